@@ -0,0 +1,102 @@
+## Logos Storage
+## Copyright (c) 2025 Status Research & Development GmbH
+## Licensed under either of
+##  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+##  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+## at your option.
+## This file may not be copied, modified, or distributed except according to
+## those terms.
+
+## Compact keys for the block addresses of the engine's internal tables.
+##
+## A `BlockAddress` carries a whole cid, which every address holds a copy of
+## and which is hashed again on every lookup, so the leaves of a dataset all
+## repeat the same tree cid. `AddressKeys` interns cids into small ids and
+## turns addresses into fixed-size keys, the id of the cid and the leaf
+## index, which are cheap to hash and compare.
+##
+## Ids are counted by the keys stored in tables: `acquire` a key when adding
+## it to a table and `release` it when removing it, so that the ids of cids
+## no table refers to anymore are recycled.
+
+{.push raises: [], gcsafe.}
+
+import std/hashes
+import std/tables
+
+import pkg/libp2p/cid
+import pkg/questionable
+
+import ../blocktype
+
+type
+  AddressKey* = object
+    id: uint32 # interned cid, or tree cid of leaves
+    index: int64 # leaf index, -1 for blocks addressed by their cid
+
+  AddressKeys* = ref object
+    ids: Table[Cid, uint32]
+    cids: seq[Cid]
+    refs: seq[int]
+    free: seq[uint32]
+
+func hash*(key: AddressKey): Hash =
+  !$(hash(key.id) !& hash(key.index))
+
+func len*(self: AddressKeys): int =
+  ## Number of cids interned
+  ##
+  self.ids.len
+
+func keyIndex(address: BlockAddress): int64 =
+  if address.leaf: address.index.int64 else: -1
+
+func lookup*(self: AddressKeys, address: BlockAddress): ?AddressKey =
+  ## Key of `address`, if its cid is interned
+  ##
+  let id = self.ids.getOrDefault(address.cidOrTreeCid, uint32.high)
+  if id == uint32.high:
+    return AddressKey.none
+
+  AddressKey(id: id, index: address.keyIndex).some
+
+proc acquire*(self: AddressKeys, address: BlockAddress): AddressKey =
+  ## Key of `address`, interning its cid if needed, to be stored in a table
+  ##
+
+  let cid = address.cidOrTreeCid
+  var id = self.ids.getOrDefault(cid, uint32.high)
+  if id == uint32.high:
+    if self.free.len > 0:
+      id = self.free.pop()
+      self.cids[id] = cid
+    else:
+      id = self.cids.len.uint32
+      self.cids.add(cid)
+      self.refs.add(0)
+    self.ids[cid] = id
+
+  inc self.refs[id]
+  AddressKey(id: id, index: address.keyIndex)
+
+proc release*(self: AddressKeys, key: AddressKey) =
+  ## Drops a key removed from a table, recycling the id of its cid when no
+  ## table refers to it anymore
+  ##
+
+  dec self.refs[key.id]
+  if self.refs[key.id] == 0:
+    self.ids.del(self.cids[key.id])
+    self.cids[key.id] = Cid()
+    self.free.add(key.id)
+
+func address*(self: AddressKeys, key: AddressKey): BlockAddress =
+  ## Address a stored key stands for
+  ##
+  if key.index < 0:
+    BlockAddress.init(self.cids[key.id])
+  else:
+    BlockAddress.init(self.cids[key.id], key.index.Natural)
+
+proc new*(T: type AddressKeys): AddressKeys =
+  AddressKeys()
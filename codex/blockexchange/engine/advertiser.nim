@@ -83,12 +83,14 @@ proc advertiseBlock(b: Advertiser, cid: Cid) {.async: (raises: [CancelledError])
 proc advertiseLocalStoreLoop(b: Advertiser) {.async: (raises: []).} =
   try:
     while b.advertiserRunning:
-      if cidsIter =? await b.localStore.listBlocks(blockType = BlockType.Manifest):
-        trace "Advertiser begins iterating blocks..."
-        for c in cidsIter:
-          if cid =? await c:
-            await b.advertiseBlock(cid)
-        trace "Advertiser iterating blocks finished."
+      # the manifest index of the store spares reading every manifest block
+      if manifests =? await b.localStore.listManifests():
+        trace "Advertiser begins iterating manifests..."
+        for m in manifests:
+          if entry =? await m:
+            await b.addCidToQueue(entry.manifestCid)
+            await b.addCidToQueue(entry.treeCid)
+        trace "Advertiser iterating manifests finished."
 
       await sleepAsync(b.advertiseLocalStoreLoopSleep)
   except CancelledError:
@@ -40,6 +40,8 @@ import ../peers
 import ./discovery
 import ./advertiser
 import ./pendingblocks
+import ./readahead
+import ./wirecompression
 
 export peers, pendingblocks, discovery
 
@@ -79,6 +81,13 @@ declareCounter(
   codex_block_exchange_requests_failed_total,
   "Total number of block requests that failed after exhausting retries",
 )
+declareCounter(
+  codex_block_exchange_busy_sent, "codex blockexchange wants turned down as busy"
+)
+declareCounter(
+  codex_block_exchange_busy_received,
+  "codex blockexchange block requests rerouted from busy peers",
+)
 
 const
   # The default max message length of nim-libp2p is 100 megabytes, meaning we can
@@ -93,6 +102,10 @@ const
   # Match MaxWantListBatchSize to efficiently respond to incoming WantLists
   PresenceBatchSize = MaxWantListBatchSize
   CleanupBatchSize = 2048
+  # Bytes of blocks each peer may send us ahead of our processing them
+  DefaultReceiveWindow* = 16.MiBs
+  # Time busy peers are told to wait before asking us for blocks again
+  BusyRetryAfter = 5.seconds
 
 type
   TaskHandler* = proc(task: BlockExcPeerCtx): Future[void] {.gcsafe.}
@@ -115,6 +128,9 @@ type
     discovery*: DiscoveryEngine
     advertiser*: Advertiser
     lastDiscRequest: Moment # time of last discovery request
+    wireCompression: WireCompression # nil unless blocks are sent compressed
+    readahead: Readahead # nil unless served datasets are read ahead
+    receiveWindow: int64 # credit granted to each peer, 0 grants none
 
 # attach task scheduler to engine
 proc scheduleTask(self: BlockExcEngine, task: BlockExcPeerCtx) {.gcsafe, raises: [].} =
@@ -146,6 +162,10 @@ proc stop*(self: BlockExcEngine) {.async: (raises: []).} =
   ##
 
   await self.trackedFutures.cancelTracked()
+  for peerCtx in self.peers:
+    await peerCtx.stopWatching()
+  if not self.readahead.isNil:
+    await self.readahead.stop()
   await self.network.stop()
   await self.discovery.stop()
   await self.advertiser.stop()
@@ -168,12 +188,35 @@ proc sendWantHave(
     await self.network.request.sendWantList(p.id, toAsk, wantType = WantType.WantHave)
     codex_block_exchange_want_have_lists_sent.inc()
 
+proc grantCredit(
+    self: BlockExcEngine, peer: BlockExcPeerCtx
+): Future[void] {.async: (raises: [CancelledError]).} =
+  ## Tops the credit granted to `peer` up to the receive window, once at least
+  ## half of it was used, so that the peer sends us blocks no faster than we
+  ## take them in
+  ##
+
+  if self.receiveWindow <= 0 or self.network.request.sendCredit.isNil:
+    return
+
+  let grant = self.receiveWindow - peer.recvCredit
+  if grant < self.receiveWindow div 2:
+    return
+
+  peer.recvCredit += grant
+  trace "Granting credit", peer = peer.id, grant
+  await self.network.request.sendCredit(peer.id, grant.uint)
+
 proc sendWantBlock(
-    self: BlockExcEngine, addresses: seq[BlockAddress], blockPeer: BlockExcPeerCtx
+    self: BlockExcEngine,
+    addresses: seq[BlockAddress],
+    blockPeer: BlockExcPeerCtx,
+    sendDontHave = false,
 ): Future[void] {.async: (raises: [CancelledError]).} =
   trace "Sending wantBlock request to", addresses, peer = blockPeer.id
+  await self.grantCredit(blockPeer)
   await self.network.request.sendWantList(
-    blockPeer.id, addresses, wantType = WantType.WantBlock
+    blockPeer.id, addresses, wantType = WantType.WantBlock, sendDontHave = sendDontHave
   ) # we want this remote to send us a block
   codex_block_exchange_want_block_lists_sent.inc()
 
@@ -313,6 +356,7 @@ proc evictPeer(self: BlockExcEngine, peer: PeerId) =
   if not peerCtx.isNil:
     for address in peerCtx.blocksRequested:
       self.pendingBlocks.clearRequest(address, peer.some)
+    peerCtx.markInactive()
 
   # drop the peer from the peers table
   self.peers.remove(peer)
@@ -337,7 +381,18 @@ proc downloadInternal(
         handle.fail(newException(RetriesExhaustedError, "Error retries exhausted"))
         break
 
-      let peers = self.peers.getPeersForBlock(address)
+      var peers = self.peers.getPeersForBlock(address)
+
+      # Peers with other blocks of the dataset likely have this one too, they
+      # are asked for it right away rather than for its presence first. Only
+      # peers answering block wants with DontHave are, others would keep the
+      # want until they time out.
+      let optimistic = peers.with.len == 0
+      if optimistic:
+        peers.with = peers.without.filterIt(
+          it.answersDontHave and it.likelyHas(address) and not it.isBusy
+        )
+
       logScope:
         peersWith = peers.with.len
         peersWithout = peers.without.len
@@ -380,16 +435,28 @@ proc downloadInternal(
         trace "No peers for block, will retry shortly"
         continue
 
+      if not self.pendingBlocks.isRequested(address) and peers.with.allIt(it.isBusy):
+        # All the peers with the block asked us to back off, waits for the
+        # first one to be available again.
+        trace "All peers with the block are busy"
+        await handle or sleepAsync(peers.with.mapIt(it.busyUntil).min - Moment.now())
+        if handle.finished:
+          break
+        continue
+
+      # Completes if the peer turns the request down as busy
+      let rerouted = self.pendingBlocks.rerouted(address)
+
       # Once again, it might happen that the block was requested to a peer
       # in the meantime. If so, we don't need to do anything. Otherwise,
       # we'll be the ones placing the request.
       let scheduledPeer =
         if not self.pendingBlocks.isRequested(address):
-          let peer = self.selectPeer(peers.with)
+          let peer = self.selectPeer(peers.with.filterIt(not it.isBusy))
           discard self.pendingBlocks.markRequested(address, peer.id)
           peer.blockRequestScheduled(address)
-          trace "Request block from block retry loop"
-          await self.sendWantBlock(@[address], peer)
+          trace "Request block from block retry loop", optimistic
+          await self.sendWantBlock(@[address], peer, sendDontHave = optimistic)
           peer
         else:
           let peerId = self.pendingBlocks.getRequestPeer(address).get()
@@ -400,10 +467,9 @@ proc downloadInternal(
         self.pendingBlocks.clearRequest(address)
         continue
 
-      # Parks until either the block is received, or the peer times out.
-      let activityTimer = scheduledPeer.activityTimer()
-      await handle or activityTimer # TODO: or peerDropped
-      activityTimer.cancel()
+      # Parks until either the block is received, the peer times out or is
+      # evicted, or the peer is too busy to send the block.
+      await handle or scheduledPeer.inactive() or rerouted
 
       # XXX: we should probably not have this. Blocks should be retried
       #   to infinity unless cancelled by the client.
@@ -412,14 +478,20 @@ proc downloadInternal(
       if handle.finished:
         trace "Handle for block finished", failed = handle.failed
         break
-      else:
-        # If the peer timed out, retries immediately.
+      elif self.pendingBlocks.getRequestPeer(address) != scheduledPeer.id.some:
+        # The request was cleared, e.g. the peer was busy, picks another peer
+        trace "Block request rerouted", peer = scheduledPeer.id
+        continue
+      elif self.peers.get(scheduledPeer.id) == scheduledPeer:
+        # If the peer timed out, retries immediately. All the requests to the
+        # peer wake up together, the first one fails the peer over and the
+        # others find it gone.
         trace "Peer timed out during block request", peer = scheduledPeer.id
         codex_block_exchange_peer_timeouts_total.inc()
-        await self.network.dropPeer(scheduledPeer.id)
         # Evicts peer immediately or we may end up picking it again in the
         # next retry.
         self.evictPeer(scheduledPeer.id)
+        await self.network.dropPeer(scheduledPeer.id)
   except CancelledError as exc:
     trace "Block download cancelled"
     if not handle.finished:
@@ -497,7 +569,7 @@ proc requestBlock*(
   self.requestBlock(BlockAddress.init(cid))
 
 proc completeBlock*(self: BlockExcEngine, address: BlockAddress, blk: Block) =
-  if address in self.pendingBlocks.blocks:
+  if address in self.pendingBlocks:
     self.pendingBlocks.completeWantHandle(address, blk)
   else:
     warn "Attempted to complete non-pending block", address
@@ -516,8 +588,26 @@ proc blockPresenceHandler*(
   peerCtx.refreshReplied()
 
   for blk in blocks:
-    if presence =? Presence.init(blk):
-      peerCtx.setPresence(presence)
+    if blk.`type` == BlockPresenceType.Busy:
+      peerCtx.markBusy(blk.retryAfter.int.milliseconds)
+      if self.pendingBlocks.getRequestPeer(blk.address) == peer.some:
+        trace "Peer busy, rerouting block request", peer, address = blk.address
+        codex_block_exchange_busy_received.inc()
+        peerCtx.blockRequestCancelled(blk.address)
+        self.pendingBlocks.reroute(blk.address)
+    elif presence =? Presence.init(blk):
+      if not presence.have and
+          self.pendingBlocks.getRequestPeer(blk.address) == peer.some:
+        # e.g. a block asked for on the strength of the peer having others of
+        # its dataset
+        trace "Peer doesn't have requested block, rerouting",
+          peer, address = blk.address
+        peerCtx.cleanPresence(blk.address)
+        peerCtx.datasetMissing(blk.address)
+        peerCtx.blockRequestCancelled(blk.address)
+        self.pendingBlocks.reroute(blk.address)
+      else:
+        peerCtx.setPresence(presence)
 
   let
     peerHave = peerCtx.peerHave
@@ -526,6 +616,9 @@ proc blockPresenceHandler*(
   if dontWantCids.len > 0:
     peerCtx.cleanPresence(dontWantCids.toSeq)
 
+  if peerCtx.isBusy:
+    return
+
   let ourWantCids = ourWantList.filterIt(
     it in peerHave and not self.pendingBlocks.retriesExhausted(it) and
       self.pendingBlocks.markRequested(it, peer)
@@ -543,27 +636,17 @@ proc blockPresenceHandler*(
       for address in ourWantCids:
         self.pendingBlocks.clearRequest(address, peer.some)
 
-proc scheduleTasks(
-    self: BlockExcEngine, blocksDelivery: seq[BlockDelivery]
-) {.async: (raises: [CancelledError]).} =
-  # schedule any new peers to provide blocks to
-  for p in self.peers:
-    for blockDelivery in blocksDelivery: # for each cid
-      # schedule a peer if it wants at least one cid
-      # and we have it in our local store
-      if blockDelivery.address in p.wantedBlocks:
-        let cid = blockDelivery.blk.cid
-        try:
-          if await (cid in self.localStore):
-            # TODO: the try/except should go away once blockstore tracks exceptions
-            self.scheduleTask(p)
-            break
-        except CancelledError as exc:
-          warn "Checking local store canceled", cid = cid, err = exc.msg
-          return
-        except CatchableError as exc:
-          error "Error checking local store for cid", cid = cid, err = exc.msg
-          raiseAssert "Unexpected error checking local store for cid"
+proc scheduleTasks(self: BlockExcEngine, blocksDelivery: seq[BlockDelivery]) =
+  ## Schedules the peers wanting any of the delivered blocks. The blocks
+  ## have just been stored, so there is no need to check the local store.
+  ##
+
+  var scheduled: HashSet[PeerId]
+  for blockDelivery in blocksDelivery:
+    for p in self.peers.peersWanting(blockDelivery.address):
+      if p.id notin scheduled:
+        scheduled.incl(p.id)
+        self.scheduleTask(p)
 
 proc cancelBlocks(
     self: BlockExcEngine, addrs: seq[BlockAddress]
@@ -571,7 +654,6 @@ proc cancelBlocks(
   ## Tells neighboring peers that we're no longer interested in a block.
   ##
 
-  let blocksDelivered = toHashSet(addrs)
   var scheduledCancellations: Table[PeerId, HashSet[BlockAddress]]
 
   if self.peers.len == 0:
@@ -589,13 +671,13 @@ proc cancelBlocks(
     return entry.peerId
 
   try:
-    for peerCtx in self.peers.peers.values:
-      # Do we have pending requests, towards this peer, for any of the blocks
-      # that were just delivered?
-      let intersection = peerCtx.blocksRequested.intersection(blocksDelivered)
-      if intersection.len > 0:
-        # If so, schedules a cancellation.
-        scheduledCancellations[peerCtx.id] = intersection
+    for address in addrs:
+      # Schedules a cancellation for every peer we still have a pending
+      # request with for a block that was just delivered.
+      for peerCtx in self.peers.peersRequested(address):
+        scheduledCancellations.mgetOrPut(peerCtx.id, initHashSet[BlockAddress]()).incl(
+          address
+        )
 
     if scheduledCancellations.len == 0:
       return
@@ -625,7 +707,7 @@ proc resolveBlocks*(
     self: BlockExcEngine, blocksDelivery: seq[BlockDelivery]
 ) {.async: (raises: [CancelledError]).} =
   self.pendingBlocks.resolve(blocksDelivery)
-  await self.scheduleTasks(blocksDelivery)
+  self.scheduleTasks(blocksDelivery)
   await self.cancelBlocks(blocksDelivery.mapIt(it.address))
 
 proc resolveBlocks*(
@@ -667,12 +749,51 @@ proc validateBlockDelivery(self: BlockExcEngine, bd: BlockDelivery): ?!void =
 
   return success()
 
+proc storeBlockDelivery(
+    self: BlockExcEngine, bd: BlockDelivery
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  if err =? (await self.localStore.putBlock(bd.blk)).errorOption:
+    return failure(err)
+
+  if bd.address.leaf:
+    without proof =? bd.proof:
+      return failure("Proof expected for a leaf block delivery")
+
+    if err =? (
+      await self.localStore.putCidAndProof(
+        bd.address.treeCid, bd.address.index, bd.blk.cid, proof
+      )
+    ).errorOption:
+      return failure(err)
+
+  success()
+
+proc storeBlockDeliveries(
+    self: BlockExcEngine, blocksDelivery: seq[BlockDelivery]
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Persists the blocks of a message in one batch, then their leaf
+  ## metadata in another
+  ##
+
+  if err =? (await self.localStore.putBlocks(blocksDelivery.mapIt(it.blk))).errorOption:
+    return failure(err)
+
+  var leaves: seq[LeafEntry]
+  for bd in blocksDelivery:
+    if bd.address.leaf:
+      without proof =? bd.proof:
+        return failure("Proof expected for a leaf block delivery")
+
+      leaves.add((bd.address.treeCid, bd.address.index, bd.blk.cid, proof))
+
+  await self.localStore.putCidsAndProofs(leaves)
+
 proc blocksDeliveryHandler*(
     self: BlockExcEngine,
     peer: PeerId,
     blocksDelivery: seq[BlockDelivery],
     allowSpurious: bool = false,
-) {.async: (raises: []).} =
+) {.async: (raises: [CancelledError]).} =
   trace "Received blocks from peer", peer, blocks = (blocksDelivery.mapIt(it.address))
 
   var validatedBlocksDelivery: seq[BlockDelivery]
@@ -686,54 +807,54 @@ proc blocksDeliveryHandler*(
       peer = peer
       address = bd.address
 
-    try:
-      # Unknown peers and unrequested blocks are dropped with a warning.
-      if not allowSpurious and (peerCtx == nil or not peerCtx.blockReceived(bd.address)):
-        warn "Dropping unrequested or duplicate block received from peer"
-        codex_block_exchange_spurious_blocks_received.inc()
-        continue
-
-      if err =? self.validateBlockDelivery(bd).errorOption:
-        warn "Block validation failed", msg = err.msg
-        continue
-
-      if err =? (await self.localStore.putBlock(bd.blk)).errorOption:
-        error "Unable to store block", err = err.msg
-        continue
+    # Unknown peers and unrequested blocks are dropped with a warning.
+    if not allowSpurious and (peerCtx == nil or not peerCtx.blockReceived(bd.address)):
+      warn "Dropping unrequested or duplicate block received from peer"
+      codex_block_exchange_spurious_blocks_received.inc()
+      continue
 
-      if bd.address.leaf:
-        without proof =? bd.proof:
-          warn "Proof expected for a leaf block delivery"
-          continue
-        if err =? (
-          await self.localStore.putCidAndProof(
-            bd.address.treeCid, bd.address.index, bd.blk.cid, proof
-          )
-        ).errorOption:
-          warn "Unable to store proof and cid for a block"
-          continue
-    except CancelledError:
-      trace "Block delivery handling cancelled"
-    except CatchableError as exc:
-      warn "Error handling block delivery", error = exc.msg
+    if err =? self.validateBlockDelivery(bd).errorOption:
+      warn "Block validation failed", msg = err.msg
       continue
 
     validatedBlocksDelivery.add(bd)
 
     if (Moment.now() - lastIdle) >= runtimeQuota:
-      try:
-        await idleAsync()
-      except CancelledError:
-        discard
-      except CatchableError:
-        discard
+      await idleAsync()
       lastIdle = Moment.now()
 
+  if not peerCtx.isNil:
+    # the blocks are in, whether they were any good or not
+    peerCtx.creditReceived(blocksDelivery.mapIt(it.blk.data.len).foldl(a + b, 0))
+
+  if err =? (await self.storeBlockDeliveries(validatedBlocksDelivery)).errorOption:
+    # fall back to storing blocks one by one, to keep the ones that can be
+    warn "Unable to store blocks in a batch", peer, err = err.msg
+
+    var stored: seq[BlockDelivery]
+    for bd in validatedBlocksDelivery:
+      if err =? (await self.storeBlockDelivery(bd)).errorOption:
+        warn "Unable to store block", peer, address = bd.address, err = err.msg
+        continue
+
+      stored.add(bd)
+
+    validatedBlocksDelivery = stored
+
   codex_block_exchange_blocks_received.inc(validatedBlocksDelivery.len.int64)
 
-  if err =? catch(await self.resolveBlocks(validatedBlocksDelivery)).errorOption:
-    warn "Error resolving blocks", err = err.msg
-    return
+  await self.resolveBlocks(validatedBlocksDelivery)
+
+  if not peerCtx.isNil and peerCtx.blocksRequested.len > 0:
+    await self.grantCredit(peerCtx)
+
+proc overloaded(self: BlockExcEngine, peerCtx: BlockExcPeerCtx): bool =
+  ## Whether we don't serve new wants of the peer now: it wants too many
+  ## blocks already, or too many peers wait to be served and it isn't one of
+  ## them. Peers which don't take busy presences keep their wants in the
+  ## latter case.
+  ##
+  not peerCtx.canWant or (self.taskQueue.full and peerCtx notin self.taskQueue)
 
 proc wantListHandler*(
     self: BlockExcEngine, peer: PeerId, wantList: WantList
@@ -745,6 +866,11 @@ proc wantListHandler*(
   if peerCtx.isNil:
     return
 
+  peerCtx.acceptsCompression = wantList.compression
+  peerCtx.acceptsBusy = wantList.busy
+  peerCtx.answersDontHave = wantList.dontHaveBlocks
+  peerCtx.expireWants()
+
   var
     presence: seq[BlockPresence]
     schedulePeer = false
@@ -791,18 +917,51 @@ proc wantListHandler*(
 
           codex_block_exchange_want_have_lists_received.inc()
         of WantType.WantBlock:
-          peerCtx.wantedBlocks.incl(e.address)
-          schedulePeer = true
+          # Protocol change: block wants used to be kept whether we had the
+          # block or not. Peers advertising `dontHaveBlocks` now expect them
+          # to be answered with DontHave when asked to, older peers never ask.
+          if e.sendDontHave and not have:
+            trace "We DON'T HAVE the wanted block", address = e.address
+            presence.add(
+              BlockPresence(address: e.address, `type`: BlockPresenceType.DontHave)
+            )
+          elif not self.overloaded(peerCtx):
+            peerCtx.blockWanted(e.address)
+            schedulePeer = true
+          elif peerCtx.acceptsBusy:
+            trace "Too busy to take the want", len = peerCtx.wantedBlocks.len
+            codex_block_exchange_busy_sent.inc()
+            presence.add(
+              BlockPresence(
+                address: e.address,
+                `type`: BlockPresenceType.Busy,
+                retryAfter: BusyRetryAfter.milliseconds.uint32,
+              )
+            )
+          elif peerCtx.canWant:
+            # the peer doesn't take busy presences, and would wait for the
+            # block anyway: keep the want, to serve once it is scheduled again
+            trace "Too busy to schedule the peer, keeping the want",
+              len = peerCtx.wantedBlocks.len
+            peerCtx.blockWanted(e.address)
+          else:
+            trace "Too many wants from the peer, ignoring it",
+              len = peerCtx.wantedBlocks.len
+            if e.sendDontHave:
+              presence.add(
+                BlockPresence(address: e.address, `type`: BlockPresenceType.DontHave)
+              )
           codex_block_exchange_want_block_lists_received.inc()
       else: # Updating existing entry in peer wants
         # peer doesn't want this block anymore
         if e.cancel:
           trace "Canceling want for block", address = e.address
-          peerCtx.wantedBlocks.excl(e.address)
+          peerCtx.blockUnwanted(e.address)
           trace "Canceled block request",
             address = e.address, len = peerCtx.wantedBlocks.len
         else:
           trace "Peer has requested a block more than once", address = e.address
+          peerCtx.wantRenewed(e.address)
           if e.wantType == WantType.WantBlock:
             schedulePeer = true
 
@@ -827,6 +986,22 @@ proc wantListHandler*(
   except CancelledError as exc: #TODO: replace with CancelledError
     warn "Error processing want list", error = exc.msg
 
+proc creditHandler*(
+    self: BlockExcEngine, peer: PeerId, bytes: uint
+) {.async: (raises: []).} =
+  ## Takes in credit granted by a peer, resuming the blocks it wants once
+  ## there is enough credit to send them
+  ##
+
+  let peerCtx = self.peers.get(peer)
+  if peerCtx.isNil:
+    return
+
+  trace "Received credit from peer", peer, bytes
+  peerCtx.creditGranted(bytes)
+  if not peerCtx.outOfCredit and peerCtx.wantedBlocks.len > 0:
+    self.scheduleTask(peerCtx)
+
 proc peerAddedHandler*(
     self: BlockExcEngine, peer: PeerId
 ) {.async: (raises: [CancelledError]).} =
@@ -856,6 +1031,23 @@ proc localLookup(
       (blk: Block) => BlockDelivery(address: address, blk: blk, proof: CodexProof.none)
     )
 
+proc lookup(
+    self: BlockExcEngine, peerCtx: BlockExcPeerCtx, address: BlockAddress
+): Future[?!BlockDelivery] {.async: (raises: [CancelledError]).} =
+  ## Looks a block up for `peerCtx`, taking it from the readahead if it was
+  ## looked up ahead of the request
+  ##
+
+  if self.readahead.isNil:
+    return await self.localLookup(address)
+
+  let prefetched = self.readahead.take(address)
+  self.readahead.observe(peerCtx.id, address)
+  if prefetched.isNil:
+    return await self.localLookup(address)
+
+  return await prefetched
+
 iterator splitBatches[T](sequence: seq[T], batchSize: int): seq[T] =
   var batch: seq[T]
   for element in sequence:
@@ -875,9 +1067,11 @@ proc taskHandler*(
 
   # Blocks that have been sent have already been picked up by other tasks and
   # should not be re-sent.
-  var
-    wantedBlocks = peerCtx.wantedBlocks.filterIt(not peerCtx.isBlockSent(it))
-    sent: HashSet[BlockAddress]
+  var wantedBlocks = peerCtx.wantedBlocks.filterIt(not peerCtx.isBlockSent(it))
+
+  # Serve the leaves of a dataset in order, for the readahead and the disk.
+  # Only leaves have an index, whole blocks go first in their own order.
+  wantedBlocks = wantedBlocks.sortedByIt((if it.leaf: it.index.int else: -1))
 
   trace "Running task for peer", peer = peerCtx.id
 
@@ -886,16 +1080,27 @@ proc taskHandler*(
 
   try:
     for batch in wantedBlocks.toSeq.splitBatches(self.maxBlocksPerMessage):
+      if peerCtx.outOfCredit:
+        trace "Peer out of credit, holding blocks back", peer = peerCtx.id
+        break
+
       var blockDeliveries: seq[BlockDelivery]
       for wantedBlock in batch:
+        if peerCtx.outOfCredit:
+          break
+
         # I/O is blocking so looking up blocks sequentially is fine.
-        without blockDelivery =? await self.localLookup(wantedBlock), err:
+        without blockDelivery =? await self.lookup(peerCtx, wantedBlock), err:
           error "Error getting block from local store",
             err = err.msg, address = wantedBlock
           peerCtx.markBlockAsNotSent(wantedBlock)
           continue
-        blockDeliveries.add(blockDelivery)
-        sent.incl(wantedBlock)
+
+        var delivery = blockDelivery
+        if not self.wireCompression.isNil and peerCtx.acceptsCompression:
+          self.wireCompression.prepare(delivery)
+        blockDeliveries.add(delivery)
+        peerCtx.creditUsed(delivery.blk.data.len)
 
       if blockDeliveries.len == 0:
         continue
@@ -907,7 +1112,8 @@ proc taskHandler*(
       # re-send them. Note that the send might still fail down the line and we will
       # have removed those anyway. At that point, we rely on the requester performing
       # a retry for the request to succeed.
-      peerCtx.wantedBlocks.keepItIf(it notin sent)
+      for bd in blockDeliveries:
+        peerCtx.blockUnwanted(bd.address)
   finally:
     # Better safe than sorry: if an exception does happen, we don't want to keep
     # those as sent, as it'll effectively prevent the blocks from ever being sent again.
@@ -974,6 +1180,9 @@ proc new*(
     maxBlocksPerMessage = DefaultMaxBlocksPerMessage,
     concurrentTasks = DefaultConcurrentTasks,
     selectPeer: PeerSelector = selectRandom,
+    wireCompression = false,
+    readaheadBlocks = 0,
+    receiveWindow = DefaultReceiveWindow,
 ): BlockExcEngine =
   ## Create new block exchange engine instance
   ##
@@ -990,8 +1199,22 @@ proc new*(
     discovery: discovery,
     advertiser: advertiser,
     selectPeer: selectPeer,
+    receiveWindow: receiveWindow.int64,
+    wireCompression:
+      if wireCompression:
+        WireCompression.new()
+      else:
+        nil,
   )
 
+  if readaheadBlocks > 0:
+    proc lookup(
+        address: BlockAddress
+    ): Future[?!BlockDelivery] {.async: (raw: true, raises: [CancelledError]).} =
+      self.localLookup(address)
+
+    self.readahead = Readahead.new(readaheadBlocks, lookup)
+
   proc blockWantListHandler(
       peer: PeerId, wantList: WantList
   ): Future[void] {.async: (raises: []).} =
@@ -1005,7 +1228,13 @@ proc new*(
   proc blocksDeliveryHandler(
       peer: PeerId, blocksDelivery: seq[BlockDelivery]
   ): Future[void] {.async: (raises: []).} =
-    self.blocksDeliveryHandler(peer, blocksDelivery)
+    try:
+      await self.blocksDeliveryHandler(peer, blocksDelivery)
+    except CancelledError:
+      trace "Block delivery handling cancelled", peer
+
+  proc creditHandler(peer: PeerId, bytes: uint): Future[void] {.async: (raises: []).} =
+    await self.creditHandler(peer, bytes)
 
   proc peerAddedHandler(
       peer: PeerId
@@ -1023,6 +1252,7 @@ proc new*(
     onPresence: blockPresenceHandler,
     onPeerJoined: peerAddedHandler,
     onPeerDeparted: peerDepartedHandler,
+    onCredit: creditHandler,
   )
 
   return self
@@ -16,8 +16,10 @@ import std/strutils
 import pkg/chronos
 import pkg/libp2p
 import pkg/metrics
+import pkg/questionable
 
 import ../protobuf/blockexc
+import ../addresskeys
 import ../../blocktype
 import ../../logutils
 
@@ -45,38 +47,51 @@ type
     requested*: ?PeerId
     blockRetries*: int
     startTime*: int64
+    rerouted: Future[void].Raising([]) # completed when the request is cleared
 
   PendingBlocksManager* = ref object of RootObj
     blockRetries*: int = DefaultBlockRetries
     retryInterval*: Duration = DefaultRetryInterval
-    blocks*: Table[BlockAddress, BlockReq] # pending Block requests
+    keys: AddressKeys # interned cids of the pending blocks
+    blocks*: Table[AddressKey, BlockReq] # pending Block requests
     lastInclusion*: Moment # time at which we last included a block into our wantlist
 
 proc updatePendingBlockGauge(p: PendingBlocksManager) =
   codex_block_exchange_pending_block_requests.set(p.blocks.len.int64)
 
+func find(self: PendingBlocksManager, address: BlockAddress): ptr BlockReq =
+  ## Pending request for `address`, if any, valid until the table changes
+  ##
+  if key =? self.keys.lookup(address):
+    self.blocks.withValue(key, pending):
+      return pending
+
 proc getWantHandle*(
     self: PendingBlocksManager, address: BlockAddress, requested: ?PeerId = PeerId.none
 ): Future[Block] {.async: (raw: true, raises: [CancelledError, RetriesExhaustedError]).} =
   ## Add an event for a block
   ##
 
-  self.blocks.withValue(address, blk):
-    return blk[].handle
-  do:
+  let pending = self.find(address)
+  if not pending.isNil:
+    return pending[].handle
+  else:
     let blk = BlockReq(
       handle: newFuture[Block]("pendingBlocks.getWantHandle"),
       requested: requested,
       blockRetries: self.blockRetries,
       startTime: getMonoTime().ticks,
     )
-    self.blocks[address] = blk
+    let key = self.keys.acquire(address)
+    self.blocks[key] = blk
     self.lastInclusion = Moment.now()
 
     let handle = blk.handle
 
     proc cleanUpBlock(data: pointer) {.raises: [].} =
-      self.blocks.del(address)
+      var req: BlockReq
+      if self.blocks.pop(key, req):
+        self.keys.release(key)
       self.updatePendingBlockGauge()
 
     handle.addCallback(cleanUpBlock)
@@ -97,14 +112,14 @@ proc completeWantHandle*(
     self: PendingBlocksManager, address: BlockAddress, blk: Block
 ) {.raises: [].} =
   ## Complete a pending want handle
-  self.blocks.withValue(address, blockReq):
-    if not blockReq[].handle.finished:
-      trace "Completing want handle from provided block", address
-      blockReq[].handle.complete(blk)
-    else:
-      trace "Want handle already completed", address
-  do:
+  let blockReq = self.find(address)
+  if blockReq.isNil:
     trace "No pending want handle found for address", address
+  elif not blockReq[].handle.finished:
+    trace "Completing want handle from provided block", address
+    blockReq[].handle.complete(blk)
+  else:
+    trace "Want handle already completed", address
 
 proc resolve*(
     self: PendingBlocksManager, blocksDelivery: seq[BlockDelivery]
@@ -113,47 +128,47 @@ proc resolve*(
   ##
 
   for bd in blocksDelivery:
-    self.blocks.withValue(bd.address, blockReq):
-      if not blockReq[].handle.finished:
-        trace "Resolving pending block", address = bd.address
-        let
-          startTime = blockReq[].startTime
-          stopTime = getMonoTime().ticks
-          retrievalDurationUs = (stopTime - startTime) div 1000
+    let blockReq = self.find(bd.address)
+    if blockReq.isNil:
+      continue
 
-        blockReq.handle.complete(bd.blk)
+    if not blockReq[].handle.finished:
+      trace "Resolving pending block", address = bd.address
+      let
+        startTime = blockReq[].startTime
+        stopTime = getMonoTime().ticks
+        retrievalDurationUs = (stopTime - startTime) div 1000
 
-        codex_block_exchange_retrieval_time_us.set(retrievalDurationUs)
-      else:
-        trace "Block handle already finished", address = bd.address
+      blockReq[].handle.complete(bd.blk)
+
+      codex_block_exchange_retrieval_time_us.set(retrievalDurationUs)
+    else:
+      trace "Block handle already finished", address = bd.address
 
 func retries*(self: PendingBlocksManager, address: BlockAddress): int =
-  self.blocks.withValue(address, pending):
-    result = pending[].blockRetries
-  do:
-    result = 0
+  let pending = self.find(address)
+  if pending.isNil: 0 else: pending[].blockRetries
 
 func decRetries*(self: PendingBlocksManager, address: BlockAddress) =
-  self.blocks.withValue(address, pending):
+  let pending = self.find(address)
+  if not pending.isNil:
     pending[].blockRetries -= 1
 
 func retriesExhausted*(self: PendingBlocksManager, address: BlockAddress): bool =
-  self.blocks.withValue(address, pending):
-    result = pending[].blockRetries <= 0
+  let pending = self.find(address)
+  not pending.isNil and pending[].blockRetries <= 0
 
 func isRequested*(self: PendingBlocksManager, address: BlockAddress): bool =
   ## Check if a block has been requested to a peer
   ##
-  result = false
-  self.blocks.withValue(address, pending):
-    result = pending[].requested.isSome
+  let pending = self.find(address)
+  not pending.isNil and pending[].requested.isSome
 
 func getRequestPeer*(self: PendingBlocksManager, address: BlockAddress): ?PeerId =
   ## Returns the peer that requested this block
   ##
-  result = PeerId.none
-  self.blocks.withValue(address, pending):
-    result = pending[].requested
+  let pending = self.find(address)
+  if pending.isNil: PeerId.none else: pending[].requested
 
 proc markRequested*(
     self: PendingBlocksManager, address: BlockAddress, peer: PeerId
@@ -164,37 +179,71 @@ proc markRequested*(
   if self.isRequested(address):
     return false
 
-  self.blocks.withValue(address, pending):
+  let pending = self.find(address)
+  if not pending.isNil:
     pending[].requested = peer.some
   return true
 
 proc clearRequest*(
     self: PendingBlocksManager, address: BlockAddress, peer: ?PeerId = PeerId.none
 ) =
-  self.blocks.withValue(address, pending):
+  let pending = self.find(address)
+  if not pending.isNil:
     if peer.isSome:
       assert peer == pending[].requested
     pending[].requested = PeerId.none
 
-func contains*(self: PendingBlocksManager, cid: Cid): bool =
-  BlockAddress.init(cid) in self.blocks
+proc rerouted*(
+    self: PendingBlocksManager, address: BlockAddress
+): Future[void].Raising([]) =
+  ## Completes once the request of the block is cleared by `reroute`
+  ##
+
+  let pending = self.find(address)
+  if pending.isNil:
+    let done = Future[void].Raising([]).init("pendingBlocks.rerouted")
+    done.complete()
+    return done
+
+  if pending[].rerouted.isNil:
+    pending[].rerouted = Future[void].Raising([]).init("pendingBlocks.rerouted")
+  pending[].rerouted
+
+proc reroute*(self: PendingBlocksManager, address: BlockAddress) =
+  ## Clears the request of a block and wakes its download up, so that the
+  ## block is requested from another peer
+  ##
+
+  let pending = self.find(address)
+  if pending.isNil:
+    return
+
+  pending[].requested = PeerId.none
+  let rerouted = pending[].rerouted
+  pending[].rerouted = nil
+  if not rerouted.isNil:
+    rerouted.complete()
 
 func contains*(self: PendingBlocksManager, address: BlockAddress): bool =
-  address in self.blocks
+  not self.find(address).isNil
+
+func contains*(self: PendingBlocksManager, cid: Cid): bool =
+  BlockAddress.init(cid) in self
 
 iterator wantList*(self: PendingBlocksManager): BlockAddress =
-  for a in self.blocks.keys:
-    yield a
+  for key in self.blocks.keys:
+    yield self.keys.address(key)
 
 iterator wantListBlockCids*(self: PendingBlocksManager): Cid =
-  for a in self.blocks.keys:
+  for key in self.blocks.keys:
+    let a = self.keys.address(key)
     if not a.leaf:
       yield a.cid
 
 iterator wantListCids*(self: PendingBlocksManager): Cid =
   var yieldedCids = initHashSet[Cid]()
-  for a in self.blocks.keys:
-    let cid = a.cidOrTreeCid
+  for key in self.blocks.keys:
+    let cid = self.keys.address(key).cidOrTreeCid
     if cid notin yieldedCids:
       yieldedCids.incl(cid)
       yield cid
@@ -214,4 +263,6 @@ func new*(
     retries = DefaultBlockRetries,
     interval = DefaultRetryInterval,
 ): PendingBlocksManager =
-  PendingBlocksManager(blockRetries: retries, retryInterval: interval)
+  PendingBlocksManager(
+    blockRetries: retries, retryInterval: interval, keys: AddressKeys.new()
+  )
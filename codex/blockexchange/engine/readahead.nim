@@ -0,0 +1,118 @@
+## Logos Storage
+## Copyright (c) 2025 Status Research & Development GmbH
+## Licensed under either of
+##  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+##  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+## at your option.
+## This file may not be copied, modified, or distributed except according to
+## those terms.
+
+## Readahead of the blocks served to peers downloading datasets.
+##
+## Peers fetch the leaves of a dataset mostly in ascending order. Once a peer
+## asked for `MinRun` leaves of a dataset in a row, the next `window` leaves
+## are looked up ahead of their requests, so that reading them from the repo
+## overlaps with sending the previous ones. At most `MaxPrefetched` lookups
+## are kept, the oldest ones are dropped first.
+
+{.push raises: [], gcsafe.}
+
+import std/tables
+
+import pkg/chronos
+import pkg/libp2p/[cid, peerid]
+import pkg/metrics
+import pkg/questionable/results
+
+import ../../blocktype
+import ../protobuf/blockexc
+
+declareCounter(
+  codex_block_exchange_readahead_hits,
+  "codex blockexchange blocks served from readahead",
+)
+
+const
+  DefaultReadaheadBlocks* = 16
+  MinRun = 2 # leaves asked in a row before reading ahead
+  MaxPrefetched = 256
+  MaxStreams = 1024
+
+type
+  Lookup* = proc(address: BlockAddress): Future[?!BlockDelivery] {.
+    async: (raises: [CancelledError])
+  .}
+
+  Prefetch* = Future[?!BlockDelivery].Raising([CancelledError])
+
+  ReadStream = object
+    next: int # leaf expected next
+    run: int # leaves asked in a row
+    ahead: int # leaves below this one are already looked up
+
+  Readahead* = ref object
+    window: int
+    lookup: Lookup
+    streams: Table[(PeerId, Cid), ReadStream]
+    prefetched: OrderedTable[BlockAddress, Prefetch]
+
+proc prefetch(self: Readahead, address: BlockAddress) =
+  if address in self.prefetched:
+    return
+
+  if self.prefetched.len >= MaxPrefetched:
+    var oldest: BlockAddress
+    for address in self.prefetched.keys:
+      oldest = address
+      break
+
+    var dropped: Prefetch
+    if self.prefetched.pop(oldest, dropped):
+      dropped.cancelSoon()
+
+  self.prefetched[address] = self.lookup(address)
+
+proc take*(self: Readahead, address: BlockAddress): Prefetch =
+  ## Lookup of `address` started ahead of its request, or nil
+  ##
+
+  if self.prefetched.pop(address, result):
+    codex_block_exchange_readahead_hits.inc()
+
+proc observe*(self: Readahead, peer: PeerId, address: BlockAddress) =
+  ## Tracks the leaves `peer` asks for, reading ahead of sequential runs
+  ##
+
+  if not address.leaf:
+    return
+
+  let key = (peer, address.treeCid)
+  if key notin self.streams and self.streams.len >= MaxStreams:
+    self.streams.clear()
+
+  var stream = self.streams.getOrDefault(key)
+  if address.index >= stream.next and address.index < stream.next + self.window:
+    inc stream.run
+  else:
+    stream.run = 1
+    stream.ahead = 0
+
+  stream.next = address.index + 1
+  if stream.run >= MinRun:
+    for index in max(stream.ahead, stream.next) ..< stream.next + self.window:
+      self.prefetch(BlockAddress.init(address.treeCid, index))
+    stream.ahead = stream.next + self.window
+
+  self.streams[key] = stream
+
+proc stop*(self: Readahead) {.async: (raises: []).} =
+  var lookups: seq[FutureBase]
+  for lookup in self.prefetched.values:
+    lookups.add(lookup.cancelAndWait())
+
+  self.prefetched.clear()
+  self.streams.clear()
+  await noCancel allFutures(lookups)
+
+proc new*(T: type Readahead, window: int, lookup: Lookup): Readahead =
+  Readahead(window: window, lookup: lookup)
@@ -0,0 +1,99 @@
+## Logos Storage
+## Copyright (c) 2025 Status Research & Development GmbH
+## Licensed under either of
+##  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+##  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+## at your option.
+## This file may not be copied, modified, or distributed except according to
+## those terms.
+
+## Compression of the blocks sent to peers which accept it, i.e. which set
+## `compression` in their want lists.
+##
+## Blocks read compressed from the repo are sent as they are stored. Other
+## blocks are compressed per dataset, according to how well the blocks of the
+## dataset compressed so far: once the first blocks show the dataset doesn't
+## compress, only one block in `ProbeInterval` is tried, so that the dataset
+## is picked up again if the data changes.
+
+{.push raises: [], gcsafe.}
+
+import std/tables
+
+import pkg/libp2p/cid
+import pkg/metrics
+import pkg/questionable
+
+import ../../blocktype
+import ../../utils/deflate
+import ../protobuf/message
+
+declareCounter(
+  codex_block_exchange_compressed_blocks_sent,
+  "codex blockexchange blocks sent compressed",
+)
+declareCounter(
+  codex_block_exchange_compression_saved_bytes,
+  "codex blockexchange bytes saved by sending blocks compressed",
+)
+
+const
+  ProbeBlocks = 8 # blocks of a dataset compressed before deciding
+  ProbeInterval = 64 # blocks of an incompressible dataset per compression try
+  MaxRatio = 0.9 # compressed to raw size ratio above which datasets are skipped
+  MaxTrackedDatasets = 4096
+
+type
+  DatasetCompression = object
+    rawBytes: int
+    compressedBytes: int
+    samples: int
+    skipped: int
+
+  WireCompression* = ref object
+    datasets: Table[Cid, DatasetCompression]
+
+func worthTrying(stats: var DatasetCompression): bool =
+  if stats.samples < ProbeBlocks or
+      stats.compressedBytes.float <= MaxRatio * stats.rawBytes.float:
+    return true
+
+  inc stats.skipped
+  if stats.skipped >= ProbeInterval:
+    stats.skipped = 0
+    return true
+
+  false
+
+proc prepare*(self: WireCompression, delivery: var BlockDelivery) =
+  ## Marks the delivery to be sent compressed, compressing the block when
+  ## that is likely to pay off
+  ##
+
+  let blk = delivery.blk
+  if blk.deflated.len == 0:
+    let dataset = delivery.address.cidOrTreeCid
+    if dataset notin self.datasets and self.datasets.len >= MaxTrackedDatasets:
+      self.datasets.clear()
+
+    var stats = self.datasets.getOrDefault(dataset)
+    if stats.worthTrying:
+      let maybeDeflated = blk.data.deflate()
+      stats.rawBytes += blk.data.len
+      stats.compressedBytes += maybeDeflated.get(blk.data).len
+      inc stats.samples
+
+      if deflated =? maybeDeflated:
+        blk.deflated = deflated
+
+    self.datasets[dataset] = stats
+
+  if blk.deflated.len > 0 and blk.deflated.len.uint <= MaxDeflatedBlockSize:
+    delivery.compressed = true
+    codex_block_exchange_compressed_blocks_sent.inc()
+    codex_block_exchange_compression_saved_bytes.inc(
+      (blk.data.len - blk.deflated.len).int64
+    )
+
+proc new*(T: type WireCompression): WireCompression =
+  WireCompression()
@@ -40,6 +40,7 @@ type
   BlockPresenceHandler* =
     proc(peer: PeerId, precense: seq[BlockPresence]) {.async: (raises: []).}
   PeerEventHandler* = proc(peer: PeerId) {.async: (raises: [CancelledError]).}
+  CreditHandler* = proc(peer: PeerId, bytes: uint) {.async: (raises: []).}
 
   BlockExcHandlers* = object
     onWantList*: WantListHandler
@@ -48,6 +49,7 @@ type
     onPeerJoined*: PeerEventHandler
     onPeerDeparted*: PeerEventHandler
     onPeerDropped*: PeerEventHandler
+    onCredit*: CreditHandler
 
   WantListSender* = proc(
     id: PeerId,
@@ -67,12 +69,15 @@ type
   PresenceSender* = proc(peer: PeerId, presence: seq[BlockPresence]) {.
     async: (raises: [CancelledError])
   .}
+  CreditSender* =
+    proc(peer: PeerId, bytes: uint) {.async: (raises: [CancelledError]).}
 
   BlockExcRequest* = object
     sendWantList*: WantListSender
     sendWantCancellations*: WantCancellationSender
     sendBlocksDelivery*: BlocksDeliverySender
     sendPresence*: PresenceSender
+    sendCredit*: CreditSender
 
   BlockExcNetwork* = ref object of LPProtocol
     peers*: Table[PeerId, NetworkPeer]
@@ -82,6 +87,7 @@ type
     getConn: ConnProvider
     inflightSema: AsyncSemaphore
     maxInflight: int = DefaultMaxInflight
+    maxPeerHandlers: int = DefaultMaxHandlers
     trackedFutures*: TrackedFutures = TrackedFutures()
 
 proc peerId*(b: BlockExcNetwork): PeerId =
@@ -124,8 +130,11 @@ proc handleWantList(
   ## Handle incoming want list
   ##
 
-  if not b.handlers.onWantList.isNil:
-    await b.handlers.onWantList(peer.id, list)
+  try:
+    if not b.handlers.onWantList.isNil:
+      await b.handlers.onWantList(peer.id, list)
+  finally:
+    peer.handlerSema.release()
 
 proc sendWantList*(
     b: BlockExcNetwork,
@@ -151,6 +160,9 @@ proc sendWantList*(
       )
     ),
     full: full,
+    compression: true, # any delivery can be decoded, compressed or not
+    busy: true, # busy peers are backed off from
+    dontHaveBlocks: true, # block wants may be answered with DontHave
   )
 
   b.send(id, Message(wantlist: msg))
@@ -168,8 +180,11 @@ proc handleBlocksDelivery(
   ## Handle incoming blocks
   ##
 
-  if not b.handlers.onBlocksDelivery.isNil:
-    await b.handlers.onBlocksDelivery(peer.id, blocksDelivery)
+  try:
+    if not b.handlers.onBlocksDelivery.isNil:
+      await b.handlers.onBlocksDelivery(peer.id, blocksDelivery)
+  finally:
+    peer.handlerSema.release()
 
 proc sendBlocksDelivery*(
     b: BlockExcNetwork, id: PeerId, blocksDelivery: seq[BlockDelivery]
@@ -185,8 +200,11 @@ proc handleBlockPresence(
   ## Handle block presence
   ##
 
-  if not b.handlers.onPresence.isNil:
-    await b.handlers.onPresence(peer.id, presence)
+  try:
+    if not b.handlers.onPresence.isNil:
+      await b.handlers.onPresence(peer.id, presence)
+  finally:
+    peer.handlerSema.release()
 
 proc sendBlockPresence*(
     b: BlockExcNetwork, id: PeerId, presence: seq[BlockPresence]
@@ -196,19 +214,43 @@ proc sendBlockPresence*(
 
   b.send(id, Message(blockPresences: @presence))
 
+proc sendCredit*(
+    b: BlockExcNetwork, id: PeerId, bytes: uint
+) {.async: (raw: true, raises: [CancelledError]).} =
+  ## Grant the remote credit for `bytes` more bytes of blocks
+  ##
+
+  b.send(id, Message(pendingBytes: bytes))
+
 proc rpcHandler(
     self: BlockExcNetwork, peer: NetworkPeer, msg: Message
 ) {.async: (raises: []).} =
   ## handle rpc messages
   ##
-  if msg.wantList.entries.len > 0:
-    self.trackedFutures.track(self.handleWantList(peer, msg.wantList))
+  ## Each part of the message is handled in the background once the peer has
+  ## a free handler slot, released when the handling is done. The read loop
+  ## of the peer waits for the slots, so it stops reading from a peer whose
+  ## handlers are all busy. Credit is taken right away, ahead of the rest of
+  ## the message.
+  ##
+
+  try:
+    if msg.pendingBytes > 0 and not self.handlers.onCredit.isNil:
+      await self.handlers.onCredit(peer.id, msg.pendingBytes)
+
+    if msg.wantList.entries.len > 0:
+      await peer.handlerSema.acquire()
+      self.trackedFutures.track(self.handleWantList(peer, msg.wantList))
 
-  if msg.payload.len > 0:
-    self.trackedFutures.track(self.handleBlocksDelivery(peer, msg.payload))
+    if msg.payload.len > 0:
+      await peer.handlerSema.acquire()
+      self.trackedFutures.track(self.handleBlocksDelivery(peer, msg.payload))
 
-  if msg.blockPresences.len > 0:
-    self.trackedFutures.track(self.handleBlockPresence(peer, msg.blockPresences))
+    if msg.blockPresences.len > 0:
+      await peer.handlerSema.acquire()
+      self.trackedFutures.track(self.handleBlockPresence(peer, msg.blockPresences))
+  except CancelledError:
+    trace "Cancelled handling message", peer = peer.id
 
 proc getOrCreatePeer(self: BlockExcNetwork, peer: PeerId): NetworkPeer =
   ## Creates or retrieves a BlockExcNetwork Peer
@@ -235,7 +277,8 @@ proc getOrCreatePeer(self: BlockExcNetwork, peer: PeerId): NetworkPeer =
     await self.rpcHandler(p, msg)
 
   # create new pubsub peer
-  let blockExcPeer = NetworkPeer.new(peer, getConn, rpcHandler)
+  let blockExcPeer =
+    NetworkPeer.new(peer, getConn, rpcHandler, maxHandlers = self.maxPeerHandlers)
   debug "Created new blockexc peer", peer
 
   self.peers[peer] = blockExcPeer
@@ -323,6 +366,7 @@ proc new*(
     switch: Switch,
     connProvider: ConnProvider = nil,
     maxInflight = DefaultMaxInflight,
+    maxPeerHandlers = DefaultMaxHandlers,
 ): BlockExcNetwork =
   ## Create a new BlockExcNetwork instance
   ##
@@ -332,6 +376,7 @@ proc new*(
     getConn: connProvider,
     inflightSema: newAsyncSemaphore(maxInflight),
     maxInflight: maxInflight,
+    maxPeerHandlers: maxPeerHandlers,
   )
 
   self.maxIncomingStreams = self.maxInflight
@@ -362,11 +407,17 @@ proc new*(
   ): Future[void] {.async: (raw: true, raises: [CancelledError]).} =
     self.sendBlockPresence(id, presence)
 
+  proc sendCredit(
+      id: PeerId, bytes: uint
+  ): Future[void] {.async: (raw: true, raises: [CancelledError]).} =
+    self.sendCredit(id, bytes)
+
   self.request = BlockExcRequest(
     sendWantList: sendWantList,
     sendWantCancellations: sendWantCancellations,
     sendBlocksDelivery: sendBlocksDelivery,
     sendPresence: sendPresence,
+    sendCredit: sendCredit,
   )
 
   self.init()
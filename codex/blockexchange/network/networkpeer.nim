@@ -11,6 +11,7 @@
 
 import pkg/chronos
 import pkg/libp2p
+import pkg/libp2p/utils/semaphore
 
 import ../protobuf/blockexc
 import ../protobuf/message
@@ -21,7 +22,9 @@ import ../../utils/trackedfutures
 logScope:
   topics = "codex blockexcnetworkpeer"
 
-const DefaultYieldInterval = 50.millis
+const
+  DefaultYieldInterval = 50.millis
+  DefaultMaxHandlers* = 8 # parts of the peer's messages handled at once
 
 type
   ConnProvider* = proc(): Future[Connection] {.async: (raises: [CancelledError]).}
@@ -35,6 +38,9 @@ type
     getConn: ConnProvider
     yieldInterval*: Duration = DefaultYieldInterval
     trackedFutures: TrackedFutures
+    handlerSema*: AsyncSemaphore
+      # Bounds the handlers running for the peer. Acquired before reading on,
+      # so that a peer outpacing its handlers is held back by its connection.
 
 proc connected*(self: NetworkPeer): bool =
   not (isNil(self.sendConn)) and not (self.sendConn.closed or self.sendConn.atEof)
@@ -102,6 +108,7 @@ func new*(
     peer: PeerId,
     connProvider: ConnProvider,
     rpcHandler: RPCHandler,
+    maxHandlers = DefaultMaxHandlers,
 ): NetworkPeer =
   doAssert(not isNil(connProvider), "should supply connection provider")
 
@@ -110,4 +117,5 @@ func new*(
     getConn: connProvider,
     handler: rpcHandler,
     trackedFutures: TrackedFutures(),
+    handlerSema: newAsyncSemaphore(max(1, maxHandlers)),
   )
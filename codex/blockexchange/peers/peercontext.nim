@@ -7,6 +7,7 @@
 ## This file may not be copied, modified, or distributed except according to
 ## those terms.
 
+import std/algorithm
 import std/sequtils
 import std/tables
 import std/sets
@@ -17,6 +18,7 @@ import pkg/questionable
 
 import ../protobuf/blockexc
 import ../protobuf/presence
+import ../addresskeys
 
 import ../../blocktype
 import ../../logutils
@@ -25,21 +27,118 @@ const
   MinRefreshInterval = 1.seconds
   MaxRefreshBackoff = 36 # 36 seconds
   MaxWantListBatchSize* = 1024 # Maximum blocks to send per WantList message
+  MaxPeerPresence* = 1 shl 16 # Remote have entries kept per peer
+  MaxPeerWants* = 1 shl 16 # Blocks a peer may want from us at once
+  PresenceTtl* = 10.minutes # Remote have entries are dropped after this long
+  PresenceSweepInterval = 1.minutes
+  WantsTtl* = 10.minutes # Wants not renewed for this long are dropped
+  MaxCredit* = 1'i64 shl 40 # Send credit a peer may grant us at most
+  MaxBusyBackoff* = 30.seconds # Longest a busy peer is left alone for
+  MaxPeerDatasets = 1024 # Datasets a peer is known to have blocks of, kept
 
-type BlockExcPeerCtx* = ref object of RootObj
-  id*: PeerId
-  blocks*: Table[BlockAddress, Presence] # remote peer have list
-  wantedBlocks*: HashSet[BlockAddress] # blocks that the peer wants
-  exchanged*: int # times peer has exchanged with us
-  refreshInProgress*: bool # indicates if a refresh is in progress
-  lastRefresh*: Moment # last time we refreshed our knowledge of the blocks this peer has
-  refreshBackoff*: int = 1 # backoff factor for refresh requests
-  blocksSent*: HashSet[BlockAddress] # blocks sent to peer
-  blocksRequested*: HashSet[BlockAddress] # pending block requests to this peer
-  lastExchange*: Moment # last time peer has sent us a block
-  activityTimeout*: Duration
-  lastSentWants*: HashSet[BlockAddress]
-    # track what wantList we last sent for delta updates
+type
+  PeerBlockIndex* = ref object
+    ## Reverse indexes over the peers of a store, from a block to the peers
+    ## wanting it from us and to the peers we requested it from. Kept up to
+    ## date by the want and request tracking procs below.
+    keys*: AddressKeys
+    wanting*: Table[AddressKey, HashSet[PeerId]]
+    requested*: Table[AddressKey, HashSet[PeerId]]
+
+  BlockExcPeerCtx* = ref object of RootObj
+    id*: PeerId
+    blocks*: Table[BlockAddress, Presence] # remote peer have list
+    wants: HashSet[BlockAddress] # blocks that the peer wants
+    exchanged*: int # times peer has exchanged with us
+    refreshInProgress*: bool # indicates if a refresh is in progress
+    lastRefresh*: Moment # last time we refreshed our knowledge of the blocks this peer has
+    refreshBackoff*: int = 1 # backoff factor for refresh requests
+    blocksSent*: HashSet[BlockAddress] # blocks sent to peer
+    requests: HashSet[BlockAddress] # pending block requests to this peer
+    lastExchange*: Moment # last time peer has sent us a block
+    activityTimeout*: Duration
+    inactivity: Future[void] # completed when the peer is found inactive
+    watchdog: Future[void] # single activity timer of the peer
+    lastSentWants*: HashSet[BlockAddress]
+      # track what wantList we last sent for delta updates
+    acceptsCompression*: bool # peer takes compressed block deliveries
+    flowControlled*: bool # peer grants credit for the blocks we send it
+    sendCredit*: int64 # bytes of blocks the peer lets us send it
+    recvCredit*: int64 # bytes of blocks we let the peer send us, not received yet
+    acceptsBusy*: bool # peer takes busy presences instead of our wants
+    answersDontHave*: bool # peer answers block wants it can't serve, if asked
+    busyUntil*: Moment # peer asked us not to request blocks before then
+    datasets: HashSet[Cid] # datasets the peer has or sent us blocks of
+    presenceSwept: Moment # last time expired remote haves were dropped
+    wantsRenewed: HashSet[BlockAddress] # wants added or renewed since `wantsEpoch`
+    wantsEpoch: Moment # start of the current generation of wants
+    index: PeerBlockIndex # reverse index of the store holding this peer
+
+proc new*(T: type PeerBlockIndex): PeerBlockIndex =
+  PeerBlockIndex(keys: AddressKeys.new())
+
+func wantedBlocks*(self: BlockExcPeerCtx): lent HashSet[BlockAddress] =
+  ## Blocks that the peer wants from us. Read only, use `blockWanted` and
+  ## `blockUnwanted` to change them, so that the store index stays in sync.
+  self.wants
+
+func blocksRequested*(self: BlockExcPeerCtx): lent HashSet[BlockAddress] =
+  ## Blocks we requested from the peer and have not received yet. Read only,
+  ## use `blockRequestScheduled` and `blockRequestCancelled` to change them.
+  self.requests
+
+proc incl(
+    index: PeerBlockIndex,
+    table: var Table[AddressKey, HashSet[PeerId]],
+    address: BlockAddress,
+    peer: PeerId,
+) =
+  var found = false
+  if key =? index.keys.lookup(address):
+    table.withValue(key, peers):
+      peers[].incl(peer)
+      found = true
+
+  if not found:
+    table[index.keys.acquire(address)] = [peer].toHashSet
+
+proc excl(
+    index: PeerBlockIndex,
+    table: var Table[AddressKey, HashSet[PeerId]],
+    address: BlockAddress,
+    peer: PeerId,
+) =
+  without key =? index.keys.lookup(address):
+    return
+
+  var empty = false
+  table.withValue(key, peers):
+    peers[].excl(peer)
+    empty = peers[].len == 0
+
+  if empty:
+    table.del(key)
+    index.keys.release(key)
+
+proc detach*(self: BlockExcPeerCtx) =
+  ## Drops the wants and pending requests of the peer from its index
+  ##
+  if not self.index.isNil:
+    for address in self.wants:
+      self.index.excl(self.index.wanting, address, self.id)
+    for address in self.requests:
+      self.index.excl(self.index.requested, address, self.id)
+    self.index = nil
+
+proc attach*(self: BlockExcPeerCtx, index: PeerBlockIndex) =
+  ## Registers the wants and pending requests of the peer in `index`
+  ##
+  self.detach()
+  self.index = index
+  for address in self.wants:
+    index.incl(index.wanting, address, self.id)
+  for address in self.requests:
+    index.incl(index.requested, address, self.id)
 
 proc isKnowledgeStale*(self: BlockExcPeerCtx): bool =
   let staleness =
@@ -86,12 +185,6 @@ proc peerHave*(self: BlockExcPeerCtx): HashSet[BlockAddress] =
 proc contains*(self: BlockExcPeerCtx, address: BlockAddress): bool =
   address in self.blocks
 
-func setPresence*(self: BlockExcPeerCtx, presence: Presence) =
-  if presence.address notin self.blocks:
-    self.havesUpdated()
-
-  self.blocks[presence.address] = presence
-
 func cleanPresence*(self: BlockExcPeerCtx, addresses: seq[BlockAddress]) =
   for a in addresses:
     self.blocks.del(a)
@@ -99,35 +192,208 @@ func cleanPresence*(self: BlockExcPeerCtx, addresses: seq[BlockAddress]) =
 func cleanPresence*(self: BlockExcPeerCtx, address: BlockAddress) =
   self.cleanPresence(@[address])
 
+proc prunePresence(self: BlockExcPeerCtx, now: Moment) =
+  ## Drops the remote haves the peer hasn't confirmed for `PresenceTtl` and,
+  ## past `MaxPeerPresence` entries, the oldest ones, down to 3/4 of the
+  ## limit so that the cost is amortized over the following inserts
+  ##
+
+  if self.blocks.len <= MaxPeerPresence:
+    if self.presenceSwept == default(Moment):
+      self.presenceSwept = now
+    if now - self.presenceSwept < PresenceSweepInterval:
+      return
+
+  self.presenceSwept = now
+  self.cleanPresence(
+    toSeq(self.blocks.values).filterIt(now - it.seen > PresenceTtl).mapIt(it.address)
+  )
+
+  if self.blocks.len > MaxPeerPresence:
+    let oldest = toSeq(self.blocks.values).sortedByIt(it.seen)
+    for presence in oldest[0 ..< self.blocks.len - MaxPeerPresence * 3 div 4]:
+      self.blocks.del(presence.address)
+
+proc datasetSeen(self: BlockExcPeerCtx, address: BlockAddress) =
+  if not address.leaf or address.treeCid in self.datasets:
+    return
+
+  if self.datasets.len >= MaxPeerDatasets:
+    self.datasets.clear()
+  self.datasets.incl(address.treeCid)
+
+proc datasetMissing*(self: BlockExcPeerCtx, address: BlockAddress) =
+  ## Stops taking the peer for a holder of the whole dataset of `address`,
+  ## which it doesn't have
+  ##
+  if address.leaf:
+    self.datasets.excl(address.treeCid)
+
+proc likelyHas*(self: BlockExcPeerCtx, address: BlockAddress): bool =
+  ## Whether the peer likely has the block without having told us so: it has
+  ## or sent us other blocks of the dataset
+  ##
+  address.leaf and address.treeCid in self.datasets and address notin self.blocks
+
+proc setPresence*(self: BlockExcPeerCtx, presence: Presence) =
+  if presence.address notin self.blocks:
+    self.havesUpdated()
+
+  if presence.have:
+    self.datasetSeen(presence.address)
+
+  let now = Moment.now()
+  var presence = presence
+  presence.seen = now
+  self.blocks[presence.address] = presence
+  self.prunePresence(now)
+
+proc canWant*(self: BlockExcPeerCtx): bool =
+  ## Whether the peer may want more blocks from us
+  self.wants.len < MaxPeerWants
+
+proc blockWanted*(self: BlockExcPeerCtx, address: BlockAddress) =
+  ## Adds a block to the set of blocks that the peer wants from us
+  self.wants.incl(address)
+  self.wantsRenewed.incl(address)
+  if not self.index.isNil:
+    self.index.incl(self.index.wanting, address, self.id)
+
+proc blockUnwanted*(self: BlockExcPeerCtx, address: BlockAddress) =
+  ## Removes a block from the set of blocks that the peer wants from us
+  self.wants.excl(address)
+  self.wantsRenewed.excl(address)
+  if not self.index.isNil:
+    self.index.excl(self.index.wanting, address, self.id)
+
+proc wantRenewed*(self: BlockExcPeerCtx, address: BlockAddress) =
+  ## The peer asked again for a block it already wanted
+  if address in self.wants:
+    self.wantsRenewed.incl(address)
+
+proc expireWants*(self: BlockExcPeerCtx) =
+  ## Drops the wants the peer has neither added nor renewed for a whole
+  ## generation of `WantsTtl`, e.g. for blocks we never had. Blocks being
+  ## sent are kept.
+  ##
+
+  let now = Moment.now()
+  if self.wantsEpoch == default(Moment):
+    self.wantsEpoch = now
+  if now - self.wantsEpoch < WantsTtl:
+    return
+
+  let expired = self.wants.filterIt(
+    it notin self.wantsRenewed and not self.isBlockSent(it)
+  )
+  for address in expired:
+    self.blockUnwanted(address)
+
+  trace "Expired peer wants", peer = self.id, expired = expired.len
+  self.wantsRenewed.clear()
+  self.wantsEpoch = now
+
 proc blockRequestScheduled*(self: BlockExcPeerCtx, address: BlockAddress) =
   ## Adds a block the set of blocks that have been requested to this peer
   ## (its request schedule).
-  if self.blocksRequested.len == 0:
+  if self.requests.len == 0:
     self.lastExchange = Moment.now()
-  self.blocksRequested.incl(address)
+  self.requests.incl(address)
+  if not self.index.isNil:
+    self.index.incl(self.index.requested, address, self.id)
 
 proc blockRequestCancelled*(self: BlockExcPeerCtx, address: BlockAddress) =
   ## Removes a block from the set of blocks that have been requested to this peer
   ## (its request schedule).
-  self.blocksRequested.excl(address)
+  self.requests.excl(address)
+  if not self.index.isNil:
+    self.index.excl(self.index.requested, address, self.id)
 
 proc blockReceived*(self: BlockExcPeerCtx, address: BlockAddress): bool =
-  let wasRequested = address in self.blocksRequested
-  self.blocksRequested.excl(address)
+  let wasRequested = address in self.requests
+  self.blockRequestCancelled(address)
   self.lastExchange = Moment.now()
+  if wasRequested:
+    self.datasetSeen(address)
   wasRequested
 
-proc activityTimer*(
-    self: BlockExcPeerCtx
-): Future[void] {.async: (raises: [CancelledError]).} =
-  ## This is called by the block exchange when a block is scheduled for this peer.
-  ## If the peer sends no blocks for a while, it is considered inactive/uncooperative
-  ## and the peer is dropped. Note that ANY block that the peer sends will reset this
-  ## timer for all blocks.
+func outOfCredit*(self: BlockExcPeerCtx): bool =
+  ## Whether the peer grants credit and we used it all
   ##
-  while true:
-    let idleTime = Moment.now() - self.lastExchange
-    if idleTime > self.activityTimeout:
-      return
+  self.flowControlled and self.sendCredit <= 0
+
+proc creditGranted*(self: BlockExcPeerCtx, bytes: uint) =
+  ## Adds credit granted by the peer. Peers which never grant credit are
+  ## sent blocks without limit.
+  ##
+  self.flowControlled = true
+  self.sendCredit = min(self.sendCredit + min(bytes, MaxCredit.uint).int64, MaxCredit)
+
+proc creditUsed*(self: BlockExcPeerCtx, bytes: int) =
+  ## Takes the size of the blocks sent to the peer from its credit. The last
+  ## block sent may take it below zero, so that blocks larger than the credit
+  ## are still sent.
+  ##
+  if self.flowControlled:
+    self.sendCredit -= bytes
+
+proc creditReceived*(self: BlockExcPeerCtx, bytes: int) =
+  ## Takes the size of the blocks the peer sent us from the credit we granted
+  ##
+  self.recvCredit = max(0, self.recvCredit - bytes)
+
+proc markBusy*(self: BlockExcPeerCtx, retryAfter: Duration) =
+  ## Leaves the peer alone for `retryAfter`, at most `MaxBusyBackoff`
+  ##
+  self.busyUntil = max(self.busyUntil, Moment.now() + min(retryAfter, MaxBusyBackoff))
+
+proc isBusy*(self: BlockExcPeerCtx): bool =
+  self.busyUntil > Moment.now()
+
+proc markInactive*(self: BlockExcPeerCtx) =
+  ## Wakes up all the requests waiting on the peer at once, so that they
+  ## are failed over to other peers, and stops watching it
+  ##
+  if not self.inactivity.isNil and not self.inactivity.finished:
+    self.inactivity.complete()
+
+  if not self.watchdog.isNil and not self.watchdog.finished:
+    self.watchdog.cancelSoon()
+  self.watchdog = nil
+
+proc watchActivity(self: BlockExcPeerCtx) {.async: (raises: []).} =
+  try:
+    while true:
+      let idleTime = Moment.now() - self.lastExchange
+      if idleTime > self.activityTimeout:
+        trace "Peer inactive", peer = self.id, idleTime
+        self.watchdog = nil
+        self.markInactive()
+        return
+
+      await sleepAsync(self.activityTimeout - idleTime)
+  except CancelledError:
+    trace "Peer activity watchdog cancelled", peer = self.id
+
+proc stopWatching*(self: BlockExcPeerCtx) {.async: (raises: []).} =
+  ## Stops the activity watchdog of the peer, if any, once it is done with
+  ## it, leaving the requests waiting on the peer as they are
+  ##
+  let watchdog = self.watchdog
+  self.watchdog = nil
+  if not watchdog.isNil:
+    await watchdog.cancelAndWait()
+
+proc inactive*(self: BlockExcPeerCtx): Future[void] =
+  ## Completes when the peer has sent no blocks for `activityTimeout`, at which
+  ## point it is considered inactive/uncooperative and dropped. All the
+  ## requests scheduled for the peer wait on this same future, watched by a
+  ## single timer, and ANY block that the peer sends resets that timer.
+  ##
+  if self.inactivity.isNil or self.inactivity.finished:
+    self.inactivity = newFuture[void]("BlockExcPeerCtx.inactive")
+
+  if self.watchdog.isNil:
+    self.watchdog = self.watchActivity()
 
-    await sleepAsync(self.activityTimeout - idleTime)
+  self.inactivity
@@ -11,13 +11,16 @@
 
 import std/sequtils
 import std/tables
+import std/sets
 import std/algorithm
 import std/sequtils
 
 import pkg/chronos
 import pkg/libp2p
+import pkg/questionable
 
 import ../protobuf/blockexc
+import ../addresskeys
 import ../../blocktype
 import ../../logutils
 
@@ -30,6 +33,7 @@ logScope:
 type
   PeerCtxStore* = ref object of RootObj
     peers*: OrderedTable[PeerId, BlockExcPeerCtx]
+    index: PeerBlockIndex
 
   PeersForBlock* = tuple[with: seq[BlockExcPeerCtx], without: seq[BlockExcPeerCtx]]
 
@@ -49,10 +53,20 @@ func peerIds*(self: PeerCtxStore): seq[PeerId] =
 func contains*(self: PeerCtxStore, peerId: PeerId): bool =
   peerId in self.peers
 
-func add*(self: PeerCtxStore, peer: BlockExcPeerCtx) =
+proc add*(self: PeerCtxStore, peer: BlockExcPeerCtx) =
+  if self.index.isNil:
+    self.index = PeerBlockIndex.new()
+
+  self.peers.withValue(peer.id, existing):
+    existing[].detach()
+
+  peer.attach(self.index)
   self.peers[peer.id] = peer
 
-func remove*(self: PeerCtxStore, peerId: PeerId) =
+proc remove*(self: PeerCtxStore, peerId: PeerId) =
+  self.peers.withValue(peerId, peer):
+    peer[].detach()
+
   self.peers.del(peerId)
 
 func get*(self: PeerCtxStore, peerId: PeerId): BlockExcPeerCtx =
@@ -75,6 +89,36 @@ func peersWant*(self: PeerCtxStore, cid: Cid): seq[BlockExcPeerCtx] =
   # FIXME: this is way slower and can end up leading to unexpected performance loss.
   toSeq(self.peers.values).filterIt(it.wantedBlocks.anyIt(it.cidOrTreeCid == cid))
 
+proc peersFromIndex(
+    self: PeerCtxStore, table: Table[AddressKey, HashSet[PeerId]], address: BlockAddress
+): seq[BlockExcPeerCtx] =
+  without key =? self.index.keys.lookup(address):
+    return
+
+  for peerId in table.getOrDefault(key):
+    let peer = self.peers.getOrDefault(peerId, nil)
+    if not peer.isNil:
+      result.add(peer)
+
+proc peersWanting*(self: PeerCtxStore, address: BlockAddress): seq[BlockExcPeerCtx] =
+  ## Peers that asked us for the block, looked up in the reverse index
+  ##
+  if self.index.isNil:
+    return
+
+  self.peersFromIndex(self.index.wanting, address)
+
+proc peersRequested*(
+    self: PeerCtxStore, address: BlockAddress
+): seq[BlockExcPeerCtx] =
+  ## Peers we have a pending request for the block with, looked up in the
+  ## reverse index
+  ##
+  if self.index.isNil:
+    return
+
+  self.peersFromIndex(self.index.requested, address)
+
 proc getPeersForBlock*(self: PeerCtxStore, address: BlockAddress): PeersForBlock =
   var res: PeersForBlock = (@[], @[])
   for peer in self:
@@ -86,4 +130,6 @@ proc getPeersForBlock*(self: PeerCtxStore, address: BlockAddress): PeersForBlock
 
 proc new*(T: type PeerCtxStore): PeerCtxStore =
   ## create new instance of a peer context store
-  PeerCtxStore(peers: initOrderedTable[PeerId, BlockExcPeerCtx]())
+  PeerCtxStore(
+    peers: initOrderedTable[PeerId, BlockExcPeerCtx](), index: PeerBlockIndex.new()
+  )
@@ -13,10 +13,13 @@ import ../../units
 
 import ../../merkletree
 import ../../blocktype
+import ../../utils/deflate
 
 const
   MaxBlockSize* = 100.MiBs.uint
   MaxMessageSize* = 100.MiBs.uint
+  # bounds the size of inflated blocks, whatever the size they claim to have
+  MaxDeflatedBlockSize* = MaxBlockSize div MaxDeflateRatio
 
 type
   WantType* = enum
@@ -38,19 +41,26 @@ type
   WantList* = object
     entries*: seq[WantListEntry] # A list of wantList entries
     full*: bool # Whether this is the full wantList. default to false
+    compression*: bool # Whether the sender accepts compressed deliveries
+    busy*: bool # Whether the sender accepts busy presences
+    dontHaveBlocks*: bool
+      # Whether the sender answers block wants it can't serve with DontHave
 
   BlockDelivery* = object
     blk*: Block
     address*: BlockAddress
     proof*: ?CodexProof # Present only if `address.leaf` is true
+    compressed*: bool # Send `blk.deflated` instead of the block data
 
   BlockPresenceType* = enum
     Have = 0
     DontHave = 1
+    Busy = 2 # Overloaded, the block is to be requested from other peers
 
   BlockPresence* = object
     address*: BlockAddress
     `type`*: BlockPresenceType
+    retryAfter*: uint32 # Busy only: milliseconds before asking again
 
   StateChannelUpdate* = object
     update*: seq[byte] # Signed Nitro state, serialized as JSON
@@ -91,13 +101,20 @@ proc write*(pb: var ProtoBuffer, field: int, value: WantList) =
   for v in value.entries:
     ipb.write(1, v)
   ipb.write(2, value.full.uint)
+  ipb.write(3, value.compression.uint)
+  ipb.write(4, value.busy.uint)
+  ipb.write(5, value.dontHaveBlocks.uint)
   ipb.finish()
   pb.write(field, ipb)
 
 proc write*(pb: var ProtoBuffer, field: int, value: BlockDelivery) =
   var ipb = initProtoBuffer()
   ipb.write(1, value.blk.cid.data.buffer)
-  ipb.write(2, value.blk.data)
+  if value.compressed and value.blk.deflated.len > 0:
+    ipb.write(5, value.blk.deflated)
+    ipb.write(6, value.blk.data.len.uint64)
+  else:
+    ipb.write(2, value.blk.data)
   ipb.write(3, value.address)
   if value.address.leaf:
     if proof =? value.proof:
@@ -109,6 +126,8 @@ proc write*(pb: var ProtoBuffer, field: int, value: BlockPresence) =
   var ipb = initProtoBuffer()
   ipb.write(1, value.address)
   ipb.write(2, value.`type`.uint)
+  if value.`type` == BlockPresenceType.Busy:
+    ipb.write(3, value.retryAfter.uint64)
   ipb.finish()
   pb.write(field, ipb)
 
@@ -180,9 +199,22 @@ proc decode*(_: type WantList, pb: ProtoBuffer): ProtoResult[WantList] =
       value.entries.add(?WantListEntry.decode(initProtoBuffer(item)))
   if ?pb.getField(2, field):
     value.full = bool(field)
+  if ?pb.getField(3, field):
+    value.compression = bool(field)
+  if ?pb.getField(4, field):
+    value.busy = bool(field)
+  if ?pb.getField(5, field):
+    value.dontHaveBlocks = bool(field)
   ok(value)
 
-proc decode*(_: type BlockDelivery, pb: ProtoBuffer): ProtoResult[BlockDelivery] =
+proc decode*(
+    _: type BlockDelivery, pb: ProtoBuffer, inflateBudget: var uint
+): ProtoResult[BlockDelivery] =
+  ## Decodes a delivery, inflating compressed blocks within `inflateBudget`,
+  ## the bytes left to inflate for the message. Deflated data is never larger
+  ## than the block it stands for, nor is the block larger than the budget,
+  ## and it is never inflated past that size, see `inflate`.
+  ##
   var
     value = BlockDelivery()
     dataBuf = newSeq[byte]()
@@ -195,6 +227,18 @@ proc decode*(_: type BlockDelivery, pb: ProtoBuffer): ProtoResult[BlockDelivery]
   if ?pb.getField(2, dataBuf):
     value.blk =
       ?Block.new(cid, dataBuf, verify = true).mapErr(x => ProtoError.IncorrectBlob)
+  elif ?pb.getField(5, dataBuf):
+    var size: uint64
+    if not ?pb.getField(6, size) or size > min(MaxBlockSize, inflateBudget).uint64 or
+        dataBuf.len.uint64 > min(size, MaxDeflatedBlockSize.uint64):
+      return err(ProtoError.IncorrectBlob)
+
+    inflateBudget -= size.uint
+    let data = ?dataBuf.inflate(size.int).mapErr(x => ProtoError.IncorrectBlob)
+    value.blk =
+      ?Block.new(cid, data, verify = true).mapErr(x => ProtoError.IncorrectBlob)
+    value.blk.deflated = dataBuf
+    value.compressed = true
   if ?pb.getField(3, ipb):
     value.address = ?BlockAddress.decode(ipb)
 
@@ -218,20 +262,30 @@ proc decode*(_: type BlockPresence, pb: ProtoBuffer): ProtoResult[BlockPresence]
   if ?pb.getField(1, ipb):
     value.address = ?BlockAddress.decode(ipb)
   if ?pb.getField(2, field):
+    if field > BlockPresenceType.high.uint64:
+      return err(ProtoError.IncorrectBlob)
     value.`type` = BlockPresenceType(field)
+  if ?pb.getField(3, field):
+    value.retryAfter = min(field, uint32.high.uint64).uint32
   ok(value)
 
-proc protobufDecode*(_: type Message, msg: seq[byte]): ProtoResult[Message] =
+proc protobufDecode*(
+    _: type Message, msg: seq[byte], maxInflated = MaxMessageSize
+): ProtoResult[Message] =
+  ## Decodes a message, rejecting it if its compressed blocks inflate to more
+  ## than `maxInflated` bytes in total
+  ##
   var
     value = Message()
     pb = initProtoBuffer(msg)
     ipb: ProtoBuffer
     sublist: seq[seq[byte]]
+    inflateBudget = maxInflated
   if ?pb.getField(1, ipb):
     value.wantList = ?WantList.decode(ipb)
   if ?pb.getRepeatedField(3, sublist): # meant to be 2?
     for item in sublist:
-      value.payload.add(?BlockDelivery.decode(initProtoBuffer(item)))
+      value.payload.add(?BlockDelivery.decode(initProtoBuffer(item), inflateBudget))
   if ?pb.getRepeatedField(4, sublist):
     for item in sublist:
       value.blockPresences.add(?BlockPresence.decode(initProtoBuffer(item)))
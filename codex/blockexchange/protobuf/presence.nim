@@ -1,6 +1,7 @@
 {.push raises: [].}
 
 import libp2p
+import pkg/chronos
 import pkg/stint
 import pkg/questionable
 import pkg/questionable/results
@@ -17,6 +18,7 @@ type
   Presence* = object
     address*: BlockAddress
     have*: bool
+    seen*: Moment # when the peer last told us about the block
 
 func parse(_: type UInt256, bytes: seq[byte]): ?UInt256 =
   if bytes.len > 32:
@@ -24,6 +26,10 @@ func parse(_: type UInt256, bytes: seq[byte]): ?UInt256 =
   UInt256.fromBytesBE(bytes).some
 
 func init*(_: type Presence, message: PresenceMessage): ?Presence =
+  if message.`type` == BlockPresenceType.Busy:
+    # says nothing about whether the peer has the block
+    return Presence.none
+
   some Presence(
     address: message.address, have: message.`type` == BlockPresenceType.Have
   )
@@ -16,7 +16,7 @@ export tables
 {.push raises: [], gcsafe.}
 
 import pkg/libp2p/[cid, multicodec, multihash]
-import pkg/stew/[byteutils, endians2]
+import pkg/stew/byteutils
 import pkg/questionable
 import pkg/questionable/results
 
@@ -33,6 +33,7 @@ type
   Block* = ref object of RootObj
     cid*: Cid
     data*: seq[byte]
+    deflated*: seq[byte] # deflate stream of `data`, when already known
 
   BlockAddress* = object
     case leaf*: bool
@@ -66,9 +67,9 @@ proc `$`*(a: BlockAddress): string =
     "cid: " & $a.cid
 
 proc hash*(a: BlockAddress): Hash =
+  # hashes the cid bytes in place, rather than copying them out with the index
   if a.leaf:
-    let data = a.treeCid.data.buffer & @(a.index.uint64.toBytesBE)
-    hash(data)
+    !$(hash(a.treeCid.data.buffer) !& hash(a.index))
   else:
     hash(a.cid.data.buffer)
 
@@ -137,6 +137,21 @@ proc shutdown*(server: CodexServer) {.async.} =
   await server.stop()
   await server.close()
 
+proc newRepoDatastore(kind: RepoKind, dir: string): Datastore =
+  case kind
+  of repoFS:
+    Datastore(
+      FSDatastore.new(dir, depth = 5).expect("Should create repo file data store!")
+    )
+  of repoSQLite:
+    Datastore(
+      SQLiteDatastore.new(dir).expect("Should create repo SQLite data store!")
+    )
+  of repoLevelDb:
+    Datastore(
+      LevelDbDatastore.new(dir).expect("Should create repo LevelDB data store!")
+    )
+
 proc new*(
     T: type CodexServer, config: CodexConf, privateKey: CodexPrivateKey
 ): CodexServer =
@@ -171,6 +186,9 @@ proc new*(
     cache = CacheStore.new(cacheSize = config.cacheSize)
     ## Is unused?
 
+  if config.repoUnified and config.repoKind == repoFS:
+    warn "A unified repo needs a sqlite or leveldb repo kind, keeping metadata apart"
+
   let discoveryDir = config.dataDir / CodexDhtNamespace
 
   if io2.createPath(discoveryDir).isErr:
@@ -200,34 +218,38 @@ proc new*(
 
     network = BlockExcNetwork.new(switch)
 
-    repoData =
-      case config.repoKind
-      of repoFS:
-        Datastore(
-          FSDatastore.new($config.dataDir, depth = 5).expect(
-            "Should create repo file data store!"
-          )
-        )
-      of repoSQLite:
-        Datastore(
-          SQLiteDatastore.new($config.dataDir).expect(
-            "Should create repo SQLite data store!"
-          )
-        )
-      of repoLevelDb:
-        Datastore(
-          LevelDbDatastore.new($config.dataDir).expect(
-            "Should create repo LevelDB data store!"
-          )
-        )
+    repoData = newRepoDatastore(config.repoKind, $config.dataDir)
+
+    # blocks and metadata keys live in distinct namespaces, so a unified repo
+    # keeps both in the repo store, sharing its write batches and syncs
+    unifiedRepo = config.repoUnified and config.repoKind != repoFS
 
     repoStore = RepoStore.new(
       repoDs = repoData,
-      metaDs = LevelDbDatastore.new(config.dataDir / CodexMetaNamespace).expect(
-          "Should create metadata store!"
-        ),
+      metaDs =
+        if unifiedRepo:
+          repoData
+        else:
+          Datastore(
+            LevelDbDatastore.new(config.dataDir / CodexMetaNamespace).expect(
+              "Should create metadata store!"
+            )
+          ),
       quotaMaxBytes = config.storageQuota,
       blockTtl = config.blockTtl,
+      shards = config.dataShardDirs.mapIt(newRepoDatastore(config.repoKind, it)),
+      compression = config.repoCompression,
+      capacityDs =
+        if config.repoCapacityDir.isSome:
+          Datastore(
+            FSDatastore.new(config.repoCapacityDir.get, depth = 5).expect(
+              "Should create capacity tier data store!"
+            )
+          )
+        else:
+          nil,
+      coldAfter = config.repoColdAfter,
+      taskpool = taskPool,
     )
 
     maintenance = BlockMaintainer.new(
@@ -242,7 +264,14 @@ proc new*(
     blockDiscovery =
       DiscoveryEngine.new(repoStore, peerStore, network, discovery, pendingBlocks)
     engine = BlockExcEngine.new(
-      repoStore, network, blockDiscovery, advertiser, peerStore, pendingBlocks
+      repoStore,
+      network,
+      blockDiscovery,
+      advertiser,
+      peerStore,
+      pendingBlocks,
+      wireCompression = config.wireCompression,
+      readaheadBlocks = config.readaheadBlocks,
     )
     store = NetworkStore.new(engine, repoStore)
 
@@ -252,6 +281,7 @@ proc new*(
       engine = engine,
       discovery = discovery,
       taskPool = taskPool,
+      stripeSize = config.parityStripe,
     )
 
   var restServer: RestServerRef = nil
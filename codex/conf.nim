@@ -45,12 +45,13 @@ import ./nat
 import ./utils/natutils
 
 from ./blockexchange/engine/pendingblocks import DefaultBlockRetries
+from ./blockexchange/engine/readahead import DefaultReadaheadBlocks
 
 export units, net, codextypes, logutils, completeCmdArg, parseCmdArg, NatConfig
 
 export
   DefaultQuotaBytes, DefaultBlockTtl, DefaultBlockInterval, DefaultNumBlocksPerInterval,
-  DefaultBlockRetries
+  DefaultBlockRetries, DefaultColdAfter, DefaultReadaheadBlocks
 
 type ThreadCount* = distinct Natural
 
@@ -224,6 +225,64 @@ type
       name: "repo-kind"
     .}: RepoKind
 
+    repoUnified* {.
+      desc:
+        "Keep block metadata in the main repo store instead of a separate " &
+        "LevelDB store (sqlite and leveldb repo kinds only)",
+      defaultValue: false,
+      name: "repo-unified"
+    .}: bool
+
+    dataShardDirs* {.
+      desc:
+        "Additional directories, usually on other disks, to stripe the " &
+        "blocks of the repo store across along with the data dir. The set of " &
+        "directories, and their order, can't change once the repo is created",
+      name: "data-shard-dir"
+    .}: seq[string]
+
+    repoCompression* {.
+      desc:
+        "Store the blocks of the repo store compressed when they compress " &
+        "well. Blocks already stored are read either way",
+      defaultValue: false,
+      name: "repo-compression"
+    .}: bool
+
+    repoCapacityDir* {.
+      desc:
+        "Directory of a capacity tier, usually on a slower and larger disk, " &
+        "where the blocks of datasets not read for a while are moved",
+      defaultValue: string.none,
+      defaultValueDesc: "",
+      name: "repo-capacity-dir"
+    .}: Option[string]
+
+    repoColdAfter* {.
+      desc:
+        "Time without reads after which a dataset is moved to the capacity tier",
+      defaultValue: DefaultColdAfter,
+      defaultValueDesc: $DefaultColdAfter,
+      name: "repo-cold-after"
+    .}: Duration
+
+    wireCompression* {.
+      desc:
+        "Send blocks compressed to the peers which accept it, for datasets " &
+        "which compress well",
+      defaultValue: false,
+      name: "wire-compression"
+    .}: bool
+
+    readaheadBlocks* {.
+      desc:
+        "Number of blocks read ahead of the requests of peers downloading a " &
+        "dataset in order, 0 disables readahead",
+      defaultValue: DefaultReadaheadBlocks,
+      defaultValueDesc: $DefaultReadaheadBlocks,
+      name: "readahead-blocks"
+    .}: int
+
     storageQuota* {.
       desc: "The size of the total storage quota dedicated to the node",
       defaultValue: DefaultQuotaBytes,
@@ -263,6 +322,15 @@ type
       name: "block-retries"
     .}: int
 
+    parityStripe* {.
+      desc:
+        "Number of data blocks per parity block of stored datasets, " &
+        "0 stores no parity blocks",
+      defaultValue: 0,
+      defaultValueDesc: "0",
+      name: "parity-stripe"
+    .}: int
+
     cacheSize* {.
       desc:
         "The size of the block cache, 0 disables the cache - " &
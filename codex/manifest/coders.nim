@@ -46,6 +46,7 @@ proc encode*(manifest: Manifest): ?!seq[byte] =
   #     optional version: CidVersion = 6; # Cid version
   #     optional filename: ?string = 7;    # original filename
   #     optional mimetype: ?string = 8;    # original mimetype
+  #     optional stripeSize: uint32 = 9;  # data blocks per parity block
   #   }
   # ```
   #
@@ -64,6 +65,9 @@ proc encode*(manifest: Manifest): ?!seq[byte] =
   if manifest.mimetype.isSome:
     header.write(8, manifest.mimetype.get())
 
+  if manifest.protected:
+    header.write(9, manifest.stripeSize.uint32)
+
   pbNode.write(1, header) # set the treeCid as the data field
   pbNode.finish()
 
@@ -84,6 +88,7 @@ proc decode*(_: type Manifest, data: openArray[byte]): ?!Manifest =
     blockSize: uint32
     filename: string
     mimetype: string
+    stripeSize: uint32
 
   # Decode `Header` message
   if pbNode.getField(1, pbHeader).isErr:
@@ -114,6 +119,9 @@ proc decode*(_: type Manifest, data: openArray[byte]): ?!Manifest =
   if pbHeader.getField(8, mimetype).isErr:
     return failure("Unable to decode `mimetype` from manifest!")
 
+  if pbHeader.getField(9, stripeSize).isErr:
+    return failure("Unable to decode `stripeSize` from manifest!")
+
   let treeCid = ?Cid.init(treeCidBuf).mapFailure
 
   var filenameOption = if filename.len == 0: string.none else: filename.some
@@ -128,6 +136,7 @@ proc decode*(_: type Manifest, data: openArray[byte]): ?!Manifest =
     codec = codec.MultiCodec,
     filename = filenameOption,
     mimetype = mimetypeOption,
+    stripeSize = stripeSize.int,
   )
 
   self.success
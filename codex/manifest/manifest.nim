@@ -34,6 +34,7 @@ type Manifest* = ref object of RootObj
   version: CidVersion # Cid version
   filename {.serialize.}: ?string # The filename of the content uploaded (optional)
   mimetype {.serialize.}: ?string # The mimetype of the content uploaded (optional)
+  stripeSize {.serialize.}: int # Data blocks per parity block, 0 if unprotected
 
 ############################################################
 # Accessors
@@ -66,6 +67,36 @@ func filename*(self: Manifest): ?string =
 func mimetype*(self: Manifest): ?string =
   self.mimetype
 
+func stripeSize*(self: Manifest): int =
+  self.stripeSize
+
+func protected*(self: Manifest): bool =
+  ## Whether the tree holds parity blocks, which let any block of a stripe be
+  ## rebuilt from the others
+  ##
+  self.stripeSize > 0
+
+func stripesCount*(self: Manifest): int =
+  if self.protected:
+    divUp(self.blocksCount, self.stripeSize)
+  else:
+    0
+
+func leavesCount*(self: Manifest): int =
+  ## Leaves of the tree: the data blocks, followed by one parity block per
+  ## stripe
+  ##
+  self.blocksCount + self.stripesCount
+
+func stripeMembers*(self: Manifest, stripe: Natural): seq[int] =
+  ## Leaf indices of the data blocks of `stripe`, followed by the index of its
+  ## parity block
+  ##
+  for index in stripe * self.stripeSize ..<
+      min((stripe + 1) * self.stripeSize, self.blocksCount):
+    result.add(index)
+  result.add(self.blocksCount + stripe)
+
 ############################################################
 # Operations on block list
 ############################################################
@@ -83,7 +114,8 @@ func isManifest*(mc: MultiCodec): ?!bool =
 func `==`*(a, b: Manifest): bool =
   (a.treeCid == b.treeCid) and (a.datasetSize == b.datasetSize) and
     (a.blockSize == b.blockSize) and (a.version == b.version) and (a.hcodec == b.hcodec) and
-    (a.codec == b.codec) and (a.filename == b.filename) and (a.mimetype == b.mimetype)
+    (a.codec == b.codec) and (a.filename == b.filename) and (a.mimetype == b.mimetype) and
+    (a.stripeSize == b.stripeSize)
 
 func `$`*(self: Manifest): string =
   result =
@@ -97,6 +129,9 @@ func `$`*(self: Manifest): string =
   if self.mimetype.isSome:
     result &= ", mimetype: " & $self.mimetype
 
+  if self.protected:
+    result &= ", stripeSize: " & $self.stripeSize
+
   return result
 
 ############################################################
@@ -113,6 +148,7 @@ func new*(
     codec = BlockCodec,
     filename: ?string = string.none,
     mimetype: ?string = string.none,
+    stripeSize = 0,
 ): Manifest =
   T(
     treeCid: treeCid,
@@ -123,6 +159,7 @@ func new*(
     hcodec: hcodec,
     filename: filename,
     mimetype: mimetype,
+    stripeSize: stripeSize,
   )
 
 func new*(T: type Manifest, data: openArray[byte]): ?!Manifest =
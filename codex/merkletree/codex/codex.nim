@@ -56,6 +56,19 @@ func getProof*(self: CodexTree, index: int): ?!CodexProof =
 
   success proof
 
+func neighbourProof*(self: CodexProof, leaf: ByteHash, index: int): ?!CodexProof =
+  var proof = CodexProof(mcodec: self.mcodec)
+
+  ?self.neighbourProof(leaf, index, proof)
+
+  success proof
+
+func neighbourProof*(self: CodexProof, leaf: MultiHash, index: int): ?!CodexProof =
+  if self.mcodec != leaf.mcodec:
+    return failure "Hash codec mismatch"
+
+  self.neighbourProof(leaf.digestBytes, index)
+
 func verify*(self: CodexProof, leaf: MultiHash, root: MultiHash): ?!bool =
   ## Verify hash
   ##
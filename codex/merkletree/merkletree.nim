@@ -190,6 +190,7 @@ func getProof*[H, K](
   proof.path = path
   proof.nleaves = nleaves
   proof.compress = self.compress.fn
+  proof.zero = self.compress.zero
 
   success()
 
@@ -228,6 +229,56 @@ func reconstructRoot*[H, K](proof: MerkleProof[H, K], leaf: H): ?!H =
 func verify*[H, K](proof: MerkleProof[H, K], leaf: H, root: H): ?!bool =
   success bool(root == ?proof.reconstructRoot(leaf))
 
+func neighbourProof*[H, K](
+    self: MerkleProof[H, K], leaf: H, index: int, proof: MerkleProof[H, K]
+): ?!void =
+  ## Proof of leaf `index`, derived from the proof of `leaf`, a leaf next to
+  ## it: its sibling, or the leaf before the last leaf when that one has no
+  ## sibling
+  ##
+
+  if not (index >= 0 and index < self.nleaves):
+    return failure "index out of bounds"
+
+  var
+    path = newSeq[H](self.path.len)
+    k = index
+    j = self.index
+    m = self.nleaves
+    h = leaf
+    bottomFlag = K.KeyBottomLayer
+
+  for i, p in self.path:
+    let sibling = k xor 1
+    if sibling == j:
+      path[i] = h
+    elif sibling == (j xor 1):
+      path[i] = p
+    elif sibling >= m:
+      path[i] = self.zero
+    else:
+      return failure "leaf " & $index & " is not next to leaf " & $self.index
+
+    # parent of the neighbour, as in `reconstructRoot`
+    if bitand(j, 1) != 0:
+      h = ?self.compress(p, h, bottomFlag)
+    elif j == m - 1:
+      h = ?self.compress(h, p, K(bottomFlag.ord + 2))
+    else:
+      h = ?self.compress(h, p, bottomFlag)
+    bottomFlag = K.KeyNone
+    k = k shr 1
+    j = j shr 1
+    m = (m + 1) shr 1
+
+  proof.index = index
+  proof.path = path
+  proof.nleaves = self.nleaves
+  proof.compress = self.compress
+  proof.zero = self.zero
+
+  success()
+
 func fromNodes*[H, K](
     self: MerkleTree[H, K],
     compressor: CompressFn,
@@ -17,8 +17,30 @@ const
   CodexManifestNamespace* = CodexRepoNamespace & "/manifests" # manifest namespace
   CodexBlocksTtlNamespace* = # Cid TTL
     CodexMetaNamespace & "/ttl"
-  CodexBlockProofNamespace* = # Cid and Proof
+  CodexBlockProofNamespace* = # Cid and Proof, keyed by fixed width leaf index
+    CodexMetaNamespace & "/leaves"
+  CodexLegacyBlockProofNamespace* = # Cid and Proof, keyed by decimal leaf index
     CodexMetaNamespace & "/proof"
+  CodexLeafCountNamespace* = # number of leaves of a tree whose block is stored
+    CodexMetaNamespace & "/leaf-counts"
+  CodexLeavesCountedNamespace* = # set if leaves were counted since the repo was created
+    CodexMetaNamespace & "/leaves-counted"
+  CodexBlockLeavesNamespace* = # leaves of a block, keyed by block cid
+    CodexMetaNamespace & "/block-leaves"
+  CodexMetaVersionNamespace* = # version of the metadata layout
+    CodexMetaNamespace & "/version"
+  CodexManifestIndexNamespace* = # tree cid of the stored manifests
+    CodexMetaNamespace & "/manifests"
+  CodexManifestIndexReadyNamespace* = # set once the manifest index is complete
+    CodexMetaNamespace & "/manifests-ready"
+  CodexJournalNamespace* = # block writes and deletes in progress
+    CodexMetaNamespace & "/journal"
+  CodexTierNamespace* = # datasets moved to the capacity tier
+    CodexMetaNamespace & "/tiers"
+  CodexShardsNamespace* = # number of shards the block data is striped across
+    CodexMetaNamespace & "/shards"
+  CodexShardIndexNamespace* = # position of a shard, kept in the shard itself
+    CodexMetaNamespace & "/shard-index"
   CodexDhtNamespace* = "dht" # Dht namespace
   CodexDhtProvidersNamespace* = # Dht providers namespace
     CodexDhtNamespace & "/providers"
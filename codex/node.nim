@@ -32,6 +32,7 @@ import ./clock
 import ./blocktype as bt
 import ./manifest
 import ./merkletree
+import ./parity
 import ./stores
 import ./blockexchange
 import ./streams
@@ -39,10 +40,11 @@ import ./discovery
 import ./utils
 import ./errors
 import ./logutils
+import ./uploadsession
 import ./utils/safeasynciter
 import ./utils/trackedfutures
 
-export logutils
+export logutils, uploadsession
 
 logScope:
   topics = "codex node"
@@ -51,6 +53,7 @@ const
   DefaultFetchBatch = 1024
   MaxOnBatchBlocks = 128
   BatchRefillThreshold = 0.75 # Refill when 75% of window completes
+  DatasetStatusBatch = 64 # Concurrent local lookups of `datasetsStatus`
 
 type
   CodexNode* = object
@@ -62,6 +65,8 @@ type
     clock*: Clock
     taskPool: Taskpool
     trackedFutures: TrackedFutures
+    uploads: UploadSessions
+    stripeSize: int # data blocks per parity block of stored datasets
 
   CodexNodeRef* = ref CodexNode
 
@@ -70,12 +75,21 @@ type
     proc(blocks: seq[bt.Block]): Future[?!void] {.async: (raises: [CancelledError]).}
   OnBlockStoredProc = proc(chunk: seq[byte]): void {.gcsafe, raises: [].}
 
+  DatasetStatus* = object
+    cid*: Cid
+    exists*: bool # the block is present in the local store
+    manifest*: ?Manifest # for manifests present in the local store
+    complete*: ?bool # whether all blocks of the dataset are stored locally
+
 func switch*(self: CodexNodeRef): Switch =
   return self.switch
 
 func blockStore*(self: CodexNodeRef): BlockStore =
   return self.networkStore
 
+func localStore*(self: CodexNodeRef): BlockStore =
+  return self.networkStore.localStore
+
 func engine*(self: CodexNodeRef): BlockExcEngine =
   return self.engine
 
@@ -142,7 +156,7 @@ proc updateExpiry*(
     return failure(error)
 
   try:
-    let ensuringFutures = Iter[int].new(0 ..< manifest.blocksCount).mapIt(
+    let ensuringFutures = Iter[int].new(0 ..< manifest.leavesCount).mapIt(
         self.networkStore.localStore.ensureExpiry(manifest.treeCid, it, expiry)
       )
 
@@ -232,6 +246,192 @@ proc fetchBatched*(
 
   success()
 
+proc rebuiltProof(
+    self: CodexNodeRef, manifest: Manifest, index: int, blk: bt.Block
+): Future[?!CodexProof] {.async: (raises: [CancelledError]).} =
+  ## Proof of a block rebuilt from its stripe, derived from the proof of the
+  ## leaf next to it, which is fetched if needed. Fails unless the block is
+  ## the leaf of the dataset tree.
+  ##
+
+  let neighbour =
+    if (index xor 1) < manifest.leavesCount:
+      index xor 1
+    else:
+      index - 1
+
+  if neighbour < 0:
+    return failure("Leaf " & $index & " has no neighbour to check it against")
+
+  var stored = await self.networkStore.localStore.getCidAndProof(
+    manifest.treeCid, neighbour
+  )
+  if stored.isErr:
+    let address = BlockAddress.init(manifest.treeCid, neighbour)
+    if err =? (await self.networkStore.getBlock(address)).errorOption:
+      return failure(err)
+
+    stored = await self.networkStore.localStore.getCidAndProof(
+      manifest.treeCid, neighbour
+    )
+
+  without cidAndProof =? stored, err:
+    return failure(err)
+
+  let (cid, neighbourProof) = cidAndProof
+
+  without leaf =? cid.mhash.mapFailure, err:
+    return failure(err)
+
+  without proof =? neighbourProof.neighbourProof(leaf, index), err:
+    return failure(err)
+
+  without rebuilt =? blk.cid.mhash.mapFailure, err:
+    return failure(err)
+
+  without root =? manifest.treeCid.mhash.mapFailure, err:
+    return failure(err)
+
+  without verified =? proof.verify(rebuilt, root), err:
+    return failure(err)
+
+  if not verified:
+    return failure("Block rebuilt for leaf " & $index & " doesn't match the dataset tree")
+
+  success proof
+
+proc fetchStripe(
+    self: CodexNodeRef, manifest: Manifest, stripe: Natural
+): Future[?!seq[bt.Block]] {.async: (raises: [CancelledError]).} =
+  ## Fetches all the blocks of a stripe at once, data blocks then the parity
+  ## block. As soon as all of them but one are in, or one of them can't be
+  ## fetched, the last one is rebuilt from the others instead of waiting for
+  ## it, and checked against the dataset tree before being used.
+  ##
+
+  let
+    members = manifest.stripeMembers(stripe)
+    futs = members.mapIt(
+      self.networkStore.getBlock(BlockAddress.init(manifest.treeCid, it))
+    )
+
+  var
+    blocks = newSeq[?bt.Block](members.len)
+    pending = futs
+    missing = -1
+    received = 0
+
+  try:
+    while received < members.len - 1:
+      let fut = await one(pending)
+      pending.del(pending.find(fut))
+
+      without blk =? (await fut), err:
+        if missing >= 0:
+          await noCancel allFutures(pending.mapIt(it.cancelAndWait()))
+          return failure(err)
+
+        missing = futs.find(fut)
+        continue
+
+      blocks[futs.find(fut)] = blk.some
+      inc received
+  except CancelledError as exc:
+    await noCancel allFutures(pending.mapIt(it.cancelAndWait()))
+    raise exc
+  except CatchableError as exc:
+    return failure(exc.msg)
+
+  if missing < 0:
+    missing = futs.find(pending[0])
+
+  let
+    address = BlockAddress.init(manifest.treeCid, members[missing])
+    present = blocks.filterIt(it.isSome).mapIt(it.get)
+
+  without blk =? parityBlock(present, manifest.blockSize), err:
+    await noCancel allFutures(pending.mapIt(it.cancelAndWait()))
+    return failure(err)
+
+  without proof =? await self.rebuiltProof(manifest, members[missing], blk), err:
+    await noCancel allFutures(pending.mapIt(it.cancelAndWait()))
+    return failure(err)
+
+  trace "Rebuilt block from its stripe", address
+
+  # Complete the pending request, if any, and stop asking peers for the block
+  await self.engine.resolveBlocks(
+    @[BlockDelivery(address: address, blk: blk, proof: proof.some)]
+  )
+  await noCancel allFutures(pending.mapIt(it.cancelAndWait()))
+
+  if err =? (await self.networkStore.localStore.putBlock(blk)).errorOption:
+    return failure(err)
+
+  if err =? (
+    await self.networkStore.localStore.putCidAndProof(
+      manifest.treeCid, members[missing], blk.cid, proof
+    )
+  ).errorOption:
+    return failure(err)
+
+  blocks[missing] = blk.some
+  success blocks.mapIt(it.get)
+
+proc fetchStripes(
+    self: CodexNodeRef,
+    manifest: Manifest,
+    batchSize = DefaultFetchBatch,
+    onBatch: BatchProc = nil,
+    fetchLocal = true,
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Fetches a protected dataset, the stripes of about `batchSize` blocks at
+  ## a time. Without `fetchLocal`, stripes held locally are skipped, and only
+  ## the data blocks that weren't local are passed to `onBatch`.
+  ##
+
+  let window = max(1, batchSize div (manifest.stripeSize + 1))
+
+  for first in countup(0, manifest.stripesCount - 1, window):
+    var
+      stripes: seq[int]
+      held: seq[seq[bool]] # members of each stripe held locally
+    for stripe in first ..< min(first + window, manifest.stripesCount):
+      var local: seq[bool]
+      if not fetchLocal:
+        for member in manifest.stripeMembers(stripe):
+          let address = BlockAddress.init(manifest.treeCid, member)
+          local.add(await address in self.networkStore)
+
+        if local.allIt(it):
+          continue
+
+      stripes.add(stripe)
+      held.add(local)
+
+    let futs = stripes.mapIt(self.fetchStripe(manifest, it))
+
+    try:
+      await allFutures(futs)
+    except CancelledError as exc:
+      await noCancel allFutures(futs.mapIt(it.cancelAndWait()))
+      raise exc
+
+    for i, fut in futs:
+      without blocks =? (await fut), err:
+        return failure(err)
+
+      if not onBatch.isNil:
+        var data = blocks[0 ..^ 2]
+        if held[i].len > 0:
+          data = toSeq(0 ..< data.len).filterIt(not held[i][it]).mapIt(data[it])
+
+        if data.len > 0:
+          if batchErr =? (await onBatch(data)).errorOption:
+            return failure(batchErr)
+
+  success()
+
 proc fetchBatched*(
     self: CodexNodeRef,
     manifest: Manifest,
@@ -245,6 +445,9 @@ proc fetchBatched*(
   trace "Fetching blocks in batches of",
     size = batchSize, blocksCount = manifest.blocksCount
 
+  if manifest.protected:
+    return self.fetchStripes(manifest, batchSize, onBatch, fetchLocal)
+
   let iter = Iter[int].new(0 ..< manifest.blocksCount)
   self.fetchBatched(manifest.treeCid, iter, batchSize, onBatch, fetchLocal)
 
@@ -364,7 +567,7 @@ proc deleteEntireDataset(self: CodexNodeRef, cid: Cid): Future[?!void] {.async.}
 
   let runtimeQuota = initDuration(milliseconds = 100)
   var lastIdle = getTime()
-  for i in 0 ..< manifest.blocksCount:
+  for i in 0 ..< manifest.leavesCount:
     if (getTime() - lastIdle) >= runtimeQuota:
       await idleAsync()
       lastIdle = getTime()
@@ -399,6 +602,93 @@ proc delete*(
 
   await self.deleteEntireDataset(cid)
 
+proc storeParity(
+    self: CodexNodeRef, cids: seq[Cid], blockSize: NBytes
+): Future[?!seq[Cid]] {.async: (raises: [CancelledError]).} =
+  ## Computes and stores the parity block of each stripe of already stored
+  ## data blocks
+  ##
+
+  var parity: seq[Cid]
+  for first in countup(0, cids.len - 1, self.stripeSize):
+    var blocks: seq[bt.Block]
+    for cid in cids[first ..< min(first + self.stripeSize, cids.len)]:
+      without blk =? (await self.networkStore.localStore.getBlock(cid)), err:
+        return failure(err)
+      blocks.add(blk)
+
+    without blk =? parityBlock(blocks, blockSize), err:
+      return failure(err)
+
+    if err =? (await self.networkStore.localStore.putBlock(blk)).errorOption:
+      return failure(err)
+
+    parity.add(blk.cid)
+
+  success parity
+
+proc storeDataset(
+    self: CodexNodeRef,
+    cids: seq[Cid],
+    datasetSize: NBytes,
+    blockSize: NBytes,
+    filename: ?string,
+    mimetype: ?string,
+): Future[?!Cid] {.async.} =
+  ## Builds the merkle tree over already stored blocks, persists the
+  ## leaf proofs and stores the manifest describing the dataset
+  ##
+
+  let
+    hcodec = Sha256HashCodec
+    dataCodec = BlockCodec
+
+  var leaves = cids
+  if self.stripeSize > 0 and cids.len > 0:
+    without parity =? (await self.storeParity(cids, blockSize)), err:
+      return failure(err)
+    leaves &= parity
+
+  without tree =? (await CodexTree.init(self.taskPool, leaves)), err:
+    return failure(err)
+
+  without treeCid =? tree.rootCid(CIDv1, dataCodec), err:
+    return failure(err)
+
+  for index, cid in leaves:
+    without proof =? tree.getProof(index), err:
+      return failure(err)
+    if err =?
+        (await self.networkStore.putCidAndProof(treeCid, index, cid, proof)).errorOption:
+      # TODO add log here
+      return failure(err)
+
+  let manifest = Manifest.new(
+    treeCid = treeCid,
+    blockSize = blockSize,
+    datasetSize = datasetSize,
+    version = CIDv1,
+    hcodec = hcodec,
+    codec = dataCodec,
+    filename = filename,
+    mimetype = mimetype,
+    stripeSize = (if leaves.len > cids.len: self.stripeSize else: 0),
+  )
+
+  without manifestBlk =? await self.storeManifest(manifest), err:
+    error "Unable to store manifest"
+    return failure(err)
+
+  info "Stored data",
+    manifestCid = manifestBlk.cid,
+    treeCid = treeCid,
+    blocks = manifest.blocksCount,
+    datasetSize = manifest.datasetSize,
+    filename = manifest.filename,
+    mimetype = manifest.mimetype
+
+  return manifestBlk.cid.success
+
 proc store*(
     self: CodexNodeRef,
     stream: LPStream,
@@ -445,44 +735,125 @@ proc store*(
   finally:
     await stream.close()
 
-  without tree =? (await CodexTree.init(self.taskPool, cids)), err:
-    return failure(err)
+  await self.storeDataset(
+    cids,
+    datasetSize = NBytes(chunker.offset),
+    blockSize = blockSize,
+    filename = filename,
+    mimetype = mimetype,
+  )
 
-  without treeCid =? tree.rootCid(CIDv1, dataCodec), err:
-    return failure(err)
+proc createUpload*(
+    self: CodexNodeRef,
+    filename: ?string = string.none,
+    mimetype: ?string = string.none,
+    blockSize = DefaultBlockSize,
+): UploadSession =
+  ## Opens a new resumable upload session
+  ##
+  let session = self.uploads.create(blockSize, filename, mimetype)
+  trace "Created upload session", id = session.id, blockSize
+  session
+
+proc uploadSession*(self: CodexNodeRef, id: string): ?!UploadSession =
+  without session =? self.uploads.get(id):
+    return failure(
+      (ref UploadSessionNotFoundError)(msg: "Upload session " & id & " not found")
+    )
+
+  success session
+
+proc uploadPart*(
+    self: CodexNodeRef, id: string, offset: int, stream: LPStream, final = false
+): Future[?!void] {.async.} =
+  ## Chunks a part of an upload session into blocks and stores them. Parts are
+  ## independent from each other, so they can be sent in parallel and retried
+  ## individually. The part ending the dataset has to be flagged as `final`.
+  ##
 
-  for index, cid in cids:
-    without proof =? tree.getProof(index), err:
+  logScope:
+    id = id
+    offset = offset
+
+  try:
+    without session =? self.uploadSession(id), err:
       return failure(err)
-    if err =?
-        (await self.networkStore.putCidAndProof(treeCid, index, cid, proof)).errorOption:
-      # TODO add log here
+
+    without firstIndex =? session.validatePart(offset), err:
       return failure(err)
 
-  let manifest = Manifest.new(
-    treeCid = treeCid,
-    blockSize = blockSize,
-    datasetSize = NBytes(chunker.offset),
-    version = CIDv1,
-    hcodec = hcodec,
-    codec = dataCodec,
-    filename = filename,
-    mimetype = mimetype,
-  )
+    let chunker = LPStreamChunker.new(stream, chunkSize = session.blockSize)
+    var cids: seq[Cid]
 
-  without manifestBlk =? await self.storeManifest(manifest), err:
-    error "Unable to store manifest"
+    while (let chunk = await chunker.getBytes(); chunk.len > 0):
+      let index = firstIndex + cids.len
+      if not session.withinDataset(index):
+        return failure(
+          (ref UploadSessionError)(
+            msg: "Part extends past the end of the dataset at block " & $index
+          )
+        )
+
+      without blk =? bt.Block.new(chunk, codec = BlockCodec), err:
+        return failure(err)
+
+      if err =? (await self.networkStore.putBlock(blk)).errorOption:
+        error "Unable to store block", cid = blk.cid, err = err.msg
+        return failure(&"Unable to store block {blk.cid}")
+
+      cids.add(blk.cid)
+
+    if err =? session.addPart(offset, chunker.offset, cids, final).errorOption:
+      return failure(err)
+
+    trace "Stored upload part", bytes = chunker.offset, blocks = cids.len
+  except CancelledError as exc:
+    raise exc
+  except CatchableError as exc:
+    return failure(exc.msg)
+  finally:
+    await stream.close()
+
+  success()
+
+proc finalizeUpload*(self: CodexNodeRef, id: string): Future[?!Cid] {.async.} =
+  ## Builds the tree and manifest of a complete upload session
+  ##
+
+  without session =? self.uploadSession(id), err:
     return failure(err)
 
-  info "Stored data",
-    manifestCid = manifestBlk.cid,
-    treeCid = treeCid,
-    blocks = manifest.blocksCount,
-    datasetSize = manifest.datasetSize,
-    filename = manifest.filename,
-    mimetype = manifest.mimetype
+  if session.finalizing:
+    return failure(
+      (ref UploadSessionError)(msg: "Upload session " & id & " is already finalizing")
+    )
 
-  return manifestBlk.cid.success
+  without cids =? session.orderedCids, err:
+    return failure(err)
+
+  session.finalizing = true
+  try:
+    without manifestCid =? (
+      await self.storeDataset(
+        cids,
+        datasetSize = NBytes(session.finalSize),
+        blockSize = session.blockSize,
+        filename = session.filename,
+        mimetype = session.mimetype,
+      )
+    ), err:
+      return failure(err)
+
+    self.uploads.remove(id)
+    return success manifestCid
+  finally:
+    session.finalizing = false
+
+proc abortUpload*(self: CodexNodeRef, id: string) =
+  ## Drops an upload session. Blocks already stored are not part of any
+  ## dataset and will be reclaimed once they expire.
+  ##
+  self.uploads.remove(id)
 
 proc iterateManifests*(self: CodexNodeRef, onManifest: OnManifest) {.async.} =
   without cidsIter =? await self.networkStore.listBlocks(BlockType.Manifest):
@@ -544,6 +915,7 @@ proc new*(
     engine: BlockExcEngine,
     discovery: Discovery,
     taskpool: Taskpool,
+    stripeSize = 0,
 ): CodexNodeRef =
   ## Create new instance of a Codex self, call `start` to run it
   ##
@@ -555,6 +927,8 @@ proc new*(
     discovery: discovery,
     taskPool: taskpool,
     trackedFutures: TrackedFutures(),
+    uploads: UploadSessions.new(),
+    stripeSize: stripeSize,
   )
 
 proc hasLocalBlock*(
@@ -563,3 +937,87 @@ proc hasLocalBlock*(
   ## Returns true if the given Cid is present in the local store
 
   return await (cid in self.networkStore.localStore)
+
+proc datasetStatus(
+    self: CodexNodeRef, cid: Cid, withManifest: bool
+): Future[DatasetStatus] {.async: (raises: [CancelledError]).} =
+  let localStore = self.networkStore.localStore
+  var status = DatasetStatus(cid: cid, exists: await (cid in localStore))
+
+  if not status.exists or not (cid.isManifest |? false):
+    return status
+
+  without blk =? await localStore.getBlock(cid), err:
+    trace "Unable to get manifest block", cid, err = err.msg
+    return status
+
+  without manifest =? Manifest.decode(blk), err:
+    trace "Unable to decode as manifest", cid, err = err.msg
+    return status
+
+  if withManifest:
+    status.manifest = manifest.some
+
+  without stored =? await localStore.countBlocks(manifest.treeCid, manifest.leavesCount),
+    err:
+    trace "Unable to count dataset blocks", cid, err = err.msg
+    return status
+
+  status.complete = (stored == manifest.leavesCount).some
+  status
+
+proc datasetsStatus*(
+    self: CodexNodeRef, cids: seq[Cid], withManifest = true
+): Future[seq[DatasetStatus]] {.async: (raises: [CancelledError]).} =
+  ## Returns, for each of the given Cids, whether it is present in the local
+  ## store and, for manifests, the manifest and whether the dataset is
+  ## complete. Lookups are run concurrently in batches.
+  ##
+
+  var statuses = newSeqOfCap[DatasetStatus](cids.len)
+
+  var start = 0
+  while start < cids.len:
+    let
+      batch = cids[start ..< min(start + DatasetStatusBatch, cids.len)]
+      futs = batch.mapIt(self.datasetStatus(it, withManifest))
+
+    start += batch.len
+
+    try:
+      await allFutures(futs)
+    except CancelledError as exc:
+      await noCancel allFutures(futs.mapIt(it.cancelAndWait))
+      raise exc
+
+    for fut in futs:
+      statuses.add(await fut)
+
+  statuses
+
+proc completeLocalDataset*(
+    self: CodexNodeRef, cid: Cid
+): Future[?Manifest] {.async: (raises: [CancelledError]).} =
+  ## Returns the manifest of `cid` if all blocks of its dataset are held by
+  ## the local store, so that it can be served without touching the network
+  ##
+
+  let status = await self.datasetStatus(cid, withManifest = true)
+  if status.complete != true.some:
+    return Manifest.none
+
+  status.manifest
+
+proc fetchBlockAndProof*(
+    self: CodexNodeRef, address: BlockAddress, local = true
+): Future[?!(bt.Block, CodexProof)] {.async: (raises: [CancelledError]).} =
+  ## Returns a leaf block along with its inclusion proof. Unless `local` is
+  ## set, missing blocks are first retrieved from the network, which stores
+  ## the proof delivered with them.
+  ##
+
+  if not local:
+    without _ =? await self.networkStore.getBlock(address), err:
+      return failure(err)
+
+  await self.networkStore.localStore.getBlockAndProof(address.treeCid, address.index)
@@ -0,0 +1,54 @@
+## Logos Storage
+## Copyright (c) 2025 Status Research & Development GmbH
+## Licensed under either of
+##  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+##  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+## at your option.
+## This file may not be copied, modified, or distributed except according to
+## those terms.
+
+## Parity blocks of protected datasets.
+##
+## The data blocks of a protected dataset are grouped in stripes of
+## `stripeSize` blocks, and the parity block of a stripe is the XOR of its
+## data blocks. Any block of a stripe, data or parity, is then the XOR of all
+## the other blocks of the stripe, so a stripe can be completed as soon as all
+## its blocks but one are in.
+
+{.push raises: [], gcsafe.}
+
+import pkg/questionable/results
+
+import ./blocktype as bt
+import ./units
+
+proc xorInto(dst: var seq[byte], src: openArray[byte]) =
+  ## XORs `src` into `dst`, a word at a time
+  ##
+  let
+    len = min(dst.len, src.len)
+    words = len div sizeof(uint64)
+
+  for i in 0 ..< words:
+    var a, b: uint64
+    copyMem(addr a, addr dst[i * sizeof(uint64)], sizeof(uint64))
+    copyMem(addr b, unsafeAddr src[i * sizeof(uint64)], sizeof(uint64))
+    a = a xor b
+    copyMem(addr dst[i * sizeof(uint64)], addr a, sizeof(uint64))
+
+  for i in words * sizeof(uint64) ..< len:
+    dst[i] = dst[i] xor src[i]
+
+proc parityBlock*(blocks: openArray[bt.Block], blockSize: NBytes): ?!bt.Block =
+  ## XOR of `blocks`, each zero padded to `blockSize`: the parity block of a
+  ## stripe, or the block missing from a stripe given all the others
+  ##
+
+  var data = newSeq[byte](blockSize.int)
+  for blk in blocks:
+    if blk.data.len > blockSize.int:
+      return failure("Block " & $blk.cid & " is larger than the block size")
+
+    data.xorInto(blk.data)
+
+  bt.Block.new(data)
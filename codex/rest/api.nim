@@ -9,6 +9,7 @@
 
 {.push raises: [], gcsafe.}
 
+import std/deques
 import std/sequtils
 import std/mimetypes
 import std/os
@@ -31,11 +32,14 @@ import ../node
 import ../blocktype
 import ../conf
 import ../manifest
+import ../merkletree
 import ../streams/asyncstreamwrapper
+import ../streams/seekablestream
 import ../stores
 import ../utils/options
 
 import ./coders
+import ./frames
 import ./json
 
 logScope:
@@ -44,6 +48,10 @@ logScope:
 declareCounter(codex_api_uploads, "codex API uploads")
 declareCounter(codex_api_downloads, "codex API downloads")
 
+const
+  MaxDatasetsStatusCids = 65536 # cids accepted by a single status query
+  VerifiedPrefetch = 16 # blocks requested ahead of the one being sent
+
 proc validate(pattern: string, value: string): int {.gcsafe, raises: [Defect].} =
   0
 
@@ -66,6 +74,71 @@ proc isPending(resp: HttpResponseRef): bool =
   ## sendBody(resp: HttpResponseRef, ...) twice, which is illegal.
   return resp.getResponseState() == HttpResponseState.Empty
 
+proc setDownloadHeaders(resp: HttpResponseRef, manifest: Manifest) =
+  if manifest.mimetype.isSome:
+    resp.setHeader("Content-Type", manifest.mimetype.get())
+  else:
+    resp.addHeader("Content-Type", "application/octet-stream")
+
+  if manifest.filename.isSome:
+    resp.setHeader(
+      "Content-Disposition", "attachment; filename=\"" & manifest.filename.get() & "\""
+    )
+  else:
+    resp.setHeader("Content-Disposition", "attachment")
+
+  # For erasure-coded datasets, we need to return the _original_ length; i.e.,
+  # the length of the non-erasure-coded dataset, as that's what we will be
+  # returning to the client.
+  resp.setHeader("Content-Length", $(manifest.datasetSize.int))
+
+proc sendLocalDataset(
+    node: CodexNodeRef, manifest: Manifest, resp: HttpResponseRef
+): Future[int] {.async: (raises: [CancelledError, HttpWriteError]).} =
+  ## Sends a dataset held entirely by the local store, writing each block
+  ## straight from the store to the response instead of copying it through
+  ## a `StoreStream` buffer. Returns the bytes sent, which fall short of the
+  ## dataset size if a block could not be read from the local store.
+  ##
+
+  var bytes = 0
+  for index in 0 ..< manifest.blocksCount:
+    let address = BlockAddress.init(manifest.treeCid, index)
+    without blk =? await node.localStore.getBlock(address), err:
+      warn "Unable to read local block", index, err = err.msg
+      return bytes
+
+    let len = min(manifest.blockSize.int, manifest.datasetSize.int - bytes)
+    if blk.data.len < len:
+      warn "Local block is too short", index, len = blk.data.len
+      return bytes
+
+    if len > 0:
+      await resp.send(addr blk.data[0], len)
+    bytes += len
+
+  bytes
+
+proc sendStream(
+    stream: LPStream, resp: HttpResponseRef
+): Future[int] {.async: (raises: [CancelledError, LPStreamError, HttpWriteError]).} =
+  ## Sends the rest of a stream, returning the bytes sent
+  ##
+
+  # a single buffer is reused for the whole download
+  var
+    buff = newSeqUninitialized[byte](DefaultBlockSize.int)
+    bytes = 0
+  while not stream.atEof:
+    let len = await stream.readOnce(addr buff[0], buff.len)
+    if len <= 0:
+      break
+
+    bytes += len
+    await resp.send(addr buff[0], len)
+
+  bytes
+
 proc retrieveCid(
     node: CodexNodeRef, cid: Cid, local: bool = true, resp: HttpResponseRef
 ): Future[void] {.async: (raises: [CancelledError, HttpWriteError]).} =
@@ -77,6 +150,27 @@ proc retrieveCid(
 
   var bytes = 0
   try:
+    if local and manifest =? (await node.completeLocalDataset(cid)):
+      setDownloadHeaders(resp, manifest)
+      await resp.prepare(HttpResponseStreamType.Plain)
+
+      bytes = await node.sendLocalDataset(manifest, resp)
+      if bytes < manifest.datasetSize.int:
+        # a block went missing since the dataset was found complete, the
+        # rest of it is streamed, fetching missing blocks as needed
+        without stream =? (await node.retrieve(cid, local)), err:
+          # headers are already sent, all we can do is to drop the connection
+          warn "Unable to stream the rest of the dataset", err = err.msg
+          raise newException(HttpWriteError, err.msg)
+
+        lpStream = stream
+        SeekableStream(stream).setPos(bytes)
+        bytes += await sendStream(stream, resp)
+
+      await resp.finish()
+      codex_api_downloads.inc()
+      return
+
     without stream =? (await node.retrieve(cid, local)), error:
       if error of BlockNotFoundError:
         resp.status = Http404
@@ -98,38 +192,10 @@ proc retrieveCid(
       await resp.sendBody(err.msg)
       return
 
-    if manifest.mimetype.isSome:
-      resp.setHeader("Content-Type", manifest.mimetype.get())
-    else:
-      resp.addHeader("Content-Type", "application/octet-stream")
-
-    if manifest.filename.isSome:
-      resp.setHeader(
-        "Content-Disposition",
-        "attachment; filename=\"" & manifest.filename.get() & "\"",
-      )
-    else:
-      resp.setHeader("Content-Disposition", "attachment")
-
-    # For erasure-coded datasets, we need to return the _original_ length; i.e.,
-    # the length of the non-erasure-coded dataset, as that's what we will be
-    # returning to the client.
-    resp.setHeader("Content-Length", $(manifest.datasetSize.int))
-
+    setDownloadHeaders(resp, manifest)
     await resp.prepare(HttpResponseStreamType.Plain)
 
-    while not stream.atEof:
-      var
-        buff = newSeqUninitialized[byte](DefaultBlockSize.int)
-        len = await stream.readOnce(addr buff[0], buff.len)
-
-      buff.setLen(len)
-      if buff.len <= 0:
-        break
-
-      bytes += buff.len
-
-      await resp.send(addr buff[0], buff.len)
+    bytes = await sendStream(stream, resp)
     await resp.finish()
     codex_api_downloads.inc()
   except CancelledError as exc:
@@ -144,6 +210,73 @@ proc retrieveCid(
     if not lpStream.isNil:
       await lpStream.close()
 
+proc decodeFlag(flag: Option[Result[bool, cstring]], default = false): ?!bool =
+  ## Decodes an optional boolean query parameter
+  ##
+  without res =? flag:
+    return success default
+
+  if res.isErr:
+    return failure($res.error())
+
+  success res.get()
+
+proc retrieveVerified(
+    node: CodexNodeRef, cid: Cid, local: bool = true, resp: HttpResponseRef
+): Future[void] {.async: (raises: [CancelledError, HttpWriteError]).} =
+  ## Download a dataset as a sequence of frames carrying each block along
+  ## with its inclusion proof, so that clients can verify it as it streams
+  ##
+
+  if local and not await node.hasLocalBlock(cid):
+    resp.status = Http404
+    await resp.sendBody("The requested CID could not be found in the local store.")
+    return
+
+  without manifest =? (await node.fetchManifest(cid)), err:
+    error "Failed to fetch manifest", err = err.msg
+    resp.status = Http404
+    await resp.sendBody(err.msg)
+    return
+
+  var
+    pending: Deque[Future[?!(Block, CodexProof)]]
+    next = 0
+    bytes = 0
+
+  try:
+    resp.setHeader("Content-Type", VerifiedContentType)
+    await resp.prepare(HttpResponseStreamType.Chunked)
+
+    while next < manifest.blocksCount or pending.len > 0:
+      while next < manifest.blocksCount and pending.len < VerifiedPrefetch:
+        pending.addLast(
+          node.fetchBlockAndProof(BlockAddress.init(manifest.treeCid, next), local)
+        )
+        inc(next)
+
+      let index = next - pending.len
+      without res =? (await pending.popFirst()), err:
+        # headers are already sent, all we can do is to drop the connection
+        warn "Error retrieving block and proof", index, err = err.msg
+        raise newException(HttpWriteError, err.msg)
+
+      let (blk, proof) = res
+      var header =
+        FrameHeader(index: index, dataLen: blk.data.len, proof: proof).encode()
+
+      await resp.send(addr header[0], header.len)
+      if blk.data.len > 0:
+        await resp.send(addr blk.data[0], blk.data.len)
+
+      bytes += blk.data.len
+
+    await resp.finish()
+    codex_api_downloads.inc()
+  finally:
+    info "Sent verified bytes", cid = cid, bytes
+    await noCancel allFutures(toSeq(pending).mapIt(it.cancelAndWait))
+
 proc buildCorsHeaders(
     httpMethod: string, allowedOrigin: Option[string]
 ): seq[(string, string)] =
@@ -173,6 +306,39 @@ proc getFilenameFromContentDisposition(contentDisposition: string): ?string =
   let filename = parts[1].strip()
   return filename[0 ..^ 2].some
 
+proc parseUploadHeaders(
+    request: HttpRequestRef
+): ?!tuple[filename: ?string, mimetype: ?string] =
+  ## Extracts and validates the optional mimetype and filename of an upload
+  ##
+  var mimetype = request.headers.getString(ContentTypeHeader).some
+
+  if mimetype.get() != "":
+    let mimetypeVal = mimetype.get()
+    var m = newMimetypes()
+    let extension = m.getExt(mimetypeVal, "")
+    if extension == "":
+      return failure("The MIME type '" & mimetypeVal & "' is not valid.")
+  else:
+    mimetype = string.none
+
+  const ContentDispositionHeader = "Content-Disposition"
+  let contentDisposition = request.headers.getString(ContentDispositionHeader)
+  let filename = getFilenameFromContentDisposition(contentDisposition)
+
+  if filename.isSome and not isValidFilename(filename.get()):
+    return failure("The filename is not valid.")
+
+  success (filename: filename, mimetype: mimetype)
+
+proc uploadErrorStatus(err: ref CatchableError): HttpCode =
+  if err of UploadSessionNotFoundError:
+    Http404
+  elif err of UploadSessionError:
+    Http422
+  else:
+    Http500
+
 proc initDataApi(node: CodexNodeRef, repoStore: RepoStore, router: var RestRouter) =
   let allowedOrigin = router.allowedOrigin # prevents capture inside of api defintion
 
@@ -203,25 +369,8 @@ proc initDataApi(node: CodexNodeRef, repoStore: RepoStore, router: var RestRoute
     #
     await request.handleExpect()
 
-    var mimetype = request.headers.getString(ContentTypeHeader).some
-
-    if mimetype.get() != "":
-      let mimetypeVal = mimetype.get()
-      var m = newMimetypes()
-      let extension = m.getExt(mimetypeVal, "")
-      if extension == "":
-        return RestApiResponse.error(
-          Http422, "The MIME type '" & mimetypeVal & "' is not valid."
-        )
-    else:
-      mimetype = string.none
-
-    const ContentDispositionHeader = "Content-Disposition"
-    let contentDisposition = request.headers.getString(ContentDispositionHeader)
-    let filename = getFilenameFromContentDisposition(contentDisposition)
-
-    if filename.isSome and not isValidFilename(filename.get()):
-      return RestApiResponse.error(Http422, "The filename is not valid.")
+    without metadata =? parseUploadHeaders(request), err:
+      return RestApiResponse.error(Http422, err.msg)
 
     # Here we could check if the extension matches the filename if needed
 
@@ -231,8 +380,8 @@ proc initDataApi(node: CodexNodeRef, repoStore: RepoStore, router: var RestRoute
       without cid =? (
         await node.store(
           AsyncStreamWrapper.new(reader = AsyncStreamReader(reader)),
-          filename = filename,
-          mimetype = mimetype,
+          filename = metadata.filename,
+          mimetype = metadata.mimetype,
         )
       ), error:
         error "Error uploading file", exc = error.msg
@@ -264,20 +413,28 @@ proc initDataApi(node: CodexNodeRef, repoStore: RepoStore, router: var RestRoute
     await resp.sendBody("")
 
   router.api(MethodGet, "/api/storage/v1/data/{cid}") do(
-    cid: Cid, resp: HttpResponseRef
+    cid: Cid, verified: Option[bool], resp: HttpResponseRef
   ) -> RestApiResponse:
     var headers = buildCorsHeaders("GET", allowedOrigin)
 
     ## Download a file from the local node in a streaming
     ## manner
+    ##
+    ## `verified` - interleave the blocks with their inclusion proofs
     if cid.isErr:
       return RestApiResponse.error(Http400, $cid.error(), headers = headers)
 
+    without isVerified =? verified.decodeFlag(), err:
+      return RestApiResponse.error(Http400, err.msg, headers = headers)
+
     if corsOrigin =? allowedOrigin:
       resp.setCorsHeaders("GET", corsOrigin)
       resp.setHeader("Access-Control-Headers", "X-Requested-With")
 
-    await node.retrieveCid(cid.get(), local = true, resp = resp)
+    if isVerified:
+      await node.retrieveVerified(cid.get(), local = true, resp = resp)
+    else:
+      await node.retrieveCid(cid.get(), local = true, resp = resp)
 
   router.api(MethodDelete, "/api/storage/v1/data/{cid}") do(
     cid: Cid, resp: HttpResponseRef
@@ -322,23 +479,31 @@ proc initDataApi(node: CodexNodeRef, repoStore: RepoStore, router: var RestRoute
     return RestApiResponse.response($json, contentType = "application/json")
 
   router.api(MethodGet, "/api/storage/v1/data/{cid}/network/stream") do(
-    cid: Cid, resp: HttpResponseRef
+    cid: Cid, verified: Option[bool], resp: HttpResponseRef
   ) -> RestApiResponse:
     ## Download a file from the network in a streaming
     ## manner
     ##
+    ## `verified` - interleave the blocks with their inclusion proofs
+    ##
 
     var headers = buildCorsHeaders("GET", allowedOrigin)
 
     if cid.isErr:
       return RestApiResponse.error(Http400, $cid.error(), headers = headers)
 
+    without isVerified =? verified.decodeFlag(), err:
+      return RestApiResponse.error(Http400, err.msg, headers = headers)
+
     if corsOrigin =? allowedOrigin:
       resp.setCorsHeaders("GET", corsOrigin)
       resp.setHeader("Access-Control-Headers", "X-Requested-With")
 
     resp.setHeader("Access-Control-Expose-Headers", "Content-Disposition")
-    await node.retrieveCid(cid.get(), local = false, resp = resp)
+    if isVerified:
+      await node.retrieveVerified(cid.get(), local = false, resp = resp)
+    else:
+      await node.retrieveCid(cid.get(), local = false, resp = resp)
 
   router.api(MethodGet, "/api/storage/v1/data/{cid}/network/manifest") do(
     cid: Cid, resp: HttpResponseRef
@@ -374,6 +539,57 @@ proc initDataApi(node: CodexNodeRef, repoStore: RepoStore, router: var RestRoute
     let json = %*{$cid: hasCid}
     return RestApiResponse.response($json, contentType = "application/json")
 
+  router.api(MethodPost, "/api/storage/v1/datasets/status") do(
+    manifest: Option[bool], contentBody: Option[ContentBody]
+  ) -> RestApiResponse:
+    ## Batched version of `/data/{cid}/exists`. Takes a JSON array of CIDs
+    ## and returns, for each of them, whether it is present in the local
+    ## store and, for manifests, whether the dataset is complete locally.
+    ##
+    ## `manifest` - include the manifests in the response (default: true)
+    ##
+    var headers = buildCorsHeaders("POST", allowedOrigin)
+
+    without withManifest =? manifest.decodeFlag(default = true), err:
+      return RestApiResponse.error(Http400, err.msg, headers = headers)
+
+    without body =? contentBody:
+      return RestApiResponse.error(Http400, "Missing request body", headers = headers)
+
+    without cidStrs =? seq[string].fromJson(body.data), err:
+      return RestApiResponse.error(
+        Http400, "Expected a JSON array of CIDs: " & err.msg, headers = headers
+      )
+
+    if cidStrs.len > MaxDatasetsStatusCids:
+      return RestApiResponse.error(
+        Http400,
+        "Too many CIDs, at most " & $MaxDatasetsStatusCids & " are allowed",
+        headers = headers,
+      )
+
+    var cids = newSeqOfCap[Cid](cidStrs.len)
+    for cidStr in cidStrs:
+      let cid = Cid.decodeString(cidStr)
+      if cid.isErr:
+        return RestApiResponse.error(
+          Http400, "Invalid CID " & cidStr & ": " & $cid.error(), headers = headers
+        )
+      cids.add(cid.get())
+
+    let
+      statuses = await node.datasetsStatus(cids, withManifest)
+      json =
+        %RestDatasetStatusList.init(
+          statuses.mapIt(
+            RestDatasetStatus.init(it.cid, it.exists, it.complete, it.manifest)
+          )
+        )
+
+    return RestApiResponse.response(
+      $json, contentType = "application/json", headers = headers
+    )
+
   router.api(MethodGet, "/api/storage/v1/space") do() -> RestApiResponse:
     let json =
       %RestRepoStore(
@@ -384,6 +600,142 @@ proc initDataApi(node: CodexNodeRef, repoStore: RepoStore, router: var RestRoute
       )
     return RestApiResponse.response($json, contentType = "application/json")
 
+proc initUploadApi(node: CodexNodeRef, router: var RestRouter) =
+  let allowedOrigin = router.allowedOrigin
+
+  router.rawApi(MethodPost, "/api/storage/v1/uploads") do() -> RestApiResponse:
+    ## Open a resumable upload session. The dataset is then sent in parts with
+    ## `PUT /uploads/{id}/parts/{offset}`, and assembled with
+    ## `POST /uploads/{id}/finalize`. Sessions are held in memory, so uploads
+    ## can be resumed as long as the node is not restarted.
+    ##
+    var headers = buildCorsHeaders("POST", allowedOrigin)
+
+    without metadata =? parseUploadHeaders(request), err:
+      return RestApiResponse.error(Http422, err.msg, headers = headers)
+
+    let
+      session = node.createUpload(metadata.filename, metadata.mimetype)
+      json = %RestUploadSession.init(session)
+
+    return RestApiResponse.response(
+      $json, contentType = "application/json", headers = headers
+    )
+
+  router.api(MethodGet, "/api/storage/v1/uploads/{id}") do(
+    id: string
+  ) -> RestApiResponse:
+    ## Returns the state of an upload session, including the ranges of blocks
+    ## received so far, so that interrupted uploads can be resumed
+    ##
+    var headers = buildCorsHeaders("GET", allowedOrigin)
+
+    if id.isErr:
+      return RestApiResponse.error(Http400, $id.error(), headers = headers)
+
+    without session =? node.uploadSession(id.get()), err:
+      return RestApiResponse.error(Http404, err.msg, headers = headers)
+
+    let json = %RestUploadSession.init(session)
+    return RestApiResponse.response(
+      $json, contentType = "application/json", headers = headers
+    )
+
+  router.rawApi(MethodPut, "/api/storage/v1/uploads/{id}/parts/{offset}") do(
+    id: string, offset: uint64, final: Option[bool]
+  ) -> RestApiResponse:
+    ## Upload a part of the dataset starting at byte `offset`, which must be
+    ## aligned to the block size. The part ending the dataset has to be sent
+    ## with `final=true`, and is the only one which may have a length that is
+    ## not a multiple of the block size. Empty parts are rejected.
+    ##
+    var headers = buildCorsHeaders("PUT", allowedOrigin)
+
+    if id.isErr:
+      return RestApiResponse.error(Http400, $id.error(), headers = headers)
+
+    if offset.isErr:
+      return RestApiResponse.error(Http400, $offset.error(), headers = headers)
+
+    without isFinal =? final.decodeFlag(), err:
+      return RestApiResponse.error(Http400, err.msg, headers = headers)
+
+    if offset.get() > int.high.uint64:
+      return RestApiResponse.error(Http400, "Invalid offset", headers = headers)
+
+    var bodyReader = request.getBodyReader()
+    if bodyReader.isErr():
+      return RestApiResponse.error(Http500, msg = bodyReader.error(), headers = headers)
+
+    await request.handleExpect()
+
+    let reader = bodyReader.get()
+
+    try:
+      if err =? (
+        await node.uploadPart(
+          id.get(),
+          offset.get().int,
+          AsyncStreamWrapper.new(reader = AsyncStreamReader(reader)),
+          isFinal,
+        )
+      ).errorOption:
+        error "Error uploading part", id = id.get(), err = err.msg
+        return RestApiResponse.error(uploadErrorStatus(err), err.msg, headers = headers)
+
+      without session =? node.uploadSession(id.get()), err:
+        return RestApiResponse.error(Http404, err.msg, headers = headers)
+
+      let json = %RestUploadSession.init(session)
+      return RestApiResponse.response(
+        $json, contentType = "application/json", headers = headers
+      )
+    except CancelledError:
+      trace "Upload part cancelled error"
+      return RestApiResponse.error(Http500, headers = headers)
+    except AsyncStreamError:
+      trace "Async stream error"
+      return RestApiResponse.error(Http500, headers = headers)
+    finally:
+      await reader.closeWait()
+
+  router.api(MethodPost, "/api/storage/v1/uploads/{id}/finalize") do(
+    id: string
+  ) -> RestApiResponse:
+    ## Builds the dataset out of all received parts and returns the Cid of
+    ## its manifest
+    ##
+    var headers = buildCorsHeaders("POST", allowedOrigin)
+
+    if id.isErr:
+      return RestApiResponse.error(Http400, $id.error(), headers = headers)
+
+    without cid =? (await node.finalizeUpload(id.get())), err:
+      error "Error finalizing upload", id = id.get(), err = err.msg
+      return RestApiResponse.error(uploadErrorStatus(err), err.msg, headers = headers)
+
+    codex_api_uploads.inc()
+    trace "Uploaded file", cid
+    return RestApiResponse.response($cid, headers = headers)
+
+  router.api(MethodDelete, "/api/storage/v1/uploads/{id}") do(
+    id: string, resp: HttpResponseRef
+  ) -> RestApiResponse:
+    ## Aborts an upload session
+    ##
+    var headers = buildCorsHeaders("DELETE", allowedOrigin)
+
+    if id.isErr:
+      return RestApiResponse.error(Http400, $id.error(), headers = headers)
+
+    node.abortUpload(id.get())
+
+    if corsOrigin =? allowedOrigin:
+      resp.setCorsHeaders("DELETE", corsOrigin)
+
+    resp.status = Http204
+    await resp.sendBody("")
+
 proc initNodeApi(node: CodexNodeRef, conf: CodexConf, router: var RestRouter) =
   let allowedOrigin = router.allowedOrigin
 
@@ -555,6 +907,7 @@ proc initRestApi*(
   var router = RestRouter.init(validate, corsAllowedOrigin)
 
   initDataApi(node, repoStore, router)
+  initUploadApi(node, router)
   initNodeApi(node, conf, router)
   initDebugApi(node, conf, router)
 
@@ -0,0 +1,115 @@
+## Logos Storage
+## Copyright (c) 2025 Status Research & Development GmbH
+## Licensed under either of
+##  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+##  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+## at your option.
+## This file may not be copied, modified, or distributed except according to
+## those terms.
+
+## Framing of verified downloads. Every block of the dataset is sent as
+##
+##   varint(len(header)) | header | data
+##
+## where `header` is a protobuf message holding the leaf index (1), the
+## length of `data` (2) and the encoded `CodexProof` of the leaf (3). This
+## lets clients check each block against the tree root of the manifest as
+## soon as it arrives, instead of rehashing the whole download. Blocks are
+## sent whole, including the padding of the last one, as that is what the
+## leaf hashes cover; clients trim the output to the dataset size.
+
+{.push raises: [], gcsafe.}
+
+import pkg/libp2p/[cid, multihash, protobuf/minprotobuf, varint]
+import pkg/questionable
+import pkg/questionable/results
+
+import ../blocktype
+import ../errors
+import ../merkletree
+import ../units
+
+const
+  VerifiedContentType* = "application/vnd.logos.storage.verified"
+  MaxFrameHeaderSize = 1.MiBs.int # a proof, plus a few varints
+  MaxFrameDataSize = 100.MiBs.int # the largest block the exchange accepts
+
+type FrameHeader* = object
+  index*: Natural
+  dataLen*: Natural
+  proof*: CodexProof
+
+proc encode*(self: FrameHeader): seq[byte] =
+  ## Encodes the header along with its length prefix
+  ##
+
+  var pb = initProtoBuffer()
+  pb.write(1, self.index.uint64)
+  pb.write(2, self.dataLen.uint64)
+  pb.write(3, self.proof.encode())
+  pb.finish
+
+  var
+    prefix: array[10, byte]
+    prefixLen: int
+  discard PB.putUVarint(prefix, prefixLen, pb.buffer.len.uint64)
+
+  @(prefix.toOpenArray(0, prefixLen - 1)) & pb.buffer
+
+proc decode*(_: type FrameHeader, data: openArray[byte]): ?!(FrameHeader, int) =
+  ## Decodes a length prefixed header, and returns it along with the number
+  ## of bytes it spans. The block data follows right after.
+  ##
+
+  var
+    headerLen: uint64
+    prefixLen: int
+
+  if PB.getUVarint(data, prefixLen, headerLen).isErr:
+    return failure("Invalid frame header length")
+
+  if headerLen > MaxFrameHeaderSize.uint64 or prefixLen + headerLen.int > data.len:
+    return failure("Truncated frame header")
+
+  var
+    pb = initProtoBuffer(@(data.toOpenArray(prefixLen, prefixLen + headerLen.int - 1)))
+    index: uint64
+    dataLen: uint64
+    proofBytes: seq[byte]
+
+  if not ?pb.getField(1, index).mapFailure or not ?pb.getField(2, dataLen).mapFailure or
+      not ?pb.getField(3, proofBytes).mapFailure:
+    return failure("Incomplete frame header")
+
+  if index > int.high.uint64:
+    return failure("Frame leaf index out of range")
+
+  if dataLen > MaxFrameDataSize.uint64:
+    return failure("Frame data too large")
+
+  let header = FrameHeader(
+    index: index.int, dataLen: dataLen.int, proof: ?CodexProof.decode(proofBytes)
+  )
+
+  success (header, prefixLen + headerLen.int)
+
+proc verify*(self: FrameHeader, data: openArray[byte], treeCid: Cid): ?!void =
+  ## Checks that `data` is the leaf `index` of the tree `treeCid`
+  ##
+
+  if data.len != self.dataLen:
+    return failure("Frame data length mismatch")
+
+  if self.proof.index != self.index:
+    return failure("Frame proof is for another leaf")
+
+  without blk =? Block.new(data), err:
+    return failure(err)
+
+  without verified =? self.proof.verify(blk.cid, treeCid), err:
+    return failure(err)
+
+  if not verified:
+    return failure("Invalid proof for leaf " & $self.index)
+
+  success()
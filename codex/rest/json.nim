@@ -1,3 +1,5 @@
+import std/sequtils
+
 import pkg/questionable
 import pkg/stew/byteutils
 import pkg/libp2p
@@ -6,6 +8,7 @@ import pkg/codexdht/discv5/routing_table as rt
 import ../utils/json
 import ../manifest
 import ../units
+import ../uploadsession
 
 export json
 
@@ -17,6 +20,15 @@ type
   RestContentList* = object
     content* {.serialize.}: seq[RestContent]
 
+  RestDatasetStatus* = object
+    cid* {.serialize.}: Cid
+    exists* {.serialize.}: bool
+    complete* {.serialize.}: Option[bool]
+    manifest* {.serialize.}: Option[Manifest]
+
+  RestDatasetStatusList* = object
+    content* {.serialize.}: seq[RestDatasetStatus]
+
   RestNode* = object
     nodeId* {.serialize.}: RestNodeId
     peerId* {.serialize.}: PeerId
@@ -36,6 +48,18 @@ type
   RestNodeId* = object
     id*: NodeId
 
+  RestBlockRange* = object
+    first* {.serialize.}: int
+    last* {.serialize.}: int
+
+  RestUploadSession* = object
+    id* {.serialize.}: string
+    blockSize* {.serialize.}: NBytes
+    datasetSize* {.serialize.}: Option[int]
+    blocksCount* {.serialize.}: int
+    received* {.serialize.}: seq[RestBlockRange]
+    missing* {.serialize.}: seq[RestBlockRange]
+
   RestRepoStore* = object
     totalBlocks* {.serialize.}: Natural
     quotaMaxBytes* {.serialize.}: NBytes
@@ -48,6 +72,33 @@ proc init*(_: type RestContentList, content: seq[RestContent]): RestContentList
 proc init*(_: type RestContent, cid: Cid, manifest: Manifest): RestContent =
   RestContent(cid: cid, manifest: manifest)
 
+proc init*(
+    _: type RestDatasetStatus,
+    cid: Cid,
+    exists: bool,
+    complete: ?bool = bool.none,
+    manifest: ?Manifest = Manifest.none,
+): RestDatasetStatus =
+  RestDatasetStatus(cid: cid, exists: exists, complete: complete, manifest: manifest)
+
+proc init*(
+    _: type RestDatasetStatusList, content: seq[RestDatasetStatus]
+): RestDatasetStatusList =
+  RestDatasetStatusList(content: content)
+
+proc init*(_: type RestBlockRange, r: BlockRange): RestBlockRange =
+  RestBlockRange(first: r.first, last: r.last)
+
+proc init*(_: type RestUploadSession, session: UploadSession): RestUploadSession =
+  RestUploadSession(
+    id: session.id,
+    blockSize: session.blockSize,
+    datasetSize: session.datasetSize,
+    blocksCount: session.blocksCount,
+    received: session.receivedRanges.mapIt(RestBlockRange.init(it)),
+    missing: session.missingRanges.mapIt(RestBlockRange.init(it)),
+  )
+
 proc init*(_: type RestNode, node: dn.Node): RestNode =
   RestNode(
     nodeId: RestNodeId.init(node.id),
@@ -16,6 +16,7 @@ import pkg/questionable/results
 
 import ../clock
 import ../blocktype
+import ../manifest
 import ../merkletree
 import ../utils
 
@@ -30,6 +31,8 @@ type
     Both
 
   CidCallback* = proc(cid: Cid): Future[void] {.async: (raises: []).}
+  LeafEntry* = tuple[treeCid: Cid, index: Natural, blkCid: Cid, proof: CodexProof]
+  ManifestEntry* = tuple[manifestCid: Cid, treeCid: Cid]
   BlockStore* = ref object of RootObj
     onBlockStored*: ?CidCallback
 
@@ -102,6 +105,33 @@ method putCidAndProof*(
 
   raiseAssert("putCidAndProof not implemented!")
 
+method putBlocks*(
+    self: BlockStore, blocks: seq[Block], ttl = Duration.none
+): Future[?!void] {.base, async: (raises: [CancelledError]), gcsafe.} =
+  ## Put several blocks to the blockstore. Stores able to persist them in
+  ## a single batch should override it
+  ##
+
+  for blk in blocks:
+    if err =? (await self.putBlock(blk, ttl)).errorOption:
+      return failure(err)
+
+  success()
+
+method putCidsAndProofs*(
+    self: BlockStore, leaves: seq[LeafEntry]
+): Future[?!void] {.base, async: (raises: [CancelledError]), gcsafe.} =
+  ## Put several block proofs to the blockstore
+  ##
+
+  for leaf in leaves:
+    if err =? (
+      await self.putCidAndProof(leaf.treeCid, leaf.index, leaf.blkCid, leaf.proof)
+    ).errorOption:
+      return failure(err)
+
+  success()
+
 method getCidAndProof*(
     self: BlockStore, treeCid: Cid, index: Natural
 ): Future[?!(Cid, CodexProof)] {.base, async: (raises: [CancelledError]), gcsafe.} =
@@ -160,6 +190,24 @@ method hasBlock*(
 
   raiseAssert("hasBlock not implemented!")
 
+method countBlocks*(
+    self: BlockStore, treeCid: Cid, blocksCount: Natural
+): Future[?!Natural] {.base, async: (raises: [CancelledError]), gcsafe.} =
+  ## Count how many of the `blocksCount` leaves of a tree are present in
+  ## the blockstore. Stores able to answer this with a single query should
+  ## override it
+  ##
+
+  var count: Natural = 0
+  for index in 0 ..< blocksCount:
+    without has =? await self.hasBlock(treeCid, index), err:
+      return failure(err)
+
+    if has:
+      inc(count)
+
+  success count
+
 method listBlocks*(
     self: BlockStore, blockType = BlockType.Manifest
 ): Future[?!SafeAsyncIter[Cid]] {.base, async: (raises: [CancelledError]), gcsafe.} =
@@ -168,6 +216,40 @@ method listBlocks*(
 
   raiseAssert("listBlocks not implemented!")
 
+method listManifests*(
+    self: BlockStore
+): Future[?!SafeAsyncIter[ManifestEntry]] {.
+    base, async: (raises: [CancelledError]), gcsafe
+.} =
+  ## List the manifests in the BlockStore along with their tree cids. This
+  ## reads and decodes every manifest block, stores keeping an index of their
+  ## manifests should override it.
+  ##
+
+  without cids =? await self.listBlocks(BlockType.Manifest), err:
+    return failure(err)
+
+  var iter = SafeAsyncIter[ManifestEntry]()
+
+  proc next(): Future[?!ManifestEntry] {.async: (raises: [CancelledError]).} =
+    let res = await cids.next()
+    if cids.finished:
+      iter.finish
+
+    without cid =? res, err:
+      return failure(err)
+
+    without blk =? await self.getBlock(cid), err:
+      return failure(err)
+
+    without manifest =? Manifest.decode(blk), err:
+      return failure(err)
+
+    success (manifestCid: cid, treeCid: manifest.treeCid)
+
+  iter.next = next
+  return success iter
+
 method close*(self: BlockStore): Future[void] {.base, async: (raises: []), gcsafe.} =
   ## Close the blockstore, cleaning up resources managed by it.
   ## For some implementations this may be a no-op
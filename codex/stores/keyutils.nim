@@ -9,10 +9,12 @@
 
 {.push raises: [], gcsafe.}
 
+import std/strutils
 import std/sugar
 import pkg/questionable/results
 import pkg/datastore
 import pkg/libp2p
+import ../errors
 import ../namespaces
 import ../manifest
 
@@ -24,6 +26,17 @@ const
   CodexManifestKey* = Key.init(CodexManifestNamespace).tryGet
   BlocksTtlKey* = Key.init(CodexBlocksTtlNamespace).tryGet
   BlockProofKey* = Key.init(CodexBlockProofNamespace).tryGet
+  LegacyBlockProofKey* = Key.init(CodexLegacyBlockProofNamespace).tryGet
+  LeafCountKey* = Key.init(CodexLeafCountNamespace).tryGet
+  LeavesCountedKey* = Key.init(CodexLeavesCountedNamespace).tryGet
+  BlockLeavesKey* = Key.init(CodexBlockLeavesNamespace).tryGet
+  MetaVersionKey* = Key.init(CodexMetaVersionNamespace).tryGet
+  ManifestIndexKey* = Key.init(CodexManifestIndexNamespace).tryGet
+  ManifestIndexReadyKey* = Key.init(CodexManifestIndexReadyNamespace).tryGet
+  JournalKey* = Key.init(CodexJournalNamespace).tryGet
+  TierKey* = Key.init(CodexTierNamespace).tryGet
+  ShardsKey* = Key.init(CodexShardsNamespace).tryGet
+  ShardIndexKey* = Key.init(CodexShardIndexNamespace).tryGet
   QuotaKey* = Key.init(CodexQuotaNamespace).tryGet
   QuotaUsedKey* = (QuotaKey / "used").tryGet
   QuotaReservedKey* = (QuotaKey / "reserved").tryGet
@@ -43,5 +56,66 @@ proc createBlockExpirationMetadataQueryKey*(): ?!Key =
   let queryString = ?(BlocksTtlKey / "*")
   Key.init(queryString)
 
+func leafIndexKey(index: Natural): string =
+  ## Fixed width, big-endian hex, so that the leaves of a tree sort in index
+  ## order and range scans over a dataset are sequential
+  ##
+  index.BiggestInt.toHex(16)
+
 proc createBlockCidAndProofMetadataKey*(treeCid: Cid, index: Natural): ?!Key =
-  (BlockProofKey / $treeCid).flatMap((k: Key) => k / $index)
+  (BlockProofKey / $treeCid).flatMap((k: Key) => k / leafIndexKey(index))
+
+proc createBlockCidAndProofMetadataQueryKey*(treeCid: Cid): ?!Key =
+  (BlockProofKey / $treeCid).flatMap((k: Key) => k / "*")
+
+proc createLegacyBlockCidAndProofMetadataKey*(treeCid: Cid, index: Natural): ?!Key =
+  (LegacyBlockProofKey / $treeCid).flatMap((k: Key) => k / $index)
+
+proc createLegacyBlockCidAndProofMetadataQueryKey*(): ?!Key =
+  LegacyBlockProofKey / "*"
+
+proc createLeafCountKey*(treeCid: Cid): ?!Key =
+  LeafCountKey / $treeCid
+
+proc createBlockLeafKey*(blkCid: Cid, treeCid: Cid, index: Natural): ?!Key =
+  ## Reverse index entry of a leaf, so that the leaves of a block can be found
+  ## from its cid
+  ##
+  (BlockLeavesKey / $blkCid).flatMap((k: Key) => k / (leafIndexKey(index) & $treeCid))
+
+proc createBlockLeavesQueryKey*(blkCid: Cid): ?!Key =
+  (BlockLeavesKey / $blkCid).flatMap((k: Key) => k / "*")
+
+proc parseBlockLeafKey*(key: Key): ?!(Cid, Natural) =
+  ## Returns the tree cid and leaf index of a reverse index entry
+  ##
+  let value = key.value
+  if value.len <= 16:
+    return failure("Invalid block leaf key " & $key)
+
+  try:
+    let index = parseHexInt(value[0 ..< 16])
+    if index < 0:
+      return failure("Negative leaf index in " & $key)
+
+    success (?Cid.init(value[16 ..^ 1]).mapFailure, index.Natural)
+  except ValueError as exc:
+    failure(exc.msg)
+
+proc createManifestIndexKey*(cid: Cid): ?!Key =
+  ManifestIndexKey / $cid
+
+proc createManifestIndexQueryKey*(): ?!Key =
+  ManifestIndexKey / "*"
+
+proc createJournalKey*(epoch: uint64, seq: uint64): ?!Key =
+  JournalKey / (epoch.toHex & seq.toHex)
+
+proc createJournalQueryKey*(): ?!Key =
+  JournalKey / "*"
+
+proc createColdDatasetKey*(treeCid: Cid): ?!Key =
+  TierKey / $treeCid
+
+proc createColdDatasetQueryKey*(): ?!Key =
+  TierKey / "*"
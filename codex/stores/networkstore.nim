@@ -155,6 +155,13 @@ method listBlocks*(
 ): Future[?!SafeAsyncIter[Cid]] {.async: (raw: true, raises: [CancelledError]).} =
   self.localStore.listBlocks(blockType)
 
+method listManifests*(
+    self: NetworkStore
+): Future[?!SafeAsyncIter[ManifestEntry]] {.
+    async: (raw: true, raises: [CancelledError])
+.} =
+  self.localStore.listManifests()
+
 method delBlock*(
     self: NetworkStore, cid: Cid
 ): Future[?!void] {.async: (raw: true, raises: [CancelledError]).} =
@@ -13,29 +13,130 @@ import pkg/libp2p/cid
 import pkg/serde/json
 import pkg/stew/byteutils
 import pkg/stew/endians2
+import pkg/questionable/results
 
 import ./types
+import ../../clock
 import ../../errors
 import ../../merkletree
+import ../../units
 import ../../utils/json
 
+const
+  MetadataVersion = 1'u8 # leading byte of the binary metadata layouts
+  BlockMetadataSize = 1 + 3 * sizeof(uint64)
+
 proc encode*(t: QuotaUsage): seq[byte] =
   t.toJson().toBytes()
 
 proc decode*(T: type QuotaUsage, bytes: seq[byte]): ?!T =
   T.fromJson(bytes)
 
+proc isJson(bytes: seq[byte]): bool =
+  ## Metadata written before the binary layouts were introduced is JSON
+  bytes.len > 0 and bytes[0] == '{'.byte
+
 proc encode*(t: BlockMetadata): seq[byte] =
-  t.toJson().toBytes()
+  ## Fixed layout: version | expiry | size | refCount, integers big-endian
+  ##
+  result = newSeqOfCap[byte](BlockMetadataSize)
+  result.add(MetadataVersion)
+  result.add(cast[uint64](t.expiry).toBytesBE)
+  result.add(t.size.uint64.toBytesBE)
+  result.add(t.refCount.uint64.toBytesBE)
 
 proc decode*(T: type BlockMetadata, bytes: seq[byte]): ?!T =
-  T.fromJson(bytes)
+  if bytes.isJson:
+    return T.fromJson(bytes)
+
+  if bytes.len != BlockMetadataSize or bytes[0] != MetadataVersion:
+    return failure("Invalid `BlockMetadata` encoding")
+
+  success BlockMetadata(
+    expiry: cast[SecondsSince1970](uint64.fromBytesBE(bytes.toOpenArray(1, 8))),
+    size: uint64.fromBytesBE(bytes.toOpenArray(9, 16)).NBytes,
+    refCount: uint64.fromBytesBE(bytes.toOpenArray(17, 24)).Natural,
+  )
 
 proc encode*(t: LeafMetadata): seq[byte] =
-  t.toJson().toBytes()
+  ## Layout: version | cid length (uint16 big-endian) | binary cid | proof
+  ##
+  let
+    cidBytes = t.blkCid.data.buffer
+    proofBytes = t.proof.encode()
+
+  result = newSeqOfCap[byte](3 + cidBytes.len + proofBytes.len)
+  result.add(MetadataVersion)
+  result.add(cidBytes.len.uint16.toBytesBE)
+  result.add(cidBytes)
+  result.add(proofBytes)
 
 proc decode*(T: type LeafMetadata, bytes: seq[byte]): ?!T =
-  T.fromJson(bytes)
+  if bytes.isJson:
+    return T.fromJson(bytes)
+
+  if bytes.len < 3 or bytes[0] != MetadataVersion:
+    return failure("Invalid `LeafMetadata` encoding")
+
+  let cidEnd = 3 + uint16.fromBytesBE(bytes.toOpenArray(1, 2)).int
+  if cidEnd > bytes.len:
+    return failure("Truncated `LeafMetadata` cid")
+
+  success LeafMetadata(
+    blkCid: ?Cid.init(bytes.toOpenArray(3, cidEnd - 1)).mapFailure,
+    proof: ?CodexProof.decode(bytes[cidEnd ..^ 1]),
+  )
+
+proc decode*(T: type LeafBlockCid, bytes: seq[byte]): ?!T =
+  if bytes.isJson:
+    return success LeafBlockCid(blkCid: (?LeafMetadata.decode(bytes)).blkCid)
+
+  if bytes.len < 3 or bytes[0] != MetadataVersion:
+    return failure("Invalid `LeafMetadata` encoding")
+
+  let cidEnd = 3 + uint16.fromBytesBE(bytes.toOpenArray(1, 2)).int
+  if cidEnd > bytes.len:
+    return failure("Truncated `LeafMetadata` cid")
+
+  success LeafBlockCid(blkCid: ?Cid.init(bytes.toOpenArray(3, cidEnd - 1)).mapFailure)
+
+proc encode*(t: ManifestIndexEntry): seq[byte] =
+  ## Binary tree cid
+  t.treeCid.data.buffer
+
+proc decode*(T: type ManifestIndexEntry, bytes: seq[byte]): ?!T =
+  success ManifestIndexEntry(treeCid: ?Cid.init(bytes).mapFailure)
+
+proc encode*(t: JournalEntry): seq[byte] =
+  ## Layout: version | op | (cid length (uint16 big-endian) | binary cid)*
+  ##
+  result = @[MetadataVersion, t.op.uint8]
+  for cid in t.cids:
+    let cidBytes = cid.data.buffer
+    result.add(cidBytes.len.uint16.toBytesBE)
+    result.add(cidBytes)
+
+proc decode*(T: type JournalEntry, bytes: seq[byte]): ?!T =
+  if bytes.len < 2 or bytes[0] != MetadataVersion or
+      bytes[1] > JournalOp.high.uint8:
+    return failure("Invalid `JournalEntry` encoding")
+
+  var
+    entry = JournalEntry(op: JournalOp(bytes[1]))
+    pos = 2
+
+  while pos < bytes.len:
+    if pos + 2 > bytes.len:
+      return failure("Truncated `JournalEntry` cid length")
+
+    let cidEnd = pos + 2 + uint16.fromBytesBE(bytes.toOpenArray(pos, pos + 1)).int
+    if cidEnd > bytes.len:
+      return failure("Truncated `JournalEntry` cid")
+
+    entry.cids.add(?Cid.init(bytes.toOpenArray(pos + 2, cidEnd - 1)).mapFailure)
+    pos = cidEnd
+
+  success entry
 
 proc encode*(t: DeleteResult): seq[byte] =
   t.toJson().toBytes()
@@ -0,0 +1,90 @@
+## Logos Storage
+## Copyright (c) 2025 Status Research & Development GmbH
+## Licensed under either of
+##  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+##  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+## at your option.
+## This file may not be copied, modified, or distributed except according to
+## those terms.
+
+## Compression of block data at rest.
+##
+## Compressed blocks are stored as
+##
+##   magic | uncompressed length (uint32 big-endian) | deflate stream
+##
+## while other blocks are stored verbatim, as they always were. Cids are over
+## the uncompressed data, so a block read back is always checked against its
+## cid: data which merely starts like a compressed block, but isn't one, is
+## taken verbatim. Small and incompressible blocks are not compressed, see
+## `deflate`.
+
+{.push raises: [], gcsafe.}
+
+import pkg/chronos
+import pkg/libp2p/cid
+import pkg/questionable
+import pkg/questionable/results
+import pkg/stew/endians2
+
+import ./types
+import ../../blocktype
+import ../../utils/deflate
+
+const
+  CompressedMagic = [0x00'u8, 0x5a, 0x42, 0x01] # "\0ZB" and a format version
+  CompressedHeaderSize = CompressedMagic.len + sizeof(uint32)
+  TaskDeflateSize = 64 * 1024 # smaller blocks are compressed inline
+
+func isCompressed(data: openArray[byte]): bool =
+  if data.len < CompressedHeaderSize:
+    return false
+
+  for i, b in CompressedMagic:
+    if data[i] != b:
+      return false
+
+  true
+
+proc encodeBlockData*(
+    self: RepoStore, data: seq[byte]
+): Future[seq[byte]] {.async: (raises: [CancelledError]).} =
+  ## Bytes to store for a block holding `data`. Large blocks are compressed
+  ## on the taskpool of the repo, if it has one, instead of the event loop.
+  ##
+
+  if not self.compression or data.len > uint32.high.int:
+    return data
+
+  let maybeDeflated =
+    if self.taskpool.isNil or data.len < TaskDeflateSize:
+      data.deflate(overhead = CompressedHeaderSize)
+    else:
+      await self.taskpool.deflate(data, overhead = CompressedHeaderSize)
+
+  without deflated =? maybeDeflated:
+    return data
+
+  var encoded = newSeqOfCap[byte](CompressedHeaderSize + deflated.len)
+  encoded.add(CompressedMagic)
+  encoded.add(data.len.uint32.toBytesBE)
+  encoded.add(deflated)
+  encoded
+
+proc decodeBlock*(cid: Cid, data: seq[byte]): ?!Block =
+  ## Block stored as `data`, decompressed when needed and checked against
+  ## its cid. Decompressed blocks keep their deflate stream, so they can be
+  ## sent compressed without compressing them again.
+  ##
+
+  if data.isCompressed:
+    let
+      size = uint32.fromBytesBE(data.toOpenArray(4, 7)).int
+      deflated = data[CompressedHeaderSize ..^ 1]
+
+    if inflated =? deflated.inflate(size) and
+        blk =? Block.new(cid, inflated, verify = true):
+      blk.deflated = deflated
+      return success blk
+
+  Block.new(cid, data, verify = true)
@@ -0,0 +1,77 @@
+## Logos Storage
+## Copyright (c) 2025 Status Research & Development GmbH
+## Licensed under either of
+##  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+##  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+## at your option.
+## This file may not be copied, modified, or distributed except according to
+## those terms.
+
+## Write-ahead journal of batched block writes.
+##
+## Block data lives in `repoDs` and its metadata in `metaDs`, which can't be
+## updated atomically together. Before the data of a batch of blocks is
+## written, an entry recording their cids is put in `metaDs`, and it is
+## dropped once their metadata is stored too. Entries left behind by a crash
+## are replayed when the repo starts (see `recoverJournal`), so the two
+## stores agree again without probing `repoDs` on every write.
+##
+## Single block puts and deletes aren't journaled: they update the data and
+## metadata of a block within a modify of its metadata key, in an order that
+## can at worst leave data without metadata behind, see `storeBlock` and
+## `tryDeleteBlock`. Delete entries may still be found in journals written
+## by older versions.
+
+import pkg/bearssl/rand
+import pkg/chronos
+import pkg/datastore
+import pkg/datastore/typedds
+import pkg/libp2p/cid
+import pkg/questionable
+import pkg/questionable/results
+
+import ./coders
+import ./types
+import ../keyutils
+import ../../rng
+
+proc newJournalKey*(self: RepoStore): ?!Key =
+  ## Key of a new journal entry. When the repo is unified, entries can be
+  ## written along with the block data, in the same batch.
+  ##
+
+  if self.journalEpoch == 0:
+    self.journalEpoch = Rng.instance()[].generate(uint64) or 1
+
+  inc self.journalSeq
+  createJournalKey(self.journalEpoch, self.journalSeq)
+
+proc beginJournal*(
+    self: RepoStore, op: JournalOp, cids: seq[Cid]
+): Future[?!Key] {.async: (raises: [CancelledError]).} =
+  ## Records that the data of `cids` is about to be written or deleted, and
+  ## returns the key of the entry to pass to `endJournal`
+  ##
+
+  without key =? self.newJournalKey(), err:
+    return failure(err)
+
+  let entry = JournalEntry(op: op, cids: cids)
+  if err =? (
+    await self.metaDs.modify(
+      key,
+      proc(maybeCurrEntry: ?JournalEntry): Future[?JournalEntry] {.async.} =
+        entry.some,
+    )
+  ).errorOption:
+    return failure(err)
+
+  success key
+
+proc endJournal*(
+    self: RepoStore, key: Key
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Drops a journal entry, once the metadata matches the data again
+  ##
+
+  await self.metaDs.delete(key)
@@ -7,6 +7,9 @@
 ## This file may not be copied, modified, or distributed except according to
 ## those terms.
 
+import std/strutils
+import std/tables
+
 import pkg/chronos
 import pkg/chronos/futures
 import pkg/datastore
@@ -17,12 +20,18 @@ import pkg/questionable
 import pkg/questionable/results
 
 import ./coders
+import ./compression
+import ./journal
+import ./sharding
+import ./tiering
 import ./types
 import ../blockstore
 import ../keyutils
 import ../../blocktype
 import ../../clock
+import ../../errors
 import ../../logutils
+import ../../manifest
 import ../../merkletree
 
 logScope:
@@ -32,7 +41,9 @@ declareGauge(codex_repostore_blocks, "codex repostore blocks")
 declareGauge(codex_repostore_bytes_used, "codex repostore bytes used")
 declareGauge(codex_repostore_bytes_reserved, "codex repostore bytes reserved")
 
-proc putLeafMetadata*(
+const LeafMigrationBatch = 1024
+
+proc storeLeafMetadata(
     self: RepoStore, treeCid: Cid, index: Natural, blkCid: Cid, proof: CodexProof
 ): Future[?!StoreResultKind] {.async: (raises: [CancelledError]).} =
   without key =? createBlockCidAndProofMetadataKey(treeCid, index), err:
@@ -57,6 +68,38 @@ proc putLeafMetadata*(
       (md.some, res),
   )
 
+proc migrateLegacyLeaf(
+    self: RepoStore, treeCid: Cid, index: Natural
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Moves a leaf still under its legacy key, ahead of the migration running
+  ## in the background
+  ##
+
+  without legacyKey =? createLegacyBlockCidAndProofMetadataKey(treeCid, index), err:
+    return failure(err)
+
+  without md =? await get[LeafMetadata](self.metaDs, legacyKey), err:
+    if err of DatastoreKeyNotFound:
+      return success()
+
+    return failure(err)
+
+  if err =? (
+    await self.storeLeafMetadata(treeCid, index, md.blkCid, md.proof)
+  ).errorOption:
+    return failure(err)
+
+  await self.metaDs.delete(legacyKey)
+
+proc putLeafMetadata*(
+    self: RepoStore, treeCid: Cid, index: Natural, blkCid: Cid, proof: CodexProof
+): Future[?!StoreResultKind] {.async: (raises: [CancelledError]).} =
+  if not self.metadataMigrated:
+    if err =? (await self.migrateLegacyLeaf(treeCid, index)).errorOption:
+      return failure(err)
+
+  await self.storeLeafMetadata(treeCid, index, blkCid, proof)
+
 proc delLeafMetadata*(
     self: RepoStore, treeCid: Cid, index: Natural
 ): Future[?!void] {.async: (raises: [CancelledError]).} =
@@ -74,6 +117,10 @@ proc getLeafMetadata*(
   without key =? createBlockCidAndProofMetadataKey(treeCid, index), err:
     return failure(err)
 
+  if not self.metadataMigrated:
+    if err =? (await self.migrateLegacyLeaf(treeCid, index)).errorOption:
+      return failure(err)
+
   without leafMd =? await get[LeafMetadata](self.metaDs, key), err:
     if err of DatastoreKeyNotFound:
       return failure(newException(BlockNotFoundError, err.msg))
@@ -82,6 +129,158 @@ proc getLeafMetadata*(
 
   success(leafMd)
 
+proc removeLeafMetadata*(
+    self: RepoStore, treeCid: Cid, index: Natural, blkCid: Cid
+): Future[?!DeleteResultKind] {.async: (raises: [CancelledError]).} =
+  ## Removes the metadata of a leaf, unless it was replaced by a leaf of
+  ## another block meanwhile
+  ##
+
+  without key =? createBlockCidAndProofMetadataKey(treeCid, index), err:
+    return failure(err)
+
+  await self.metaDs.modifyGet(
+    key,
+    proc(
+        maybeCurrMd: ?LeafMetadata
+    ): Future[(?LeafMetadata, DeleteResultKind)] {.async.} =
+      if currMd =? maybeCurrMd:
+        if currMd.blkCid == blkCid:
+          return (LeafMetadata.none, Deleted)
+
+      (maybeCurrMd, NotFound),
+  )
+
+proc leafCount*(
+    self: RepoStore, treeCid: Cid
+): Future[?!Natural] {.async: (raises: [CancelledError]).} =
+  ## Number of leaves of a tree whose block is stored, as counted when they
+  ## were put and deleted
+  ##
+
+  without key =? createLeafCountKey(treeCid), err:
+    return failure(err)
+
+  let count = await get[Natural](self.metaDs, key)
+  if count.isErr:
+    if count.error of DatastoreKeyNotFound:
+      return success 0.Natural
+
+    return failure(count.error)
+
+  success count.get
+
+proc updateLeafCount*(
+    self: RepoStore, treeCid: Cid, plusCount: Natural = 0, minusCount: Natural = 0
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  without key =? createLeafCountKey(treeCid), err:
+    return failure(err)
+
+  await self.metaDs.modify(
+    key,
+    proc(maybeCurrCount: ?Natural): Future[?Natural] {.async.} =
+      let count = (maybeCurrCount |? 0.Natural).int + plusCount - minusCount
+      if count > 0: count.Natural.some else: Natural.none,
+  )
+
+proc addBlockLeaf*(
+    self: RepoStore, blkCid: Cid, treeCid: Cid, index: Natural
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Records a leaf in the reverse index of its block
+  ##
+
+  without key =? createBlockLeafKey(blkCid, treeCid, index), err:
+    return failure(err)
+
+  await self.metaDs.modify(
+    key,
+    proc(maybeCurr: ?Natural): Future[?Natural] {.async.} =
+      1.Natural.some,
+  )
+
+proc delBlockLeaf*(
+    self: RepoStore, blkCid: Cid, treeCid: Cid, index: Natural
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  without key =? createBlockLeafKey(blkCid, treeCid, index), err:
+    return failure(err)
+
+  await self.metaDs.delete(key)
+
+proc dropBlockLeaves*(
+    self: RepoStore, blkCid: Cid
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Drops the leaves referencing a deleted block, taking them out of the
+  ## count of their tree. Blocks still referenced are only deleted once they
+  ## expire, which would otherwise leave their leaves behind.
+  ##
+
+  without queryKey =? createBlockLeavesQueryKey(blkCid), err:
+    return failure(err)
+
+  without queryIter =?
+    await query[Natural](self.metaDs, Query.init(queryKey, value = false)), err:
+    return failure(err)
+
+  var keys: seq[Key]
+  try:
+    while not queryIter.finished:
+      without res =? await queryIter.next(), err:
+        return failure(err)
+
+      if key =? res.key:
+        keys.add(key)
+  finally:
+    if err =? (await queryIter.dispose()).errorOption:
+      trace "Error disposing block leaves query", err = err.msg
+
+  for key in keys:
+    let leaf = parseBlockLeafKey(key)
+    if leaf.isErr:
+      warn "Dropping malformed block leaf entry", key = $key, err = leaf.error.msg
+    else:
+      let (treeCid, index) = leaf.get
+      without removed =? await self.removeLeafMetadata(treeCid, index, blkCid), err:
+        return failure(err)
+
+      if removed == Deleted:
+        trace "Dropping leaf of deleted block", blkCid, treeCid, index
+        if err =? (await self.updateLeafCount(treeCid, minusCount = 1)).errorOption:
+          return failure(err)
+
+    if err =? (await self.metaDs.delete(key)).errorOption:
+      return failure(err)
+
+  success()
+
+proc loadLeavesCounted*(
+    self: RepoStore
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Leaf counts are exact in repos which held no blocks when counting
+  ## started. Older repos count the leaves of their incomplete trees from
+  ## their leaf metadata.
+  ##
+
+  let stored = await get[Natural](self.metaDs, LeavesCountedKey)
+  if stored.isOk:
+    self.leavesCounted = stored.get > 0
+    return success()
+
+  if not (stored.error of DatastoreKeyNotFound):
+    return failure(stored.error)
+
+  let counted = self.totalBlocks == 0
+  if err =? (
+    await self.metaDs.modify(
+      LeavesCountedKey,
+      proc(maybeCurr: ?Natural): Future[?Natural] {.async.} =
+        (if counted: 1.Natural else: 0.Natural).some,
+    )
+  ).errorOption:
+    return failure(err)
+
+  self.leavesCounted = counted
+  success()
+
 proc updateTotalBlocksCount*(
     self: RepoStore, plusCount: Natural = 0, minusCount: Natural = 0
 ): Future[?!void] {.async: (raises: [CancelledError]).} =
@@ -161,9 +360,34 @@ proc updateBlockMetadata*(
         ),
   )
 
+proc hasBlockMetadata*(
+    self: RepoStore, cid: Cid
+): Future[?!bool] {.async: (raises: [CancelledError]).} =
+  without metaKey =? createBlockExpirationMetadataKey(cid), err:
+    return failure(err)
+
+  let md = await get[BlockMetadata](self.metaDs, metaKey)
+  if md.isErr:
+    if md.error of DatastoreKeyNotFound:
+      return success false
+
+    return failure(md.error)
+
+  success true
+
 proc storeBlock*(
-    self: RepoStore, blk: Block, minExpiry: SecondsSince1970
+    self: RepoStore, blk: Block, minExpiry: SecondsSince1970, storedSize = NBytes.none
 ): Future[?!StoreResult] {.async: (raises: [CancelledError]).} =
+  ## Stores the block metadata, and the block data unless `storedSize` is
+  ## set, i.e. the data was already written as part of a batch, taking that
+  ## many bytes. Sizes and quota count the stored, maybe compressed, bytes.
+  ##
+  ## The data is encoded and written only when the block isn't stored yet,
+  ## before the metadata, in the modify of its key, so a crash in between
+  ## leaves the data alone, which the next put of the block overwrites and
+  ## its next delete drops. Only batches are journaled.
+  ##
+
   if blk.isEmpty:
     return success(StoreResult(kind: AlreadyInStore))
 
@@ -181,23 +405,15 @@ proc storeBlock*(
         res: StoreResult
 
       if currMd =? maybeCurrMd:
-        if currMd.size == blk.data.len.NBytes:
+        # stored verbatim or compressed, maybe before compression was turned
+        # on, either way it takes at most the size of its data
+        if currMd.size <= blk.data.len.NBytes:
           md = BlockMetadata(
             size: currMd.size,
             expiry: max(currMd.expiry, minExpiry),
             refCount: currMd.refCount,
           )
           res = StoreResult(kind: AlreadyInStore)
-
-          # making sure that the block actually is stored in the repoDs
-          without hasBlock =? await self.repoDs.has(blkKey), err:
-            raise err
-
-          if not hasBlock:
-            warn "Block metadata is present, but block is absent. Restoring block.",
-              cid = blk.cid
-            if err =? (await self.repoDs.put(blkKey, blk.data)).errorOption:
-              raise err
         else:
           raise newException(
             CatchableError,
@@ -205,24 +421,73 @@ proc storeBlock*(
               $blk.cid,
           )
       else:
-        md = BlockMetadata(size: blk.data.len.NBytes, expiry: minExpiry, refCount: 0)
-        res = StoreResult(kind: Stored, used: blk.data.len.NBytes)
-        if err =? (await self.repoDs.put(blkKey, blk.data)).errorOption:
-          raise err
+        var size = storedSize |? 0.NBytes
+        if storedSize.isNone:
+          let data = await self.encodeBlockData(blk.data)
+          if err =? (await self.shardOf(blkKey).put(blkKey, data)).errorOption:
+            raise err
+
+          size = data.len.NBytes
+
+        md = BlockMetadata(size: size, expiry: minExpiry, refCount: 0)
+        res = StoreResult(kind: Stored, used: size)
 
       (md.some, res),
   )
 
-proc tryDeleteBlock*(
-    self: RepoStore, cid: Cid, expiryLimit = SecondsSince1970.low
-): Future[?!DeleteResult] {.async: (raises: [CancelledError]).} =
+proc writingBlocks*(self: RepoStore, cids: seq[Cid]) =
+  ## Registers the blocks of a batch whose data is about to be written ahead
+  ## of their metadata, so that it isn't dropped as unaccounted for. Pass the
+  ## same cids to `blocksWritten` once their metadata is stored.
+  ##
+
+  for cid in cids:
+    self.blocksWriting.inc(cid)
+
+proc blocksWritten*(self: RepoStore, cids: seq[Cid]) =
+  for cid in cids:
+    let count = self.blocksWriting.getOrDefault(cid) - 1
+    if count > 0:
+      self.blocksWriting[cid] = count
+    else:
+      self.blocksWriting.del(cid)
+
+proc dropUnstoredData*(
+    self: RepoStore, cid: Cid
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Deletes the data of a block unless it has metadata or a batch is writing
+  ## it, checked in a modify of its metadata key, which puts and deletes go
+  ## through as well
+  ##
+
   without metaKey =? createBlockExpirationMetadataKey(cid), err:
     return failure(err)
 
   without blkKey =? makePrefixKey(self.postFixLen, cid), err:
     return failure(err)
 
-  await self.metaDs.modifyGet(
+  await self.metaDs.modify(
+    metaKey,
+    proc(maybeCurrMd: ?BlockMetadata): Future[?BlockMetadata] {.async.} =
+      if maybeCurrMd.isNone and cid notin self.blocksWriting:
+        if err =? (await self.deleteBlockData(blkKey)).errorOption:
+          raise err
+
+      maybeCurrMd,
+  )
+
+proc tryDeleteBlock*(
+    self: RepoStore, cid: Cid, expiryLimit = SecondsSince1970.low
+): Future[?!DeleteResult] {.async: (raises: [CancelledError]).} =
+  ## Deletes the block metadata, then its data, rechecking that no put of
+  ## the block came in between. A crash in between leaves the data alone,
+  ## which is dropped by the next delete of the block, found or not.
+  ##
+
+  without metaKey =? createBlockExpirationMetadataKey(cid), err:
+    return failure(err)
+
+  let deleted = await self.metaDs.modifyGet(
     metaKey,
     proc(
         maybeCurrMd: ?BlockMetadata
@@ -234,10 +499,9 @@ proc tryDeleteBlock*(
       if currMd =? maybeCurrMd:
         if currMd.refCount == 0 or currMd.expiry < expiryLimit:
           maybeMeta = BlockMetadata.none
-          res = DeleteResult(kind: Deleted, released: currMd.size)
-
-          if err =? (await self.repoDs.delete(blkKey)).errorOption:
-            raise err
+          res = DeleteResult(
+            kind: Deleted, released: currMd.size, refCount: currMd.refCount
+          )
         else:
           maybeMeta = currMd.some
           res = DeleteResult(kind: InUse)
@@ -245,14 +509,373 @@ proc tryDeleteBlock*(
         maybeMeta = BlockMetadata.none
         res = DeleteResult(kind: NotFound)
 
-        # making sure that the block acutally is removed from the repoDs
-        without hasBlock =? await self.repoDs.has(blkKey), err:
-          raise err
+      (maybeMeta, res),
+  )
 
-        if hasBlock:
-          warn "Block metadata is absent, but block is present. Removing block.", cid
-          if err =? (await self.repoDs.delete(blkKey)).errorOption:
-            raise err
+  without res =? deleted, err:
+    return failure(err)
 
-      (maybeMeta, res),
+  if res.kind != InUse:
+    if err =? (await self.dropUnstoredData(cid)).errorOption:
+      return failure(err)
+
+  success res
+
+proc indexManifest*(
+    self: RepoStore, blk: Block
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Records the tree cid of a manifest block in the manifest index. This is
+  ## done before the block is stored, so the index never misses a stored
+  ## manifest; entries of blocks that failed to store are dropped when the
+  ## index is listed.
+  ##
+
+  without isManifest =? blk.cid.isManifest, err:
+    return failure(err)
+
+  if not isManifest:
+    return success()
+
+  without manifest =? Manifest.decode(blk), err:
+    return failure(err)
+
+  without key =? createManifestIndexKey(blk.cid), err:
+    return failure(err)
+
+  let entry = ManifestIndexEntry(treeCid: manifest.treeCid)
+  await self.metaDs.modify(
+    key,
+    proc(maybeCurrEntry: ?ManifestIndexEntry): Future[?ManifestIndexEntry] {.async.} =
+      entry.some,
+  )
+
+proc storingManifests*(self: RepoStore, blocks: openArray[Block]): seq[Cid] =
+  ## Registers the manifests among `blocks` as being stored, so that their
+  ## index entries, written ahead of their data, are not dropped as stale.
+  ## Returns the cids to pass to `manifestsStored` once the put is over.
+  ##
+
+  for blk in blocks:
+    if blk.cid.isManifest |? false:
+      self.manifestsStoring.inc(blk.cid)
+      result.add(blk.cid)
+
+proc manifestsStored*(self: RepoStore, cids: seq[Cid]) =
+  for cid in cids:
+    let count = self.manifestsStoring.getOrDefault(cid) - 1
+    if count > 0:
+      self.manifestsStoring[cid] = count
+    else:
+      self.manifestsStoring.del(cid)
+
+proc dropStaleManifest*(
+    self: RepoStore, key: Key, cid: Cid
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Drops the index entry of a manifest found without data, unless the
+  ## manifest is being stored or got stored since. The entry is rechecked in
+  ## a modify of its key, which `indexManifest` writes through as well.
+  ##
+
+  if cid in self.manifestsStoring:
+    return success()
+
+  without blkKey =? makePrefixKey(self.postFixLen, cid), err:
+    return failure(err)
+
+  await self.metaDs.modify(
+    key,
+    proc(maybeCurrEntry: ?ManifestIndexEntry): Future[?ManifestIndexEntry] {.async.} =
+      if cid in self.manifestsStoring:
+        return maybeCurrEntry
+
+      without has =? await self.hasBlockData(blkKey), err:
+        raise err
+
+      if has: maybeCurrEntry else: ManifestIndexEntry.none,
   )
+
+proc unindexManifest*(
+    self: RepoStore, cid: Cid
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Drops a deleted manifest from the manifest index
+  ##
+
+  without isManifest =? cid.isManifest, err:
+    return failure(err)
+
+  if not isManifest:
+    return success()
+
+  without key =? createManifestIndexKey(cid), err:
+    return failure(err)
+
+  await self.metaDs.delete(key)
+
+proc isManifestIndexReady*(
+    self: RepoStore
+): Future[?!bool] {.async: (raises: [CancelledError]).} =
+  let ready = await get[Natural](self.metaDs, ManifestIndexReadyKey)
+  if ready.isErr:
+    if ready.error of DatastoreKeyNotFound:
+      return success false
+
+    return failure(ready.error)
+
+  success ready.get > 0
+
+proc buildManifestIndex*(
+    self: RepoStore
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Indexes the manifests of repos created before the manifest index
+  ## existed. Manifests stored meanwhile are indexed as they are put, so the
+  ## index is complete once this scan is over.
+  ##
+
+  without cids =? await self.listBlocks(BlockType.Manifest), err:
+    return failure(err)
+
+  var indexed = 0
+  for c in cids:
+    without cid =? await c:
+      continue
+
+    without blk =? await self.getBlock(cid), err:
+      warn "Unable to read manifest to index", cid, err = err.msg
+      continue
+
+    if err =? (await self.indexManifest(blk)).errorOption:
+      warn "Unable to index manifest", cid, err = err.msg
+      continue
+
+    inc indexed
+
+  if err =? (
+    await self.metaDs.modify(
+      ManifestIndexReadyKey,
+      proc(maybeCurrReady: ?Natural): Future[?Natural] {.async.} =
+        1.Natural.some,
+    )
+  ).errorOption:
+    return failure(err)
+
+  self.manifestIndexReady = true
+  info "Built manifest index", manifests = indexed
+  success()
+
+proc recoverJournalEntry*(
+    self: RepoStore, key: Key, entry: JournalEntry
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Brings the data and metadata of the blocks of an unfinished journal
+  ## entry back in agreement, then drops the entry. Writes whose metadata
+  ## never landed are rolled back; deletes are completed. Only used when the
+  ## repo starts, before any other write.
+  ##
+
+  for cid in entry.cids:
+    without metaKey =? createBlockExpirationMetadataKey(cid), err:
+      return failure(err)
+
+    without blkKey =? makePrefixKey(self.postFixLen, cid), err:
+      return failure(err)
+
+    let md = await get[BlockMetadata](self.metaDs, metaKey)
+    if md.isErr and not (md.error of DatastoreKeyNotFound):
+      return failure(md.error)
+
+    case entry.op
+    of JournalOp.Store:
+      if md.isErr:
+        trace "Rolling back block write", cid
+        if err =? (await self.deleteBlockData(blkKey)).errorOption:
+          return failure(err)
+    of JournalOp.Delete:
+      if md.isOk:
+        # the metadata outlived the data, so the block was never accounted
+        # as deleted
+        trace "Completing block delete", cid
+        if err =? (await self.deleteBlockData(blkKey)).errorOption:
+          return failure(err)
+
+        if err =? (await self.metaDs.delete(metaKey)).errorOption:
+          return failure(err)
+
+        if err =? (await self.updateTotalBlocksCount(minusCount = 1)).errorOption:
+          return failure(err)
+
+        if err =? (await self.updateQuotaUsage(minusUsed = md.get.size)).errorOption:
+          return failure(err)
+
+        if err =? (await self.unindexManifest(cid)).errorOption:
+          return failure(err)
+
+        if md.get.refCount > 0:
+          if err =? (await self.dropBlockLeaves(cid)).errorOption:
+            return failure(err)
+
+  await self.endJournal(key)
+
+proc recoverJournal*(
+    self: RepoStore
+): Future[?!Natural] {.async: (raises: [CancelledError]).} =
+  ## Replays the journal entries left behind by a crash, returning how many
+  ## there were
+  ##
+
+  without queryKey =? createJournalQueryKey(), err:
+    return failure(err)
+
+  without queryIter =?
+    await query[JournalEntry](self.metaDs, Query.init(queryKey)), err:
+    return failure(err)
+
+  var
+    entries: seq[(Key, JournalEntry)]
+    malformed: seq[Key]
+  try:
+    while not queryIter.finished:
+      without res =? await queryIter.next(), err:
+        return failure(err)
+
+      without key =? res.key:
+        continue
+
+      without entry =? res.value, err:
+        warn "Dropping malformed journal entry", key = $key, err = err.msg
+        malformed.add(key)
+        continue
+
+      entries.add((key, entry))
+  finally:
+    if err =? (await queryIter.dispose()).errorOption:
+      trace "Error disposing journal query", err = err.msg
+
+  for key in malformed:
+    if err =? (await self.endJournal(key)).errorOption:
+      return failure(err)
+
+  for (key, entry) in entries:
+    if err =? (await self.recoverJournalEntry(key, entry)).errorOption:
+      return failure(err)
+
+  success entries.len.Natural
+
+proc parseLegacyLeafKey(key: Key): ?!(Cid, Natural) =
+  ## Legacy leaf keys end with `<treeCid>/<decimal index>`
+  ##
+
+  without parent =? key.parent, err:
+    return failure(err)
+
+  without treeCid =? Cid.init(parent.value).mapFailure, err:
+    return failure(err)
+
+  try:
+    let index = parseInt(key.value)
+    if index < 0:
+      return failure("Negative leaf index " & $index)
+
+    success (treeCid, index.Natural)
+  except ValueError as exc:
+    failure(exc.msg)
+
+proc migrateLegacyLeaves(
+    self: RepoStore
+): Future[?!Natural] {.async: (raises: [CancelledError]).} =
+  ## Moves a batch of leaf metadata from the legacy `meta/proof/<tree>/<index>`
+  ## keys to the fixed width keys, returning how many entries were moved.
+  ## Entries with a malformed key or value are logged and dropped.
+  ##
+
+  without queryKey =? createLegacyBlockCidAndProofMetadataQueryKey(), err:
+    return failure(err)
+
+  without queryIter =? await query[LeafMetadata](
+    self.metaDs, Query.init(queryKey, limit = LeafMigrationBatch)
+  ), err:
+    return failure(err)
+
+  var batch: seq[(Key, ?!LeafMetadata)]
+  try:
+    while not queryIter.finished:
+      without res =? await queryIter.next(), err:
+        return failure(err)
+
+      without key =? res.key:
+        continue
+
+      batch.add((key, res.value))
+  finally:
+    if err =? (await queryIter.dispose()).errorOption:
+      trace "Error disposing legacy leaves query", err = err.msg
+
+  for (key, value) in batch:
+    let leaf = parseLegacyLeafKey(key)
+    if leaf.isErr:
+      warn "Dropping malformed leaf metadata", key = $key, err = leaf.error.msg
+    elif value.isErr:
+      warn "Dropping undecodable leaf metadata", key = $key, err = value.error.msg
+    else:
+      let
+        (treeCid, index) = leaf.get
+        md = value.get
+      if err =? (
+        await self.storeLeafMetadata(treeCid, index, md.blkCid, md.proof)
+      ).errorOption:
+        return failure(err)
+
+    if err =? (await self.metaDs.delete(key)).errorOption:
+      return failure(err)
+
+  success batch.len.Natural
+
+proc loadMetadataVersion*(
+    self: RepoStore
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  let stored = await get[Natural](self.metaDs, MetaVersionKey)
+  if stored.isErr:
+    if not (stored.error of DatastoreKeyNotFound):
+      return failure(stored.error)
+
+    self.metadataMigrated = false
+  else:
+    self.metadataMigrated = stored.get >= MetaVersion
+
+  success()
+
+proc migrateMetadata*(
+    self: RepoStore
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Brings the metadata of repos created by older versions to `MetaVersion`.
+  ## Version 1 moved leaf metadata to fixed width, ordered keys; values are
+  ## rewritten in the binary layouts lazily, as JSON ones still decode.
+  ##
+  ## This runs in the background once the repo is started. Until it is done,
+  ## leaves still under legacy keys are moved when they are read or put, and
+  ## the version is recorded once none are left.
+  ##
+
+  info "Migrating repo metadata", target = MetaVersion
+
+  var migrated = 0
+  while true:
+    without moved =? await self.migrateLegacyLeaves(), err:
+      return failure(err)
+
+    if moved == 0:
+      break
+
+    migrated += moved
+    trace "Migrated leaf metadata", migrated
+
+  if err =? (
+    await self.metaDs.modify(
+      MetaVersionKey,
+      proc(maybeCurrVersion: ?Natural): Future[?Natural] {.async.} =
+        MetaVersion.Natural.some,
+    )
+  ).errorOption:
+    return failure(err)
+
+  self.metadataMigrated = true
+  info "Migrated repo metadata", leaves = migrated
+  success()
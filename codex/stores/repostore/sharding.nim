@@ -0,0 +1,132 @@
+## Logos Storage
+## Copyright (c) 2025 Status Research & Development GmbH
+## Licensed under either of
+##  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+##  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+## at your option.
+## This file may not be copied, modified, or distributed except according to
+## those terms.
+
+## Striping of block data across several datastores, usually one per disk.
+##
+## The shard of a block is picked from a hash of its cid, so it never changes
+## for a given set of shards, and no index is needed to find it. Metadata,
+## quota accounting included, stays in `metaDs`, so the quota covers all
+## shards together. Batched writes are split per shard and issued to all
+## shards at once, each shard doing its own I/O.
+##
+## As placement depends on the number and order of the shards, both are
+## recorded on the first start of a repo: the number of shards in `metaDs`,
+## and its position in each shard. A repo refuses to start with other shards.
+
+import std/sequtils
+
+import pkg/chronos
+import pkg/datastore
+import pkg/datastore/typedds
+import pkg/questionable
+import pkg/questionable/results
+
+import ./coders
+import ./types
+import ../keyutils
+
+func fnv1a(s: string): uint64 =
+  ## Stable across runs and compiler versions, unlike `std/hashes`, as
+  ## blocks must be found on the same shard after a restart
+  ##
+  result = 0xcbf29ce484222325'u64
+  for c in s:
+    result = (result xor c.uint64) * 0x100000001b3'u64
+
+func isSharded*(self: RepoStore): bool =
+  self.shards.len > 1
+
+func shardIndex(self: RepoStore, key: Key): int =
+  (fnv1a(key.value) mod self.shards.len.uint64).int
+
+func shardOf*(self: RepoStore, key: Key): Datastore =
+  ## Datastore holding the data of the block stored under `key`
+  ##
+  if not self.isSharded:
+    return self.repoDs
+
+  self.shards[self.shardIndex(key)]
+
+proc putShards*(
+    self: RepoStore, batch: seq[BatchEntry]
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Writes a batch of block data, one batch per shard, to all shards at once
+  ##
+
+  if not self.isSharded:
+    return await self.repoDs.put(batch)
+
+  var batches = newSeq[seq[BatchEntry]](self.shards.len)
+  for entry in batch:
+    batches[self.shardIndex(entry.key)].add(entry)
+
+  let futs = toSeq(0 ..< batches.len).filterIt(batches[it].len > 0).mapIt(
+      self.shards[it].put(batches[it])
+    )
+  await allFutures(futs)
+
+  for fut in futs:
+    if err =? (await fut).errorOption:
+      return failure(err)
+
+  success()
+
+proc checkShardLayout*(
+    self: RepoStore
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Checks the shards are the ones the block data was striped across, in the
+  ## same order, recording the layout if it wasn't yet. Repos holding blocks
+  ## from before the layout was recorded had a single shard.
+  ##
+
+  var count = self.shards.len.Natural
+  let stored = await get[Natural](self.metaDs, ShardsKey)
+  if stored.isOk:
+    count = stored.get
+  elif not (stored.error of DatastoreKeyNotFound):
+    return failure(stored.error)
+  else:
+    if self.totalBlocks > 0:
+      count = 1
+
+    if err =? (
+      await self.metaDs.modify(
+        ShardsKey,
+        proc(maybeCurr: ?Natural): Future[?Natural] {.async.} =
+          count.some,
+      )
+    ).errorOption:
+      return failure(err)
+
+  if count != self.shards.len:
+    return failure(
+      "Repo data is striped across " & $count & " data directories, " &
+        $self.shards.len & " are configured"
+    )
+
+  for index, shard in self.shards:
+    without bytes =? await shard.get(ShardIndexKey), err:
+      if not (err of DatastoreKeyNotFound):
+        return failure(err)
+
+      if err =? (await shard.put(ShardIndexKey, index.Natural.encode)).errorOption:
+        return failure(err)
+
+      continue
+
+    without stored =? Natural.decode(bytes), err:
+      return failure(err)
+
+    if stored != index:
+      return failure(
+        "Data directory " & $index & " holds shard " & $stored &
+          " of the repo, data directories were reordered"
+      )
+
+  success()
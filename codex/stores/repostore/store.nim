@@ -9,6 +9,9 @@
 
 {.push raises: [].}
 
+import std/sequtils
+import std/tables
+
 import pkg/chronos
 import pkg/chronos/futures
 import pkg/datastore
@@ -18,6 +21,10 @@ import pkg/questionable
 import pkg/questionable/results
 
 import ./coders
+import ./compression
+import ./journal
+import ./sharding
+import ./tiering
 import ./types
 import ./operations
 import ../blockstore
@@ -34,6 +41,8 @@ export blocktype, cid
 logScope:
   topics = "codex repostore"
 
+const CountBlocksBatch = 256 # blocks checked at once when counting leaves
+
 ###########################################################
 # BlockStore API
 ###########################################################
@@ -53,10 +62,11 @@ method getBlocks*(
 
   return SafeAsyncIter[Block].new(genNext, isFinished)
 
-method getBlock*(
-    self: RepoStore, cid: Cid
+proc readBlock(
+    self: RepoStore, cid: Cid, cold: bool
 ): Future[?!Block] {.async: (raises: [CancelledError]).} =
-  ## Get a block from the blockstore
+  ## Read, decode and verify a block, looking first in the capacity tier if
+  ## it belongs to a cold dataset
   ##
 
   logScope:
@@ -70,7 +80,7 @@ method getBlock*(
     trace "Error getting key from provider", err = err.msg
     return failure(err)
 
-  without data =? await self.repoDs.get(key), err:
+  without data =? await self.readBlockData(key, cold), err:
     if not (err of DatastoreKeyNotFound):
       trace "Error getting block from datastore", err = err.msg, key
       return failure(err)
@@ -78,7 +88,48 @@ method getBlock*(
     return failure(newException(BlockNotFoundError, err.msg))
 
   trace "Got block for cid", cid
-  return Block.new(cid, data, verify = true)
+  return decodeBlock(cid, data)
+
+proc getBlockInternal(
+    self: RepoStore, cid: Cid, cold = false
+): Future[?!Block] {.async: (raises: [CancelledError]).} =
+  ## Get a block, joining the read of the block already in flight if any, so
+  ## that concurrent readers of a block share a single read and verification.
+  ## Reads looking first in the capacity tier are shared apart from the
+  ## others. Cancelling a reader doesn't cancel the read the others are
+  ## waiting on.
+  ##
+  ## Readers of a shared read get the same `Block`, which must not be
+  ## mutated, beyond caching its deflate stream.
+  ##
+
+  let key = (cid, cold)
+  var read = self.blockReads.getOrDefault(key)
+  if read.isNil:
+    read = self.readBlock(cid, cold)
+    if not read.finished:
+      self.blockReads[key] = read
+      read.addCallback(
+        proc(udata: pointer) {.gcsafe, raises: [].} =
+          self.blockReads.del(key)
+      )
+
+  await read.join()
+  return await read
+
+method getBlock*(
+    self: RepoStore, cid: Cid
+): Future[?!Block] {.async: (raw: true, raises: [CancelledError]).} =
+  ## Get a block from the blockstore
+  ##
+
+  self.getBlockInternal(cid)
+
+proc getDatasetBlock(
+    self: RepoStore, treeCid: Cid, blkCid: Cid
+): Future[?!Block] {.async: (raw: true, raises: [CancelledError]).} =
+  self.datasetRead(treeCid)
+  self.getBlockInternal(blkCid, cold = treeCid in self.coldDatasets)
 
 method getBlockAndProof*(
     self: RepoStore, treeCid: Cid, index: Natural
@@ -86,7 +137,7 @@ method getBlockAndProof*(
   without leafMd =? await self.getLeafMetadata(treeCid, index), err:
     return failure(err)
 
-  without blk =? await self.getBlock(leafMd.blkCid), err:
+  without blk =? await self.getDatasetBlock(treeCid, leafMd.blkCid), err:
     return failure(err)
 
   success((blk, leafMd.proof))
@@ -97,7 +148,7 @@ method getBlock*(
   without leafMd =? await self.getLeafMetadata(treeCid, index), err:
     return failure(err)
 
-  await self.getBlock(leafMd.blkCid)
+  await self.getDatasetBlock(treeCid, leafMd.blkCid)
 
 method getBlock*(
     self: RepoStore, address: BlockAddress
@@ -135,10 +186,11 @@ method ensureExpiry*(
 
   await self.ensureExpiry(leafMd.blkCid, expiry)
 
-method putCidAndProof*(
+proc putLeaf(
     self: RepoStore, treeCid: Cid, index: Natural, blkCid: Cid, proof: CodexProof
-): Future[?!void] {.async: (raises: [CancelledError]).} =
-  ## Put a block to the blockstore
+): Future[?!StoreResultKind] {.async: (raises: [CancelledError]).} =
+  ## Stores the metadata of a leaf and references its block. The caller counts
+  ## new leaves in their tree.
   ##
 
   logScope:
@@ -151,15 +203,39 @@ method putCidAndProof*(
   without res =? await self.putLeafMetadata(treeCid, index, blkCid, proof), err:
     return failure(err)
 
+  self.datasetWritten(treeCid)
+
+  if res == AlreadyInStore:
+    trace "Leaf metadata already exists"
+    return success res
+
   if blkCid.mcodec == BlockCodec:
-    if res == Stored:
-      if err =? (await self.updateBlockMetadata(blkCid, plusRefCount = 1)).errorOption:
-        return failure(err)
-      trace "Leaf metadata stored, block refCount incremented"
-    else:
-      trace "Leaf metadata already exists"
+    if err =? (await self.updateBlockMetadata(blkCid, plusRefCount = 1)).errorOption:
+      # the leaf is stored again, and counted, once its block is
+      without _ =? await self.removeLeafMetadata(treeCid, index, blkCid), delErr:
+        warn "Unable to remove leaf metadata", err = delErr.msg
+      return failure(err)
 
-  return success()
+    if err =? (await self.addBlockLeaf(blkCid, treeCid, index)).errorOption:
+      return failure(err)
+
+    trace "Leaf metadata stored, block refCount incremented"
+
+  success res
+
+method putCidAndProof*(
+    self: RepoStore, treeCid: Cid, index: Natural, blkCid: Cid, proof: CodexProof
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Put a block to the blockstore
+  ##
+
+  without res =? await self.putLeaf(treeCid, index, blkCid, proof), err:
+    return failure(err)
+
+  if res == Stored:
+    return await self.updateLeafCount(treeCid, plusCount = 1)
+
+  success()
 
 method getCidAndProof*(
     self: RepoStore, treeCid: Cid, index: Natural
@@ -177,17 +253,17 @@ method getCid*(
 
   success(leafMd.blkCid)
 
-method putBlock*(
-    self: RepoStore, blk: Block, ttl = Duration.none
+proc putBlockInternal(
+    self: RepoStore, blk: Block, ttl: ?Duration
 ): Future[?!void] {.async: (raises: [CancelledError]).} =
-  ## Put a block to the blockstore
-  ##
-
   logScope:
     cid = blk.cid
 
   let expiry = self.clock.now() + (ttl |? self.blockTtl).seconds
 
+  if err =? (await self.indexManifest(blk)).errorOption:
+    return failure(err)
+
   without res =? await self.storeBlock(blk, expiry), err:
     return failure(err)
 
@@ -209,6 +285,239 @@ method putBlock*(
 
   return success()
 
+method putBlock*(
+    self: RepoStore, blk: Block, ttl = Duration.none
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Put a block to the blockstore
+  ##
+
+  let manifests = self.storingManifests([blk])
+  try:
+    return await self.putBlockInternal(blk, ttl)
+  finally:
+    self.manifestsStored(manifests)
+
+proc putBlocksInternal(
+    self: RepoStore, blocks: seq[Block], ttl: ?Duration
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  let expiry = self.clock.now() + (ttl |? self.blockTtl).seconds
+
+  # blocks already stored only get their metadata updated
+  let presentFuts = blocks.mapIt(self.hasBlockMetadata(it.cid))
+  await allFutures(presentFuts)
+
+  var missing: seq[int]
+  for i, blk in blocks:
+    if blk.isEmpty:
+      continue
+
+    without present =? (await presentFuts[i]), err:
+      return failure(err)
+
+    if err =? (await self.indexManifest(blk)).errorOption:
+      return failure(err)
+
+    if not present:
+      missing.add(i)
+
+  # only the data of missing blocks is encoded, large blocks on the taskpool
+  let encodeFuts = missing.mapIt(self.encodeBlockData(blocks[it].data))
+  await allFutures(encodeFuts)
+
+  var
+    batch: seq[BatchEntry]
+    batchCids: seq[Cid]
+    storedSizes = newSeq[Option[NBytes]](blocks.len)
+    charged = 0.NBytes
+  for j, i in missing:
+    without key =? makePrefixKey(self.postFixLen, blocks[i].cid), err:
+      return failure(err)
+
+    let data = await encodeFuts[j]
+    storedSizes[i] = data.len.NBytes.some
+    charged += data.len.NBytes
+    batch.add((key, data))
+    batchCids.add(blocks[i].cid)
+
+  proc settleQuota(used: NBytes): Future[?!void] {.async: (raises: [CancelledError]).} =
+    # brings the bytes charged for the batch to the bytes it ended up using
+    let settled =
+      if used > charged:
+        await self.updateQuotaUsage(plusUsed = used - charged)
+      elif used < charged:
+        await self.updateQuotaUsage(minusUsed = charged - used)
+      else:
+        success()
+
+    if settled.isOk:
+      charged = used
+
+    settled
+
+  proc refund() {.async: (raises: [CancelledError]).} =
+    if err =? (await settleQuota(0.NBytes)).errorOption:
+      warn "Unable to release the quota of the batch", err = err.msg
+
+  var journalKey: ?Key
+  proc dropUnstored() {.async: (raises: [CancelledError]).} =
+    # drops the data written by the batch for blocks it didn't store, once
+    # nothing else may store them, then the journal entry
+    for cid in batchCids:
+      if err =? (await self.dropUnstoredData(cid)).errorOption:
+        warn "Unable to roll back block data", cid, err = err.msg
+        return
+
+    if key =? journalKey:
+      if err =? (await self.endJournal(key)).errorOption:
+        warn "Unable to drop the journal entry of the batch", err = err.msg
+
+  if batch.len > 0:
+    # charged before the data is written, so that a full repo takes none of it
+    if err =? (await self.updateQuotaUsage(plusUsed = charged)).errorOption:
+      return failure(err)
+
+    if self.unified and not self.isSharded:
+      # the journal entry goes in the same batch as the data
+      without key =? self.newJournalKey(), err:
+        await refund()
+        return failure(err)
+
+      journalKey = key.some
+      batch.add((key, JournalEntry(op: JournalOp.Store, cids: batchCids).encode))
+    else:
+      without key =? await self.beginJournal(JournalOp.Store, batchCids), err:
+        await refund()
+        return failure(err)
+
+      journalKey = key.some
+
+  var
+    written = success()
+    results = newSeq[?!StoreResult](blocks.len)
+  self.writingBlocks(batchCids)
+  try:
+    if batch.len > 0:
+      written = await self.putShards(batch)
+
+    if written.isOk:
+      let futs = toSeq(0 ..< blocks.len).mapIt(
+          self.storeBlock(blocks[it], expiry, storedSizes[it])
+        )
+      await allFutures(futs)
+      for i, fut in futs:
+        results[i] = await fut
+  finally:
+    self.blocksWritten(batchCids)
+
+  if err =? written.errorOption:
+    await dropUnstored()
+    await refund()
+    return failure(err)
+
+  var
+    stored: seq[Cid]
+    used = 0.NBytes
+    failed: seq[Cid]
+    lastErr: ref CatchableError
+
+  for i, maybeRes in results:
+    without res =? maybeRes, err:
+      failed.add(blocks[i].cid)
+      lastErr = err
+      continue
+
+    if res.kind == Stored:
+      stored.add(blocks[i].cid)
+      used += res.used
+
+  proc rollback(cids: seq[Cid]) {.async: (raises: [CancelledError]).} =
+    # deletes the blocks stored by the batch, along with the data of those it
+    # wrote but didn't store
+    var released = 0.NBytes
+    for cid in cids:
+      without res =? await self.tryDeleteBlock(cid), err:
+        warn "Unable to roll back block", cid, err = err.msg
+        continue
+
+      if res.kind == Deleted:
+        released += res.released
+
+    await dropUnstored()
+
+    if err =? (await settleQuota(used - released)).errorOption:
+      warn "Unable to release the quota of the batch", err = err.msg
+
+  if failed.len > 0:
+    await rollback(stored)
+    return failure(lastErr)
+
+  if key =? journalKey:
+    if err =? (await self.endJournal(key)).errorOption:
+      await rollback(stored)
+      return failure(err)
+
+    journalKey = Key.none
+
+  if err =? (await settleQuota(used)).errorOption:
+    await rollback(stored)
+    return failure(err)
+
+  if stored.len > 0:
+    if err =? (await self.updateTotalBlocksCount(plusCount = stored.len)).errorOption:
+      await rollback(stored)
+      return failure(err)
+
+    if onBlock =? self.onBlockStored:
+      for cid in stored:
+        await onBlock(cid)
+
+  trace "Blocks stored", blocks = blocks.len, stored = stored.len, used
+  success()
+
+method putBlocks*(
+    self: RepoStore, blocks: seq[Block], ttl = Duration.none
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Put several blocks with a single batched write of the data of those not
+  ## stored yet. The batch is charged against the quota before its data is
+  ## written, and every failure after that rolls it back and refunds it.
+  ##
+
+  let manifests = self.storingManifests(blocks)
+  try:
+    return await self.putBlocksInternal(blocks, ttl)
+  finally:
+    self.manifestsStored(manifests)
+
+method putCidsAndProofs*(
+    self: RepoStore, leaves: seq[LeafEntry]
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Put several block proofs, updating their metadata concurrently, and the
+  ## count of each tree once
+  ##
+
+  let futs = leaves.mapIt(self.putLeaf(it.treeCid, it.index, it.blkCid, it.proof))
+  await allFutures(futs)
+
+  var
+    stored: CountTable[Cid]
+    lastErr: ref CatchableError
+  for i, fut in futs:
+    without res =? (await fut), err:
+      lastErr = err
+      continue
+
+    if res == Stored:
+      stored.inc(leaves[i].treeCid)
+
+  for treeCid, count in stored:
+    if err =? (await self.updateLeafCount(treeCid, plusCount = count)).errorOption:
+      return failure(err)
+
+  if not lastErr.isNil:
+    return failure(lastErr)
+
+  success()
+
 proc delBlockInternal(
     self: RepoStore, cid: Cid
 ): Future[?!DeleteResultKind] {.async: (raises: [CancelledError]).} =
@@ -231,6 +540,14 @@ proc delBlockInternal(
     if err =? (await self.updateQuotaUsage(minusUsed = res.released)).errorOption:
       return failure(err)
 
+    if err =? (await self.unindexManifest(cid)).errorOption:
+      return failure(err)
+
+    if res.refCount > 0:
+      # an expired block, still referenced by leaves
+      if err =? (await self.dropBlockLeaves(cid)).errorOption:
+        return failure(err)
+
   success(res.kind)
 
 method delBlock*(
@@ -264,10 +581,21 @@ method delBlock*(
     else:
       return failure(err)
 
-  if err =? (await self.delLeafMetadata(treeCid, index)).errorOption:
+  without removed =? await self.removeLeafMetadata(treeCid, index, leafMd.blkCid), err:
     error "Failed to delete leaf metadata, block will remain on disk.", err = err.msg
     return failure(err)
 
+  if removed != Deleted:
+    trace "Leaf metadata already deleted", treeCid, index
+    return success()
+
+  if err =? (await self.updateLeafCount(treeCid, minusCount = 1)).errorOption:
+    return failure(err)
+
+  if leafMd.blkCid.mcodec == BlockCodec:
+    if err =? (await self.delBlockLeaf(leafMd.blkCid, treeCid, index)).errorOption:
+      return failure(err)
+
   if err =?
       (await self.updateBlockMetadata(leafMd.blkCid, minusRefCount = 1)).errorOption:
     if not (err of BlockNotFoundError):
@@ -295,7 +623,7 @@ method hasBlock*(
     trace "Error getting key from provider", err = err.msg
     return failure(err)
 
-  return await self.repoDs.has(key)
+  return await self.hasBlockData(key)
 
 method hasBlock*(
     self: RepoStore, treeCid: Cid, index: Natural
@@ -308,24 +636,81 @@ method hasBlock*(
 
   await self.hasBlock(leafMd.blkCid)
 
-method listBlocks*(
-    self: RepoStore, blockType = BlockType.Manifest
-): Future[?!SafeAsyncIter[Cid]] {.async: (raises: [CancelledError]).} =
-  ## Get the list of blocks in the RepoStore.
-  ## This is an intensive operation
+method countBlocks*(
+    self: RepoStore, treeCid: Cid, blocksCount: Natural
+): Future[?!Natural] {.async: (raises: [CancelledError]).} =
+  ## Counts the leaves of a tree whose block is stored, from the count kept
+  ## as leaves are put and deleted. Trees of older repos may have leaves put
+  ## before counting started, so unless the count says they are complete,
+  ## their leaves are counted from their metadata, checking their blocks
+  ## concurrently.
   ##
 
-  var iter = SafeAsyncIter[Cid]()
+  without counted =? await self.leafCount(treeCid), err:
+    return failure(err)
 
-  let key =
-    case blockType
-    of BlockType.Manifest: CodexManifestKey
-    of BlockType.Block: CodexBlocksKey
-    of BlockType.Both: CodexRepoKey
+  if self.leavesCounted or counted >= blocksCount:
+    return success min(counted, blocksCount)
+
+  without queryKey =? createBlockCidAndProofMetadataQueryKey(treeCid), err:
+    return failure(err)
+
+  without queryIter =? await query[LeafBlockCid](self.metaDs, Query.init(queryKey)),
+    err:
+    trace "Error querying leaves in repo", treeCid, err = err.msg
+    return failure(err)
+
+  var
+    count: Natural = 0
+    batch: seq[Cid]
+
+  proc countBatch(): Future[?!void] {.async: (raises: [CancelledError]).} =
+    let futs = batch.mapIt(self.hasBlock(it))
+    batch.setLen(0)
+    await allFutures(futs)
+
+    for fut in futs:
+      without has =? (await fut), err:
+        return failure(err)
+
+      if has:
+        inc(count)
+
+    success()
+
+  try:
+    while not queryIter.finished:
+      without res =? await queryIter.next(), err:
+        return failure(err)
+
+      if res.key.isNone:
+        continue
+
+      without leaf =? res.value, err:
+        trace "Skipping invalid leaf metadata", treeCid, err = err.msg
+        continue
+
+      batch.add(leaf.blkCid)
+      if batch.len >= CountBlocksBatch:
+        if err =? (await countBatch()).errorOption:
+          return failure(err)
+
+    if err =? (await countBatch()).errorOption:
+      return failure(err)
+  finally:
+    if err =? (await queryIter.dispose()).errorOption:
+      trace "Error disposing leaves query", treeCid, err = err.msg
+
+  success min(count, blocksCount)
+
+proc listTierBlocks(
+    ds: Datastore, key: Key
+): Future[?!SafeAsyncIter[Cid]] {.async: (raises: [CancelledError]).} =
+  var iter = SafeAsyncIter[Cid]()
 
   let query = Query.init(key, value = false)
-  without queryIter =? (await self.repoDs.query(query)), err:
-    trace "Error querying cids in repo", blockType, err = err.msg
+  without queryIter =? (await ds.query(query)), err:
+    trace "Error querying cids in repo", key, err = err.msg
     return failure(err)
 
   proc next(): Future[?!Cid] {.async: (raises: [CancelledError]).} =
@@ -343,6 +728,105 @@ method listBlocks*(
   iter.next = next
   return success iter
 
+method listBlocks*(
+    self: RepoStore, blockType = BlockType.Manifest
+): Future[?!SafeAsyncIter[Cid]] {.async: (raises: [CancelledError]).} =
+  ## Get the list of blocks in the RepoStore, from every shard and tier.
+  ## This is an intensive operation
+  ##
+
+  let key =
+    case blockType
+    of BlockType.Manifest: CodexManifestKey
+    of BlockType.Block: CodexBlocksKey
+    of BlockType.Both: CodexRepoKey
+
+  var datastores = self.shards
+  if self.isTiered:
+    datastores.add(self.capacityDs)
+
+  var iters: seq[SafeAsyncIter[Cid]]
+  for ds in datastores:
+    without iter =? await listTierBlocks(ds, key), err:
+      return failure(err)
+
+    iters.add(iter)
+
+  if iters.len == 1:
+    return success iters[0]
+
+  success chain(iters)
+
+method listManifests*(
+    self: RepoStore
+): Future[?!SafeAsyncIter[ManifestEntry]] {.async: (raises: [CancelledError]).} =
+  ## List the manifests from the manifest index, without reading the manifest
+  ## blocks. Until the index of an older repo is built, this falls back to
+  ## scanning the manifest blocks.
+  ##
+
+  if not self.manifestIndexReady:
+    return await procCall BlockStore(self).listManifests()
+
+  without queryKey =? createManifestIndexQueryKey(), err:
+    return failure(err)
+
+  without queryIter =?
+    await query[ManifestIndexEntry](self.metaDs, Query.init(queryKey)), err:
+    trace "Error querying manifest index", err = err.msg
+    return failure(err)
+
+  var
+    iter = SafeAsyncIter[ManifestEntry]()
+    stale: seq[(Key, Cid)]
+
+  proc finish() {.async: (raises: [CancelledError]).} =
+    iter.finish
+    if err =? (await queryIter.dispose()).errorOption:
+      trace "Error disposing manifest index query", err = err.msg
+
+    # entries of manifests which failed to store, dropped once the query is
+    # over as not all datastores allow deleting while iterating
+    for (key, cid) in stale:
+      if err =? (await self.dropStaleManifest(key, cid)).errorOption:
+        trace "Error dropping stale manifest index entry", key = $key, err = err.msg
+
+  proc next(): Future[?!ManifestEntry] {.async: (raises: [CancelledError]).} =
+    if iter.finished:
+      return ManifestEntry.failure("No more manifests")
+
+    await idleAsync()
+    while not queryIter.finished:
+      without res =? await queryIter.next(), err:
+        return failure(err)
+
+      without key =? res.key:
+        continue
+
+      without entry =? res.value, err:
+        return failure(err)
+
+      without cid =? Cid.init(key.value).mapFailure, err:
+        return failure(err)
+
+      without blkKey =? makePrefixKey(self.postFixLen, cid), err:
+        return failure(err)
+
+      without has =? await self.hasBlockData(blkKey), err:
+        return failure(err)
+
+      if not has:
+        stale.add((key, cid))
+        continue
+
+      return success (manifestCid: cid, treeCid: entry.treeCid)
+
+    await finish()
+    ManifestEntry.failure("No more manifests")
+
+  iter.next = next
+  return success iter
+
 proc createBlockExpirationQuery(maxNumber: int, offset: int): ?!Query =
   let queryKey = ?createBlockExpirationMetadataQueryKey()
   success Query.init(queryKey, offset = offset, limit = maxNumber)
@@ -405,7 +889,7 @@ method close*(self: RepoStore): Future[void] {.async: (raises: []).} =
 
   trace "Closing repostore"
 
-  if not self.metaDs.isNil:
+  if not self.metaDs.isNil and not self.unified:
     try:
       (await noCancel self.metaDs.close()).expect("Should meta datastore")
     except CatchableError as err:
@@ -414,6 +898,19 @@ method close*(self: RepoStore): Future[void] {.async: (raises: []).} =
   if not self.repoDs.isNil:
     (await noCancel self.repoDs.close()).expect("Should repo datastore")
 
+  for shard in self.shards:
+    if shard != self.repoDs:
+      try:
+        (await noCancel shard.close()).expect("Should close shard datastore")
+      except CatchableError as err:
+        error "Failed to close shard datastore", err = err.msg
+
+  if not self.capacityDs.isNil:
+    try:
+      (await noCancel self.capacityDs.close()).expect("Should capacity datastore")
+    except CatchableError as err:
+      error "Failed to close capacity datastore", err = err.msg
+
 ###########################################################
 # RepoStore procs
 ###########################################################
@@ -448,12 +945,68 @@ proc start*(
     return
 
   trace "Starting rep"
+  if err =? (await self.loadMetadataVersion()).errorOption:
+    raise newException(CodexError, err.msg)
+
+  if not self.metadataMigrated:
+    proc migrate() {.async: (raises: []).} =
+      try:
+        if err =? (await self.migrateMetadata()).errorOption:
+          warn "Unable to migrate repo metadata", err = err.msg
+      except CancelledError:
+        trace "Migrating repo metadata cancelled"
+
+    self.metadataMigrator = migrate()
+
+  without recovered =? await self.recoverJournal(), err:
+    raise newException(CodexError, err.msg)
+
+  if recovered > 0:
+    info "Recovered unfinished block writes and deletes", entries = recovered
+
   if err =? (await self.updateTotalBlocksCount()).errorOption:
     raise newException(CodexError, err.msg)
 
   if err =? (await self.updateQuotaUsage()).errorOption:
     raise newException(CodexError, err.msg)
 
+  if err =? (await self.checkShardLayout()).errorOption:
+    raise newException(CodexError, err.msg)
+
+  if err =? (await self.loadLeavesCounted()).errorOption:
+    raise newException(CodexError, err.msg)
+
+  without ready =? await self.isManifestIndexReady(), err:
+    raise newException(CodexError, err.msg)
+
+  self.manifestIndexReady = ready
+  if not ready:
+    proc buildIndex() {.async: (raises: []).} =
+      try:
+        if err =? (await self.buildManifestIndex()).errorOption:
+          warn "Unable to build manifest index", err = err.msg
+      except CancelledError:
+        trace "Building manifest index cancelled"
+
+    self.manifestIndexer = buildIndex()
+
+  if self.isTiered:
+    if err =? (await self.loadColdDatasets()).errorOption:
+      raise newException(CodexError, err.msg)
+
+    self.tieringStarted = Moment.now()
+
+    proc tieringLoop() {.async: (raises: []).} =
+      try:
+        while true:
+          await sleepAsync(self.tieringInterval)
+          if err =? (await self.runTiering()).errorOption:
+            warn "Tiering pass failed", err = err.msg
+      except CancelledError:
+        trace "Tiering loop cancelled"
+
+    self.tiering = tieringLoop()
+
   self.started = true
 
 proc stop*(self: RepoStore): Future[void] {.async: (raises: []).} =
@@ -464,5 +1017,13 @@ proc stop*(self: RepoStore): Future[void] {.async: (raises: []).} =
     return
 
   trace "Stopping repo"
+  if not self.metadataMigrator.isNil and not self.metadataMigrator.finished:
+    await noCancel self.metadataMigrator.cancelAndWait()
+
+  if not self.manifestIndexer.isNil and not self.manifestIndexer.finished:
+    await noCancel self.manifestIndexer.cancelAndWait()
+
+  if not self.tiering.isNil and not self.tiering.finished:
+    await noCancel self.tiering.cancelAndWait()
 
   self.started = false
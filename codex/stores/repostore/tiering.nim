@@ -0,0 +1,352 @@
+## Logos Storage
+## Copyright (c) 2025 Status Research & Development GmbH
+## Licensed under either of
+##  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+##  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+## at your option.
+## This file may not be copied, modified, or distributed except according to
+## those terms.
+
+## Tiering of block data between a fast tier (`repoDs`) and a capacity tier
+## (`capacityDs`).
+##
+## New blocks are always written to the fast tier, as is all the metadata.
+## A background pass moves the blocks of datasets which were not read or
+## written for `coldAfter` to the capacity tier, and brings back cold datasets that are
+## read often again. The tree cids of the datasets on the capacity tier are
+## kept under `meta/tiers`, so reads of their blocks go straight to the
+## capacity tier. Blocks shared with other datasets, or moved while being
+## read, are found by falling back to the other tier.
+
+import std/sequtils
+import std/sets
+import std/tables
+
+import pkg/chronos
+import pkg/datastore
+import pkg/datastore/typedds
+import pkg/libp2p/cid
+import pkg/questionable
+import pkg/questionable/results
+
+import ./coders
+import ./sharding
+import ./types
+import ../blockstore
+import ../keyutils
+import ../../logutils
+import ../../utils/safeasynciter
+
+logScope:
+  topics = "codex repostore tiering"
+
+const
+  TierMoveBatch = 256 # blocks moved per batched write
+  PromoteReads* = 16 # reads of a cold dataset, per pass, bringing it back
+
+func isTiered*(self: RepoStore): bool =
+  not self.capacityDs.isNil
+
+proc datasetRead*(self: RepoStore, treeCid: Cid) =
+  ## Records a read of a block of the dataset
+  ##
+  if not self.isTiered:
+    return
+
+  var reads = self.datasetReads.getOrDefault(treeCid)
+  reads.lastRead = Moment.now()
+  inc reads.reads
+  self.datasetReads[treeCid] = reads
+
+proc datasetWritten*(self: RepoStore, treeCid: Cid) =
+  ## Records a write of a block of the dataset, which keeps it on the fast
+  ## tier like a read, without counting towards its promotion
+  ##
+  if not self.isTiered:
+    return
+
+  self.datasetReads.mgetOrPut(treeCid, DatasetReads()).lastRead = Moment.now()
+
+proc readBlockData*(
+    self: RepoStore, key: Key, cold = false
+): Future[?!seq[byte]] {.async: (raises: [CancelledError]).} =
+  ## Reads block data from the tier it is expected on, then from the other one
+  ##
+
+  let
+    fast = self.shardOf(key)
+    tiers =
+      if cold and self.isTiered:
+        @[self.capacityDs, fast]
+      elif self.isTiered:
+        @[fast, self.capacityDs]
+      else:
+        @[fast]
+
+  var notFound: ref CatchableError
+  for ds in tiers:
+    without data =? await ds.get(key), err:
+      if not (err of DatastoreKeyNotFound):
+        return failure(err)
+
+      notFound = err
+      continue
+
+    return success data
+
+  failure(notFound)
+
+proc hasBlockData*(
+    self: RepoStore, key: Key
+): Future[?!bool] {.async: (raises: [CancelledError]).} =
+  without has =? await self.shardOf(key).has(key), err:
+    return failure(err)
+
+  if has or not self.isTiered:
+    return success has
+
+  await self.capacityDs.has(key)
+
+proc deleteBlockData*(
+    self: RepoStore, key: Key
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## Deletes block data from every tier
+  ##
+
+  if err =? (await self.shardOf(key).delete(key)).errorOption:
+    return failure(err)
+
+  if self.isTiered:
+    if err =? (await self.capacityDs.delete(key)).errorOption:
+      return failure(err)
+
+  success()
+
+proc loadColdDatasets*(
+    self: RepoStore
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  without queryKey =? createColdDatasetQueryKey(), err:
+    return failure(err)
+
+  without queryIter =? await query[Natural](self.metaDs, Query.init(queryKey)), err:
+    return failure(err)
+
+  try:
+    while not queryIter.finished:
+      without res =? await queryIter.next(), err:
+        return failure(err)
+
+      without key =? res.key:
+        continue
+
+      without treeCid =? Cid.init(key.value).mapFailure, err:
+        warn "Invalid cold dataset key", key = $key, err = err.msg
+        continue
+
+      self.coldDatasets.incl(treeCid)
+  finally:
+    if err =? (await queryIter.dispose()).errorOption:
+      trace "Error disposing cold datasets query", err = err.msg
+
+  success()
+
+proc datasetBlocks(
+    self: RepoStore, treeCid: Cid
+): Future[?!seq[Cid]] {.async: (raises: [CancelledError]).} =
+  without queryKey =? createBlockCidAndProofMetadataQueryKey(treeCid), err:
+    return failure(err)
+
+  without queryIter =?
+    await query[LeafBlockCid](self.metaDs, Query.init(queryKey)), err:
+    return failure(err)
+
+  var
+    seen: HashSet[Cid]
+    cids: seq[Cid]
+  try:
+    while not queryIter.finished:
+      without res =? await queryIter.next(), err:
+        return failure(err)
+
+      if res.key.isNone:
+        continue
+
+      without leafMd =? res.value, err:
+        return failure(err)
+
+      if not seen.containsOrIncl(leafMd.blkCid):
+        cids.add(leafMd.blkCid)
+  finally:
+    if err =? (await queryIter.dispose()).errorOption:
+      trace "Error disposing dataset leaves query", err = err.msg
+
+  success cids
+
+proc moveDataset*(
+    self: RepoStore, treeCid: Cid, toCapacity: bool
+): Future[?!Natural] {.async: (raises: [CancelledError]).} =
+  ## Moves the blocks of a dataset to the capacity tier, or back to the fast
+  ## one. Blocks are written to their new tier before being deleted from the
+  ## old one, so they are always found by reads. Blocks deleted while being
+  ## moved are dropped from both tiers once written, their metadata being
+  ## rechecked in a modify of its key, which deletes go through as well.
+  ##
+
+  without cids =? await self.datasetBlocks(treeCid), err:
+    return failure(err)
+
+  var moved = 0
+  for first in countup(0, cids.len - 1, TierMoveBatch):
+    var
+      batch: seq[BatchEntry]
+      batchCids: seq[Cid]
+    for cid in cids[first ..< min(first + TierMoveBatch, cids.len)]:
+      without key =? makePrefixKey(self.postFixLen, cid), err:
+        return failure(err)
+
+      let src = if toCapacity: self.shardOf(key) else: self.capacityDs
+      without data =? await src.get(key), err:
+        if err of DatastoreKeyNotFound:
+          continue # already on the other tier, or deleted
+        return failure(err)
+
+      batch.add((key, data))
+      batchCids.add(cid)
+
+    if batch.len == 0:
+      continue
+
+    let stored =
+      if toCapacity:
+        await self.capacityDs.put(batch)
+      else:
+        await self.putShards(batch)
+
+    if err =? stored.errorOption:
+      return failure(err)
+
+    for i in 0 ..< batch.len:
+      without metaKey =? createBlockExpirationMetadataKey(batchCids[i]), err:
+        return failure(err)
+
+      let
+        key = batch[i].key
+        src = if toCapacity: self.shardOf(key) else: self.capacityDs
+      if err =? (
+        await self.metaDs.modify(
+          metaKey,
+          proc(maybeCurrMd: ?BlockMetadata): Future[?BlockMetadata] {.async.} =
+            let deleted =
+              if maybeCurrMd.isSome:
+                await src.delete(key)
+              else:
+                await self.deleteBlockData(key)
+
+            if err =? deleted.errorOption:
+              raise err
+
+            maybeCurrMd,
+        )
+      ).errorOption:
+        return failure(err)
+
+    moved += batch.len
+
+  success moved.Natural
+
+proc setCold(
+    self: RepoStore, treeCid: Cid, cold: bool
+): Future[?!void] {.async: (raises: [CancelledError]).} =
+  without key =? createColdDatasetKey(treeCid), err:
+    return failure(err)
+
+  if cold:
+    if err =? (
+      await self.metaDs.modify(
+        key,
+        proc(maybeCurr: ?Natural): Future[?Natural] {.async.} =
+          1.Natural.some,
+      )
+    ).errorOption:
+      return failure(err)
+
+    self.coldDatasets.incl(treeCid)
+  else:
+    if err =? (await self.metaDs.delete(key)).errorOption:
+      return failure(err)
+
+    self.coldDatasets.excl(treeCid)
+
+  success()
+
+proc runTiering*(self: RepoStore): Future[?!void] {.async: (raises: [CancelledError]).} =
+  ## A tiering pass: demotes datasets not read for `coldAfter`, and promotes
+  ## cold datasets read at least `PromoteReads` times since the last pass
+  ##
+
+  without manifests =? await self.listManifests(), err:
+    return failure(err)
+
+  let now = Moment.now()
+  var
+    datasets: HashSet[Cid]
+    demoted, promoted = 0
+
+  for m in manifests:
+    without entry =? await m:
+      continue
+
+    let treeCid = entry.treeCid
+    datasets.incl(treeCid)
+
+    let
+      reads = self.datasetReads.getOrDefault(
+        treeCid, DatasetReads(lastRead: self.tieringStarted)
+      )
+      cold = treeCid in self.coldDatasets
+
+    if not cold and now - reads.lastRead >= self.coldAfter:
+      without moved =? await self.moveDataset(treeCid, toCapacity = true), err:
+        warn "Unable to move dataset to the capacity tier", treeCid, err = err.msg
+        continue
+
+      if err =? (await self.setCold(treeCid, true)).errorOption:
+        return failure(err)
+
+      trace "Moved dataset to the capacity tier", treeCid, blocks = moved
+      inc demoted
+    elif cold and reads.reads >= PromoteReads:
+      # the dataset is unmarked once moved, reads meanwhile fall back to the
+      # fast tier for the blocks already moved
+      without moved =? await self.moveDataset(treeCid, toCapacity = false), err:
+        warn "Unable to move dataset to the fast tier", treeCid, err = err.msg
+        continue
+
+      if err =? (await self.setCold(treeCid, false)).errorOption:
+        return failure(err)
+
+      trace "Moved dataset to the fast tier", treeCid, blocks = moved
+      inc promoted
+
+  # drops the marks of deleted datasets
+  for treeCid in self.coldDatasets.toSeq:
+    if treeCid notin datasets:
+      if err =? (await self.setCold(treeCid, false)).errorOption:
+        return failure(err)
+
+  # reads of cold datasets only matter until the next pass, and datasets
+  # idle for `coldAfter` are cold or deleted
+  var idle: seq[Cid]
+  for treeCid, reads in self.datasetReads.mpairs:
+    if treeCid in self.coldDatasets or now - reads.lastRead >= self.coldAfter:
+      idle.add(treeCid)
+    else:
+      reads.reads = 0
+
+  for treeCid in idle:
+    self.datasetReads.del(treeCid)
+
+  if demoted > 0 or promoted > 0:
+    info "Tiering pass done", demoted, promoted, cold = self.coldDatasets.len
+
+  success()
@@ -7,11 +7,16 @@
 ## This file may not be copied, modified, or distributed except according to
 ## those terms.
 
+import std/sets
+import std/tables
+
 import pkg/chronos
 import pkg/datastore
 import pkg/datastore/typedds
 import pkg/libp2p/cid
 import pkg/questionable
+import pkg/questionable/results
+import pkg/taskpools
 
 import ../blockstore
 import ../../clock
@@ -23,6 +28,9 @@ import ../../units
 const
   DefaultBlockTtl* = 30.days
   DefaultQuotaBytes* = 20.GiBs
+  MetaVersion* = 1 # version of the metadata layout, see `migrateMetadata`
+  DefaultColdAfter* = 7.days
+  DefaultTieringInterval* = 1.hours
 
 type
   QuotaNotEnoughError* = object of CodexError
@@ -31,12 +39,39 @@ type
     postFixLen*: int
     repoDs*: Datastore
     metaDs*: TypedDatastore
+    unified*: bool # blocks and metadata share `repoDs`
     clock*: Clock
     quotaMaxBytes*: NBytes
     quotaUsage*: QuotaUsage
     totalBlocks*: Natural
     blockTtl*: Duration
     started*: bool
+    manifestIndexReady*: bool # manifests can be listed from the index
+    manifestIndexer*: Future[void].Raising([]) # builds the index of older repos
+    journalEpoch*: uint64 # random, keeps journal keys unique across restarts
+    journalSeq*: uint64 # sequence number of the last journal entry
+    shards*: seq[Datastore] # datastores the block data is striped on
+    compression*: bool # compress the data of compressible blocks
+    taskpool*: Taskpool # compresses large blocks off the event loop, if set
+    capacityDs*: Datastore # capacity tier of cold datasets, nil if not tiered
+    coldAfter*: Duration # datasets unread for this long go to the capacity tier
+    tieringInterval*: Duration
+    coldDatasets*: HashSet[Cid] # tree cids of the datasets on the capacity tier
+    datasetReads*: Table[Cid, DatasetReads]
+      # reads since the last tiering pass, and last read or write
+    tieringStarted*: Moment
+    tiering*: Future[void].Raising([]) # moves datasets between tiers
+    blockReads*: Table[(Cid, bool), Future[?!Block].Raising([CancelledError])]
+      # block reads in flight, by cid and whether read from the capacity tier
+    manifestsStoring*: CountTable[Cid] # manifests indexed, their data on the way
+    blocksWriting*: CountTable[Cid] # blocks of batches, their metadata on the way
+    leavesCounted*: bool # the leaf counts of every tree are exact
+    metadataMigrated*: bool # metadata is at `MetaVersion`, no legacy keys left
+    metadataMigrator*: Future[void].Raising([]) # migrates older metadata
+
+  DatasetReads* = object
+    lastRead*: Moment
+    reads*: Natural
 
   QuotaUsage* {.serialize.} = object
     used*: NBytes
@@ -51,6 +86,21 @@ type
     blkCid*: Cid
     proof*: CodexProof
 
+  LeafBlockCid* = object
+    ## Block cid of a leaf metadata entry, decoded without its proof
+    blkCid*: Cid
+
+  ManifestIndexEntry* {.serialize.} = object
+    treeCid*: Cid
+
+  JournalOp* {.pure.} = enum
+    Store = 0 # block data written before its metadata
+    Delete = 1 # block data deleted before its metadata
+
+  JournalEntry* = object
+    op*: JournalOp
+    cids*: seq[Cid]
+
   BlockExpiration* {.serialize.} = object
     cid*: Cid
     expiry*: SecondsSince1970
@@ -63,6 +113,7 @@ type
   DeleteResult* {.serialize.} = object
     kind*: DeleteResultKind
     released*: NBytes
+    refCount*: Natural # leaves of the deleted block, dropped along with it
 
   StoreResultKind* {.serialize.} = enum
     Stored = 0 # new block stored
@@ -95,15 +146,34 @@ func new*(
     postFixLen = 2,
     quotaMaxBytes = DefaultQuotaBytes,
     blockTtl = DefaultBlockTtl,
+    shards: seq[Datastore] = @[],
+    compression = false,
+    capacityDs: Datastore = nil,
+    coldAfter = DefaultColdAfter,
+    tieringInterval = DefaultTieringInterval,
+    taskpool: Taskpool = nil,
 ): RepoStore =
-  ## Create new instance of a RepoStore
+  ## Create new instance of a RepoStore. Passing the same datastore as
+  ## `repoDs` and `metaDs` keeps blocks and metadata in a single store, their
+  ## keys live in distinct namespaces. Additional `shards` stripe the block
+  ## data across `repoDs` and them, see `sharding`. With `compression`, the
+  ## data of compressible blocks is stored deflated, large blocks on the
+  ## `taskpool` when given. With a `capacityDs`, datasets which
+  ## are not read for `coldAfter` move there from `repoDs`, see `tiering`.
   ##
   RepoStore(
     repoDs: repoDs,
     metaDs: TypedDatastore.init(metaDs),
+    unified: repoDs == metaDs,
     clock: clock,
     postFixLen: postFixLen,
     quotaMaxBytes: quotaMaxBytes,
     blockTtl: blockTtl,
+    shards: @[repoDs] & shards,
+    compression: compression,
+    taskpool: taskpool,
+    capacityDs: capacityDs,
+    coldAfter: coldAfter,
+    tieringInterval: tieringInterval,
     onBlockStored: CidCallback.none,
   )
@@ -0,0 +1,277 @@
+## Logos Storage
+## Copyright (c) 2025 Status Research & Development GmbH
+## Licensed under either of
+##  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+##  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+## at your option.
+## This file may not be copied, modified, or distributed except according to
+## those terms.
+
+## Bookkeeping for resumable, multi-part uploads.
+##
+## An upload session collects the block cids of a dataset whose parts are
+## sent independently (possibly in parallel and out of order). Every part
+## starts at a `blockSize` aligned offset, so each part can be chunked into
+## blocks on its own. The part that ends the dataset has to be flagged as
+## final, and is the only one whose length may not be a multiple of
+## `blockSize`. The merkle tree and manifest are built once the session is
+## finalized.
+##
+## Sessions are kept in memory only, so they do not survive a restart of the
+## node.
+
+{.push raises: [], gcsafe.}
+
+import std/tables
+import std/algorithm
+import std/sequtils
+
+import pkg/chronos
+import pkg/bearssl/rand
+import pkg/libp2p/cid
+import pkg/questionable
+import pkg/questionable/results
+import pkg/stew/byteutils
+
+import ./units
+import ./utils
+import ./errors
+import ./rng
+
+const
+  DefaultUploadSessionTtl* = 24.hours
+  UploadSessionIdLen = 16
+
+type
+  UploadSessionError* = object of CodexError
+  UploadSessionNotFoundError* = object of UploadSessionError
+
+  UploadSession* = ref object
+    id*: string
+    blockSize*: NBytes
+    filename*: ?string
+    mimetype*: ?string
+    blocks*: Table[int, Cid] # block index -> block cid
+    datasetSize*: ?int # known once the final part was received
+    lastActivity*: Moment
+    finalizing*: bool
+
+  UploadSessions* = ref object
+    sessions: Table[string, UploadSession]
+    ttl*: Duration
+
+  BlockRange* = tuple[first: int, last: int] # inclusive range of block indices
+
+proc newUploadSessionError(msg: string): ref UploadSessionError =
+  newException(UploadSessionError, msg)
+
+func blocksCount*(self: UploadSession): int =
+  ## Number of blocks in the dataset, as far as it is known. If the last part
+  ## has not been received yet, this is derived from the highest block seen.
+  ##
+  if size =? self.datasetSize:
+    divUp(size, self.blockSize.int)
+  else:
+    var count = 0
+    for index in self.blocks.keys:
+      count = max(count, index + 1)
+    count
+
+func isComplete*(self: UploadSession): bool =
+  let count = self.blocksCount
+  self.datasetSize.isSome and count > 0 and self.blocks.len == count
+
+proc receivedRanges*(self: UploadSession): seq[BlockRange] =
+  ## Returns the received block indices, compacted into sorted ranges
+  ##
+  var indices = toSeq(self.blocks.keys)
+  indices.sort()
+
+  for index in indices:
+    if result.len > 0 and result[^1].last + 1 == index:
+      result[^1].last = index
+    else:
+      result.add((first: index, last: index))
+
+proc missingRanges*(self: UploadSession): seq[BlockRange] =
+  ## Returns the block indices that are still missing, up to the highest
+  ## known block index
+  ##
+  var next = 0
+  for r in self.receivedRanges:
+    if r.first > next:
+      result.add((first: next, last: r.first - 1))
+    next = r.last + 1
+
+  if (let count = self.blocksCount; next < count):
+    result.add((first: next, last: count - 1))
+
+proc validatePart*(self: UploadSession, offset: int): ?!int =
+  ## Checks that a part can start at `offset` and returns the index of its
+  ## first block
+  ##
+  if self.finalizing:
+    return failure newUploadSessionError("Upload session is being finalized")
+
+  if offset < 0 or offset mod self.blockSize.int != 0:
+    return failure newUploadSessionError(
+      "Part offset " & $offset & " is not aligned to the block size " &
+        $self.blockSize.int
+    )
+
+  if size =? self.datasetSize and offset >= size:
+    return failure newUploadSessionError(
+      "Part offset " & $offset & " is past the end of the dataset (" & $size & ")"
+    )
+
+  success offset div self.blockSize.int
+
+proc addBlock*(self: UploadSession, index: int, cid: Cid) =
+  self.blocks[index] = cid
+  self.lastActivity = Moment.now()
+
+proc completePart*(
+    self: UploadSession, offset: int, length: int, final = false
+): ?!void =
+  ## Records the end of a part. The final part sets the end of the dataset,
+  ## and is the only one which may be shorter than a multiple of the block
+  ## size.
+  ##
+  self.lastActivity = Moment.now()
+
+  if length <= 0:
+    return failure newUploadSessionError("Part at offset " & $offset & " is empty")
+
+  let partEnd = offset + length
+  if final:
+    if size =? self.datasetSize and size != partEnd:
+      return failure newUploadSessionError(
+        "Dataset end already set to " & $size & ", part ends at " & $partEnd
+      )
+
+    let count = divUp(partEnd, self.blockSize.int)
+    for index in self.blocks.keys:
+      if index >= count:
+        return failure newUploadSessionError(
+          "Block " & $index & " was received past the end of the dataset (" & $partEnd &
+            ")"
+        )
+
+    self.datasetSize = partEnd.some
+  elif length mod self.blockSize.int != 0:
+    return failure newUploadSessionError(
+      "Part at offset " & $offset & " is not a multiple of the block size " &
+        $self.blockSize.int & " and is not flagged as final"
+    )
+  elif size =? self.datasetSize and partEnd > size:
+    return failure newUploadSessionError(
+      "Part ends at " & $partEnd & ", past the end of the dataset (" & $size & ")"
+    )
+
+  success()
+
+proc addPart*(
+    self: UploadSession, offset: int, length: int, cids: seq[Cid], final = false
+): ?!void =
+  ## Records a stored part, adding its blocks only once the part is known to
+  ## fit the dataset, so that a rejected part leaves the session untouched.
+  ## Parts still in flight when the session started finalizing are rejected.
+  ##
+  if self.finalizing:
+    return failure newUploadSessionError("Upload session is being finalized")
+
+  if err =? self.completePart(offset, length, final).errorOption:
+    return failure err
+
+  let firstIndex = offset div self.blockSize.int
+  for i, cid in cids:
+    self.addBlock(firstIndex + i, cid)
+
+  success()
+
+func withinDataset*(self: UploadSession, index: int): bool =
+  ## Whether block `index` can be part of the dataset, as far as its end is
+  ## known
+  ##
+  without size =? self.datasetSize:
+    return true
+
+  index < divUp(size, self.blockSize.int)
+
+func finalSize*(self: UploadSession): int =
+  ## Size of the dataset, once complete
+  ##
+  self.datasetSize |? (self.blocksCount * self.blockSize.int)
+
+proc orderedCids*(self: UploadSession): ?!seq[Cid] =
+  ## Returns the block cids in dataset order, failing if any is missing
+  ##
+  if self.datasetSize.isNone:
+    return failure newUploadSessionError("Upload is incomplete, final part is missing")
+
+  if not self.isComplete:
+    let missing = self.missingRanges
+    return failure newUploadSessionError(
+      "Upload is incomplete, missing blocks: " & $missing
+    )
+
+  var cids = newSeqOfCap[Cid](self.blocks.len)
+  for index in 0 ..< self.blocksCount:
+    cids.add(self.blocks[index])
+
+  success cids
+
+proc new*(T: type UploadSessions, ttl = DefaultUploadSessionTtl): UploadSessions =
+  UploadSessions(ttl: ttl)
+
+proc prune*(self: UploadSessions) =
+  ## Drops sessions that have been idle for longer than `ttl`. Blocks stored
+  ## by an abandoned session are not referenced by any dataset, so they are
+  ## garbage collected once their expiry passes.
+  ##
+  let now = Moment.now()
+  var expired: seq[string]
+  for id, session in self.sessions:
+    if not session.finalizing and session.lastActivity + self.ttl < now:
+      expired.add(id)
+
+  for id in expired:
+    self.sessions.del(id)
+
+proc create*(
+    self: UploadSessions,
+    blockSize: NBytes,
+    filename: ?string = string.none,
+    mimetype: ?string = string.none,
+): UploadSession =
+  self.prune()
+
+  var id: string
+  while true:
+    var bytes = newSeq[byte](UploadSessionIdLen)
+    Rng.instance()[].generate(bytes)
+    id = byteutils.toHex(bytes)
+    if id notin self.sessions:
+      break
+
+  let session = UploadSession(
+    id: id,
+    blockSize: blockSize,
+    filename: filename,
+    mimetype: mimetype,
+    lastActivity: Moment.now(),
+  )
+  self.sessions[id] = session
+  session
+
+proc get*(self: UploadSessions, id: string): ?UploadSession =
+  self.sessions.withValue(id, session):
+    return session[].some
+
+  UploadSession.none
+
+proc remove*(self: UploadSessions, id: string) =
+  self.sessions.del(id)
+
+func len*(self: UploadSessions): int =
+  self.sessions.len
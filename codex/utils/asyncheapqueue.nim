@@ -7,11 +7,18 @@
 ## This file may not be copied, modified, or distributed except according to
 ## those terms.
 
+import std/hashes
 import std/sequtils
+import std/tables
 import pkg/chronos
 import pkg/results
 
 # Based on chronos AsyncHeapQueue and std/heapqueue
+#
+# The position of every item is indexed, so that finding, updating and
+# deleting an item doesn't scan the heap. Items are told apart with `==`
+# and `hash`, which must agree: items equal to one another are the same
+# entry, and updating one re-sifts it from where it is.
 
 type
   QueueType* {.pure.} = enum
@@ -29,6 +36,7 @@ type
     getters: seq[Future[void]]
     putters: seq[Future[void]]
     queue: seq[T]
+    positions: Table[T, int] # index of every item in `queue`
     maxsize: int
 
   AsyncHQErrors* {.pure.} = enum
@@ -45,6 +53,7 @@ proc newAsyncHeapQueue*[T](
     getters: newSeq[Future[void]](),
     putters: newSeq[Future[void]](),
     queue: newSeqOfCap[T](maxsize),
+    positions: initTable[T, int](),
     maxsize: maxsize,
     queueType: queueType,
   )
@@ -68,6 +77,10 @@ proc heapCmp[T](x, y: T, max: bool = false): bool {.inline.} =
   else:
     return (x < y)
 
+proc place[T](heap: AsyncHeapQueue[T], pos: int, item: T) {.inline.} =
+  heap.queue[pos] = item
+  heap.positions[item] = pos
+
 proc siftdown[T](heap: AsyncHeapQueue[T], startpos, p: int) =
   ## 'heap' is a heap at all indices >= startpos, except
   ## possibly for pos.  pos is the index of a leaf with a
@@ -82,11 +95,11 @@ proc siftdown[T](heap: AsyncHeapQueue[T], startpos, p: int) =
     let parentpos = (pos - 1) shr 1
     let parent = heap[parentpos]
     if heapCmp(newitem, parent, heap.queueType == QueueType.Max):
-      heap.queue[pos] = parent
+      heap.place(pos, parent)
       pos = parentpos
     else:
       break
-  heap.queue[pos] = newitem
+  heap.place(pos, newitem)
 
 proc siftup[T](heap: AsyncHeapQueue[T], p: int) =
   let endpos = len(heap)
@@ -102,14 +115,25 @@ proc siftup[T](heap: AsyncHeapQueue[T], p: int) =
         not heapCmp(heap[childpos], heap[rightpos], heap.queueType == QueueType.Max):
       childpos = rightpos
     # Move the smaller child up.
-    heap.queue[pos] = heap[childpos]
+    heap.place(pos, heap[childpos])
     pos = childpos
     childpos = 2 * pos + 1
   # The leaf at pos is empty now.  Put newitem there, and bubble it up
   # to its final resting place (by sifting its parents down).
-  heap.queue[pos] = newitem
+  heap.place(pos, newitem)
   siftdown(heap, startpos, pos)
 
+proc resift[T](heap: AsyncHeapQueue[T], pos: int) =
+  ## Restores the heap invariant after the item at `pos` changed, moving it
+  ## towards the root or the leaves as needed, in O(log n)
+  ##
+
+  if pos > 0 and
+      heapCmp(heap[pos], heap[(pos - 1) shr 1], heap.queueType == QueueType.Max):
+    siftdown(heap, 0, pos)
+  else:
+    siftup(heap, pos)
+
 proc full*[T](heap: AsyncHeapQueue[T]): bool {.inline.} =
   ## Return ``true`` if there are ``maxsize`` items in the queue.
   ##
@@ -124,14 +148,36 @@ proc empty*[T](heap: AsyncHeapQueue[T]): bool {.inline.} =
   ## Return ``true`` if the queue is empty, ``false`` otherwise.
   (len(heap.queue) == 0)
 
+proc find*[T](heap: AsyncHeapQueue[T], item: T): int =
+  ## Position of `item` in `heap`, or -1 if it isn't there
+  ##
+  heap.positions.getOrDefault(item, -1)
+
+proc update*[T](heap: AsyncHeapQueue[T], item: T): bool =
+  ## Update an entry in the heap by reshufling its
+  ## possition, maintaining the heap invariant.
+  ##
+
+  let index = heap.find(item)
+  if index > -1:
+    # replace item with new one in case it's a copy
+    heap.place(index, item)
+    heap.resift(index)
+    return true
+
 proc pushNoWait*[T](heap: AsyncHeapQueue[T], item: T): Result[void, AsyncHQErrors] =
-  ## Push `item` onto heap, maintaining the heap invariant.
+  ## Push `item` onto heap, maintaining the heap invariant. An item equal
+  ## to `item` already in the heap is updated instead.
   ##
 
+  if heap.update(item):
+    return ok()
+
   if heap.full():
     return err(AsyncHQErrors.Full)
 
   heap.queue.add(item)
+  heap.positions[item] = len(heap) - 1
   siftdown(heap, 0, len(heap) - 1)
   heap.getters.wakeupNext()
 
@@ -165,10 +211,12 @@ proc popNoWait*[T](heap: AsyncHeapQueue[T]): Result[T, AsyncHQErrors] =
   let lastelt = heap.queue.pop()
   if heap.len > 0:
     result = ok(heap[0])
-    heap.queue[0] = lastelt
+    heap.positions.del(heap[0])
+    heap.place(0, lastelt)
     siftup(heap, 0)
   else:
     result = ok(lastelt)
+    heap.positions.del(lastelt)
 
   heap.putters.wakeupNext()
 
@@ -195,11 +243,11 @@ proc del*[T](heap: AsyncHeapQueue[T], index: Natural) =
   if heap.empty():
     return
 
-  swap(heap.queue[^1], heap.queue[index])
-  let newLen = heap.len - 1
-  heap.queue.setLen(newLen)
-  if index < newLen:
-    heap.siftup(index)
+  heap.positions.del(heap[index])
+  let lastelt = heap.queue.pop()
+  if index < heap.len:
+    heap.place(index, lastelt)
+    heap.resift(index)
 
   heap.putters.wakeupNext()
 
@@ -211,21 +259,6 @@ proc delete*[T](heap: AsyncHeapQueue[T], item: T) =
   if index > -1:
     heap.del(index)
 
-proc update*[T](heap: AsyncHeapQueue[T], item: T): bool =
-  ## Update an entry in the heap by reshufling its
-  ## possition, maintaining the heap invariant.
-  ##
-
-  let index = heap.find(item)
-  if index > -1:
-    # replace item with new one in case it's a copy
-    heap.queue[index] = item
-    # re-establish heap order
-    # TODO: don't start at 0 to avoid reshuffling
-    # entire heap
-    heap.siftup(0)
-    return true
-
 proc pushOrUpdateNoWait*[T](
     heap: AsyncHeapQueue[T], item: T
 ): Result[void, AsyncHQErrors] =
@@ -258,10 +291,11 @@ proc replace*[T](heap: AsyncHeapQueue[T], item: T): Result[T, AsyncHQErrors] =
   ##
 
   if heap.empty():
-    error(AsyncHQErrors.Empty)
+    return err(AsyncHQErrors.Empty)
 
-  result = heap[0]
-  heap.queue[0] = item
+  result = ok(heap[0])
+  heap.positions.del(heap[0])
+  heap.place(0, item)
   siftup(heap, 0)
 
 proc pushPopNoWait*[T](heap: AsyncHeapQueue[T], item: T): Result[T, AsyncHQErrors] =
@@ -269,16 +303,20 @@ proc pushPopNoWait*[T](heap: AsyncHeapQueue[T], item: T): Result[T, AsyncHQError
   ##
 
   if heap.empty():
-    err(AsyncHQErrors.Empty)
+    return err(AsyncHQErrors.Empty)
 
-  if heap.len > 0 and heapCmp(heap[0], item, heap.queueType == QueueType.Max):
-    swap(item, heap[0])
+  if heapCmp(heap[0], item, heap.queueType == QueueType.Max):
+    result = ok(heap[0])
+    heap.positions.del(heap[0])
+    heap.place(0, item)
     siftup(heap, 0)
-  return item
+  else:
+    result = ok(item)
 
 proc clear*[T](heap: AsyncHeapQueue[T]) {.inline.} =
   ## Clears all elements of queue ``heap``.
   heap.queue.setLen(0)
+  heap.positions.clear()
 
 proc len*[T](heap: AsyncHeapQueue[T]): int {.inline.} =
   ## Return the number of elements in ``heap``.
@@ -316,10 +354,7 @@ iterator pairs*[T](heap: AsyncHeapQueue[T]): tuple[key: int, val: T] {.inline.}
 proc contains*[T](heap: AsyncHeapQueue[T], item: T): bool {.inline.} =
   ## Return true if ``item`` is in ``heap`` or false if not found. Usually used
   ## via the ``in`` operator.
-  for e in heap.queue.items():
-    if e == item:
-      return true
-  return false
+  item in heap.positions
 
 proc `$`*[T](heap: AsyncHeapQueue[T]): string =
   ## Turn an async queue ``heap`` into its string representation.
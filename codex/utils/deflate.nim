@@ -0,0 +1,424 @@
+## Logos Storage
+## Copyright (c) 2025 Status Research & Development GmbH
+## Licensed under either of
+##  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+##  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+## at your option.
+## This file may not be copied, modified, or distributed except according to
+## those terms.
+
+## Deflate compression of block data, shared by the repo store (blocks at
+## rest) and the block exchange (blocks on the wire). It trades ratio for
+## speed, and gives up early on data which wouldn't shrink much.
+##
+## Streams are walked before being inflated, to find the size they inflate
+## to without writing it out (see `inflatedSize`, after `puff` from zlib),
+## so that one claiming a small size can't make us allocate more.
+
+{.push raises: [], gcsafe.}
+
+import std/math
+
+import pkg/chronos
+import pkg/chronos/threadsync
+import pkg/questionable
+import pkg/questionable/results
+import pkg/taskpools
+import pkg/zippy
+
+import ./sharedbuf
+
+const
+  MinDeflateSize* = 1024 # smaller data is not worth compressing
+  MaxDeflateRatio* = 1032 # most deflate can expand, bounds inflated sizes
+  EntropySampleSize = 4096 # bytes looked at to estimate the entropy
+  MaxEntropy = 7.2 # bits per byte, above which data is not compressed
+  MinGainDivisor = 8 # compression must save at least 1/8 of the size
+  MaxCodeBits = 15 # longest huffman code of a deflate stream
+  MaxLengthCodes = 286
+  MaxDistanceCodes = 30
+  FixedLengthCodes = 288
+  LengthBase = [
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83,
+    99, 115, 131, 163, 195, 227, 258,
+  ]
+  LengthExtra = [
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5,
+    0,
+  ]
+  DistanceBase = [
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+  ]
+  DistanceExtra = [
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+    12, 12, 13, 13,
+  ]
+  CodeLengthOrder = [16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15]
+
+type
+  BitReader = object
+    pos: int # next byte to load
+    bits: uint32 # loaded bits, not read yet
+    count: int # number of loaded bits
+
+  Huffman = object
+    counts: array[MaxCodeBits + 1, int] # number of codes of each length
+    symbols: array[FixedLengthCodes, int] # symbols ordered by code
+
+func entropy(data: openArray[byte]): float =
+  ## Shannon entropy of the leading bytes of `data`, in bits per byte
+  ##
+  let sample = min(data.len, EntropySampleSize)
+  if sample == 0:
+    return 0.0
+
+  var counts: array[256, int]
+  for i in 0 ..< sample:
+    inc counts[data[i]]
+
+  for count in counts:
+    if count > 0:
+      let p = count / sample
+      result -= p * log2(p)
+
+func isCompressible*(data: openArray[byte]): bool =
+  ## Quick check, without compressing, of whether `data` is worth compressing
+  ##
+  data.len >= MinDeflateSize and data.entropy <= MaxEntropy
+
+proc deflate*(data: seq[byte], overhead = 0): ?seq[byte] =
+  ## Deflates `data`, if it is compressible and the result, plus `overhead`
+  ## bytes of framing, saves at least 1/8 of its size
+  ##
+
+  if not data.isCompressible:
+    return seq[byte].none
+
+  let deflated =
+    try:
+      compress(data, BestSpeed, dfDeflate)
+    except ZippyError:
+      return seq[byte].none
+
+  if overhead + deflated.len > data.len - data.len div MinGainDivisor:
+    return seq[byte].none
+
+  deflated.some
+
+proc deflateWorker(
+    data: SharedBuf[byte], output: SharedBuf[byte], overhead: int, signal: ThreadSignalPtr
+): int =
+  ## Deflates `data` into `output`, as large as `data`, returning the length
+  ## of the deflated data, or -1 if it was not worth compressing
+  ##
+
+  defer:
+    discard signal.fireSync()
+
+  without deflated =? (@(data.toOpenArray())).deflate(overhead):
+    return -1
+
+  # deflate only returns data smaller than its input
+  copyMem(output.payload[0].addr, deflated[0].unsafeAddr, deflated.len)
+  deflated.len
+
+proc deflate*(
+    tp: Taskpool, data: seq[byte], overhead = 0
+): Future[?seq[byte]] {.async: (raises: [CancelledError]).} =
+  ## Same as `deflate`, run on the taskpool so that large blocks don't hold
+  ## up the event loop
+  ##
+
+  if not data.isCompressible:
+    return seq[byte].none
+
+  if tp.numThreads == 1:
+    # With a single thread, there's no point creating a separate task
+    return data.deflate(overhead)
+
+  without signal =? ThreadSignalPtr.new():
+    return data.deflate(overhead)
+
+  defer:
+    signal.close().expect("closing once works")
+
+  var output = newSeq[byte](data.len)
+  let res = tp.spawn deflateWorker(
+    SharedBuf.view(data), SharedBuf.view(output), overhead, signal
+  )
+
+  # The task can't be stopped early, and uses our buffers until it is done,
+  # so block cancellation attempts
+  try:
+    await noCancel signal.wait()
+  except AsyncError as exc:
+    raiseAssert "Could not wait for signal, was it initialized? " & exc.msg
+
+  let deflatedLen = res.sync()
+  if deflatedLen < 0:
+    return seq[byte].none
+
+  output.setLen(deflatedLen)
+  output.some
+
+func readBits(
+    r: var BitReader, data: openArray[byte], n: int, value: var int
+): bool =
+  ## Reads `n` bits, least significant first, loading bytes only as needed
+  ##
+  while r.count < n:
+    if r.pos >= data.len:
+      return false
+    r.bits = r.bits or (data[r.pos].uint32 shl r.count)
+    inc r.pos
+    r.count += 8
+
+  value = int(r.bits and ((1'u32 shl n) - 1))
+  r.bits = r.bits shr n
+  r.count -= n
+  true
+
+func init(h: var Huffman, lengths: openArray[int]): int =
+  ## Builds the canonical code of symbols of `lengths`. Returns 0 for a
+  ## complete code, more for an incomplete one, less for an oversubscribed one.
+  ##
+  h.counts = default(array[MaxCodeBits + 1, int])
+  for length in lengths:
+    inc h.counts[length]
+
+  if h.counts[0] == lengths.len:
+    return 0 # no codes, complete but only decodes nothing
+
+  var left = 1
+  for length in 1 .. MaxCodeBits:
+    left = (left shl 1) - h.counts[length]
+    if left < 0:
+      return left
+
+  var offsets: array[MaxCodeBits + 1, int]
+  for length in 1 ..< MaxCodeBits:
+    offsets[length + 1] = offsets[length] + h.counts[length]
+
+  for symbol, length in lengths:
+    if length != 0:
+      h.symbols[offsets[length]] = symbol
+      inc offsets[length]
+
+  left
+
+func decodeSymbol(
+    r: var BitReader, data: openArray[byte], h: Huffman, symbol: var int
+): bool =
+  var code, first, index = 0
+  for length in 1 .. MaxCodeBits:
+    var bit: int
+    if not r.readBits(data, 1, bit):
+      return false
+
+    code = code or bit
+    let count = h.counts[length]
+    if code - count < first:
+      symbol = h.symbols[index + (code - first)]
+      return true
+
+    index += count
+    first = (first + count) shl 1
+    code = code shl 1
+
+  false # not a code of `h`
+
+func readCodes(
+    r: var BitReader, data: openArray[byte], lencode, distcode: var Huffman
+): bool =
+  ## Reads the codes of a block compressed with dynamic codes
+  ##
+  var nlen, ndist, ncode: int
+  if not r.readBits(data, 5, nlen) or not r.readBits(data, 5, ndist) or
+      not r.readBits(data, 4, ncode):
+    return false
+
+  nlen += 257
+  ndist += 1
+  ncode += 4
+  if nlen > MaxLengthCodes or ndist > MaxDistanceCodes:
+    return false
+
+  var lengths: array[MaxLengthCodes + MaxDistanceCodes, int]
+  for i in 0 ..< ncode:
+    if not r.readBits(data, 3, lengths[CodeLengthOrder[i]]):
+      return false
+
+  var lencodes: Huffman
+  if lencodes.init(lengths.toOpenArray(0, CodeLengthOrder.len - 1)) != 0:
+    return false
+
+  var index = 0
+  while index < nlen + ndist:
+    var symbol: int
+    if not r.decodeSymbol(data, lencodes, symbol):
+      return false
+
+    if symbol < 16:
+      lengths[index] = symbol
+      inc index
+      continue
+
+    var length, repeat: int
+    if symbol == 16:
+      if index == 0 or not r.readBits(data, 2, repeat):
+        return false
+      length = lengths[index - 1]
+      repeat += 3
+    elif symbol == 17:
+      if not r.readBits(data, 3, repeat):
+        return false
+      repeat += 3
+    else:
+      if not r.readBits(data, 7, repeat):
+        return false
+      repeat += 11
+
+    if index + repeat > nlen + ndist:
+      return false
+
+    for _ in 0 ..< repeat:
+      lengths[index] = length
+      inc index
+
+  if lengths[256] == 0:
+    return false # no end of block code
+
+  # incomplete codes are only allowed for a single code
+  let lenLeft = lencode.init(lengths.toOpenArray(0, nlen - 1))
+  if lenLeft < 0 or (lenLeft > 0 and nlen - lencode.counts[0] != 1):
+    return false
+
+  let distLeft = distcode.init(lengths.toOpenArray(nlen, nlen + ndist - 1))
+  if distLeft < 0 or (distLeft > 0 and ndist - distcode.counts[0] != 1):
+    return false
+
+  true
+
+func fixedCodes(lencode, distcode: var Huffman) =
+  var lengths: array[FixedLengthCodes, int]
+  for symbol in 0 ..< FixedLengthCodes:
+    lengths[symbol] =
+      if symbol < 144:
+        8
+      elif symbol < 256:
+        9
+      elif symbol < 280:
+        7
+      else:
+        8
+  discard lencode.init(lengths)
+
+  for symbol in 0 ..< MaxDistanceCodes:
+    lengths[symbol] = 5
+  discard distcode.init(lengths.toOpenArray(0, MaxDistanceCodes - 1))
+
+func codesSize(
+    r: var BitReader,
+    data: openArray[byte],
+    lencode, distcode: Huffman,
+    size: var int,
+    limit: int,
+): bool =
+  ## Adds the size of a block compressed with codes to `size`, giving up
+  ## once it is over `limit`
+  ##
+  while size <= limit:
+    var symbol: int
+    if not r.decodeSymbol(data, lencode, symbol):
+      return false
+
+    if symbol < 256:
+      inc size
+    elif symbol == 256:
+      return true
+    else:
+      let index = symbol - 257
+      if index >= LengthBase.len:
+        return false
+
+      var extra, distSymbol, distExtra: int
+      if not r.readBits(data, LengthExtra[index], extra) or
+          not r.decodeSymbol(data, distcode, distSymbol) or
+          distSymbol >= DistanceBase.len or
+          not r.readBits(data, DistanceExtra[distSymbol], distExtra):
+        return false
+
+      if DistanceBase[distSymbol] + distExtra > size:
+        return false # refers to data before the start of the stream
+
+      size += LengthBase[index] + extra
+
+  false
+
+func inflatedSize*(data: openArray[byte], limit: int): ?int =
+  ## Number of bytes the deflate stream `data` inflates to, found without
+  ## inflating it. None if the stream is malformed, or inflates to more than
+  ## `limit` bytes, in which case the walk stops there.
+  ##
+  var
+    r: BitReader
+    size = 0
+    last = 0
+
+  while last == 0:
+    var kind: int
+    if not r.readBits(data, 1, last) or not r.readBits(data, 2, kind):
+      return int.none
+
+    case kind
+    of 0:
+      # stored block, starting at the next byte
+      r.bits = 0
+      r.count = 0
+      if r.pos + 4 > data.len:
+        return int.none
+
+      let
+        length = data[r.pos].int or (data[r.pos + 1].int shl 8)
+        nlength = data[r.pos + 2].int or (data[r.pos + 3].int shl 8)
+      if length != (not nlength and 0xffff) or r.pos + 4 + length > data.len:
+        return int.none
+
+      r.pos += 4 + length
+      size += length
+    of 1, 2:
+      var lencode, distcode: Huffman
+      if kind == 1:
+        fixedCodes(lencode, distcode)
+      elif not r.readCodes(data, lencode, distcode):
+        return int.none
+
+      if not r.codesSize(data, lencode, distcode, size, limit):
+        return int.none
+    else:
+      return int.none
+
+    if size > limit:
+      return int.none
+
+  size.some
+
+proc inflate*(data: seq[byte], size: int): ?!seq[byte] =
+  ## Inflates `data`, which must hold exactly `size` bytes once inflated. The
+  ## stream is walked first, so that it is never inflated past `size` bytes.
+  ##
+
+  if data.inflatedSize(size) != size.some:
+    return failure("Inflated data size mismatch")
+
+  let inflated =
+    try:
+      uncompress(data, dfDeflate)
+    except ZippyError as err:
+      return failure(err.msg)
+
+  if inflated.len != size:
+    return failure("Inflated data size mismatch")
+
+  success inflated
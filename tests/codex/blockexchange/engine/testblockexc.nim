@@ -73,7 +73,7 @@ asyncchecksuite "NetworkStore engine - 2 nodes":
 
     (await nodeCmps2.localStore.putBlock(blk)).tryGet()
 
-    peerCtx1.wantedBlocks.incl(blk.address)
+    peerCtx1.blockWanted(blk.address)
     check nodeCmps2.engine.taskQueue.pushOrUpdateNoWait(peerCtx1).isOk
 
     check eventually (await nodeCmps1.localStore.hasBlock(blk.cid)).tryGet()
@@ -1,6 +1,7 @@
 import std/sequtils
 import std/random
 import std/algorithm
+import std/sets
 
 import pkg/stew/byteutils
 import pkg/chronos
@@ -206,6 +207,115 @@ asyncchecksuite "NetworkStore engine handlers":
 
     await done
 
+  test "Should turn wants down as busy when too many peers wait":
+    var sent: seq[BlockPresence]
+    proc sendPresence(
+        peerId: PeerId, presence: seq[BlockPresence]
+    ) {.async: (raises: [CancelledError]).} =
+      sent.add(presence)
+
+    engine.network =
+      BlockExcNetwork(request: BlockExcRequest(sendPresence: sendPresence))
+
+    while not engine.taskQueue.full:
+      check engine.taskQueue.pushNoWait(BlockExcPeerCtx(id: PeerId.example)).isOk
+
+    var wantList = makeWantList(blocks.mapIt(it.cid), wantType = WantType.WantBlock)
+    wantList.busy = true
+    await engine.wantListHandler(peerId, wantList)
+
+    check sent.mapIt(it.address) == wantList.entries.mapIt(it.address)
+    check sent.allIt(it.`type` == BlockPresenceType.Busy and it.retryAfter > 0)
+    check peerCtx.wantedBlocks.len == 0
+
+  test "Should keep the wants of peers not taking busy presences":
+    var sent: seq[BlockPresence]
+    proc sendPresence(
+        peerId: PeerId, presence: seq[BlockPresence]
+    ) {.async: (raises: [CancelledError]).} =
+      sent.add(presence)
+
+    engine.network =
+      BlockExcNetwork(request: BlockExcRequest(sendPresence: sendPresence))
+
+    while not engine.taskQueue.full:
+      check engine.taskQueue.pushNoWait(BlockExcPeerCtx(id: PeerId.example)).isOk
+
+    let wantList = makeWantList(blocks.mapIt(it.cid), wantType = WantType.WantBlock)
+    await engine.wantListHandler(peerId, wantList)
+
+    check sent.len == 0
+    check peerCtx.wantedBlocks == wantList.entries.mapIt(it.address).toHashSet
+    check peerCtx notin engine.taskQueue
+
+  test "Should reroute block requests turned down as busy":
+    let
+      address = blocks[0].address
+      handle = engine.pendingBlocks.getWantHandle(address)
+      rerouted = engine.pendingBlocks.rerouted(address)
+
+    check engine.pendingBlocks.markRequested(address, peerId)
+    peerCtx.blockRequestScheduled(address)
+
+    await engine.blockPresenceHandler(
+      peerId,
+      @[
+        BlockPresence(
+          address: address, `type`: BlockPresenceType.Busy, retryAfter: 1000
+        )
+      ],
+    )
+
+    check rerouted.finished
+    check not engine.pendingBlocks.isRequested(address)
+    check address notin peerCtx.blocksRequested
+    check address notin peerCtx.blocks # says nothing about what the peer has
+    check peerCtx.isBusy
+    check not handle.finished
+
+  test "Should answer want-blocks for missing blocks with dont-have":
+    var sent: seq[BlockPresence]
+    proc sendPresence(
+        peerId: PeerId, presence: seq[BlockPresence]
+    ) {.async: (raises: [CancelledError]).} =
+      sent.add(presence)
+
+    engine.network =
+      BlockExcNetwork(request: BlockExcRequest(sendPresence: sendPresence))
+
+    (await engine.localStore.putBlock(blocks[0])).tryGet()
+    let wantList = makeWantList(
+      blocks.mapIt(it.cid), wantType = WantType.WantBlock, sendDontHave = true
+    )
+    await engine.wantListHandler(peerId, wantList)
+
+    check sent.mapIt(it.address) == blocks[1 ..^ 1].mapIt(it.address)
+    check sent.allIt(it.`type` == BlockPresenceType.DontHave)
+    check peerCtx.wantedBlocks == [blocks[0].address].toHashSet
+
+  test "Should reroute block requests the peer doesn't have":
+    let
+      address = BlockAddress.init(Cid.example, 1)
+      handle = engine.pendingBlocks.getWantHandle(address)
+      rerouted = engine.pendingBlocks.rerouted(address)
+
+    peerCtx.setPresence(
+      Presence(address: BlockAddress.init(address.treeCid, 0), have: true)
+    )
+    check engine.pendingBlocks.markRequested(address, peerId)
+    peerCtx.blockRequestScheduled(address)
+
+    await engine.blockPresenceHandler(
+      peerId, @[BlockPresence(address: address, `type`: BlockPresenceType.DontHave)]
+    )
+
+    check rerouted.finished
+    check not engine.pendingBlocks.isRequested(address)
+    check address notin peerCtx.blocksRequested
+    check address notin peerCtx
+    check not peerCtx.likelyHas(address)
+    check not handle.finished
+
   test "Should store blocks in local store":
     let pending = blocks.mapIt(engine.pendingBlocks.getWantHandle(it.cid))
 
@@ -226,6 +336,30 @@ asyncchecksuite "NetworkStore engine handlers":
       let present = await engine.localStore.hasBlock(b.cid)
       check present.tryGet()
 
+  test "Should grant credit back as blocks come in":
+    var granted: seq[uint]
+    proc sendCredit(id: PeerId, bytes: uint) {.async: (raises: [CancelledError]).} =
+      granted.add(bytes)
+
+    engine.network = BlockExcNetwork(
+      request: BlockExcRequest(
+        sendWantCancellations: NopSendWantCancellationsProc, sendCredit: sendCredit
+      )
+    )
+
+    discard engine.pendingBlocks.getWantHandle(blocks[0].cid)
+    for blk in blocks[0 .. 1]:
+      peerCtx.blockRequestScheduled(blk.address)
+    peerCtx.recvCredit = 512
+
+    await engine.blocksDeliveryHandler(
+      peerId, @[BlockDelivery(blk: blocks[0], address: blocks[0].address)]
+    )
+
+    let window = DefaultReceiveWindow.int64
+    check granted == @[(window - 256).uint]
+    check peerCtx.recvCredit == window
+
   test "Should handle block presence":
     var handles:
       Table[Cid, Future[Block].Raising([CancelledError, RetriesExhaustedError])]
@@ -427,6 +561,82 @@ asyncchecksuite "Block Download":
 
     discard await blockHandle.wait(5.seconds)
 
+  test "Should ask peers with other blocks of the dataset for a block directly":
+    let
+      treeCid = Cid.example
+      address = BlockAddress.init(treeCid, 1)
+      wanted = newFuture[void]("wanted")
+
+    peerCtx.activityTimeout = 60.seconds
+    peerCtx.answersDontHave = true
+    peerCtx.setPresence(Presence(address: BlockAddress.init(treeCid, 0), have: true))
+
+    proc sendWantList(
+        id: PeerId,
+        addresses: seq[BlockAddress],
+        priority: int32 = 0,
+        cancel: bool = false,
+        wantType: WantType = WantType.WantHave,
+        full: bool = false,
+        sendDontHave: bool = false,
+    ) {.async: (raises: [CancelledError]).} =
+      if wantType == WantType.WantBlock and not wanted.finished:
+        check id == peerId
+        check addresses == @[address]
+        check sendDontHave
+        wanted.complete()
+
+    engine.network = BlockExcNetwork(
+      request: BlockExcRequest(
+        sendWantList: sendWantList, sendWantCancellations: NopSendWantCancellationsProc
+      )
+    )
+
+    let pending = engine.requestBlock(address)
+    await wanted.wait(5.seconds)
+
+    pending.cancel()
+    expect CancelledError:
+      discard (await pending).tryGet()
+
+  test "Should not ask legacy peers for a block directly":
+    let
+      treeCid = Cid.example
+      address = BlockAddress.init(treeCid, 1)
+
+    peerCtx.activityTimeout = 60.seconds
+    peerCtx.setPresence(Presence(address: BlockAddress.init(treeCid, 0), have: true))
+    check peerCtx.likelyHas(address)
+    check not peerCtx.answersDontHave
+
+    var wantedBlocks: seq[BlockAddress]
+    proc sendWantList(
+        id: PeerId,
+        addresses: seq[BlockAddress],
+        priority: int32 = 0,
+        cancel: bool = false,
+        wantType: WantType = WantType.WantHave,
+        full: bool = false,
+        sendDontHave: bool = false,
+    ) {.async: (raises: [CancelledError]).} =
+      if wantType == WantType.WantBlock:
+        wantedBlocks.add(addresses)
+
+    engine.network = BlockExcNetwork(
+      request: BlockExcRequest(
+        sendWantList: sendWantList, sendWantCancellations: NopSendWantCancellationsProc
+      )
+    )
+
+    let pending = engine.requestBlock(address)
+    await sleepAsync(100.millis)
+    check wantedBlocks.len == 0
+    check not engine.pendingBlocks.isRequested(address)
+
+    pending.cancel()
+    expect CancelledError:
+      discard (await pending).tryGet()
+
   test "Should cancel block request":
     var
       address = BlockAddress.init(blocks[0].cid)
@@ -559,12 +769,81 @@ asyncchecksuite "Task Handler":
       (await engine.localStore.putBlock(blk)).tryGet()
     engine.network.request.sendBlocksDelivery = sendBlocksDelivery
 
-    peersCtx[0].wantedBlocks.incl(blocks[0].address)
+    peersCtx[0].blockWanted(blocks[0].address)
+
+    await engine.taskHandler(peersCtx[0])
+
+  test "Should send blocks within the credit granted by the peer":
+    var sent: seq[BlockAddress]
+    proc sendBlocksDelivery(
+        id: PeerId, blocksDelivery: seq[BlockDelivery]
+    ) {.async: (raises: [CancelledError]).} =
+      sent.add(blocksDelivery.mapIt(it.address))
+
+    for blk in blocks:
+      (await engine.localStore.putBlock(blk)).tryGet()
+      peersCtx[0].blockWanted(blk.address)
+    engine.network.request.sendBlocksDelivery = sendBlocksDelivery
+
+    # the second block takes the credit below zero
+    await engine.creditHandler(peers[0], 300)
+    await engine.taskHandler(peersCtx[0])
+    check sent.len == 2
+    check peersCtx[0].outOfCredit
+    check peersCtx[0].wantedBlocks.len == blocks.len - 2
+
+    await engine.creditHandler(peers[0], 1024)
+    await engine.taskHandler(peersCtx[0])
+    check sent.len == blocks.len
+    check peersCtx[0].wantedBlocks.len == 0
+
+  test "Should not limit peers which grant no credit":
+    var sent: seq[BlockAddress]
+    proc sendBlocksDelivery(
+        id: PeerId, blocksDelivery: seq[BlockDelivery]
+    ) {.async: (raises: [CancelledError]).} =
+      sent.add(blocksDelivery.mapIt(it.address))
+
+    for blk in blocks:
+      (await engine.localStore.putBlock(blk)).tryGet()
+      peersCtx[0].blockWanted(blk.address)
+    engine.network.request.sendBlocksDelivery = sendBlocksDelivery
+
+    await engine.taskHandler(peersCtx[0])
+    check sent.len == blocks.len
+
+  test "Should serve wants for whole blocks and leaves together":
+    var sent: seq[BlockAddress]
+    proc sendBlocksDelivery(
+        id: PeerId, blocksDelivery: seq[BlockDelivery]
+    ) {.async: (raises: [CancelledError]).} =
+      sent.add(blocksDelivery.mapIt(it.address))
+
+    let
+      (_, tree, _) = makeDataset(blocks).tryGet()
+      treeCid = tree.rootCid.tryGet()
+      leaves = toSeq(0 ..< blocks.len).mapIt(BlockAddress.init(treeCid, it))
+
+    for index, blk in blocks:
+      (await engine.localStore.putBlock(blk)).tryGet()
+      (
+        await engine.localStore.putCidAndProof(
+          treeCid, index, blk.cid, tree.getProof(index).tryGet()
+        )
+      ).tryGet()
+    engine.network.request.sendBlocksDelivery = sendBlocksDelivery
+
+    peersCtx[0].blockWanted(blocks[0].address)
+    for address in leaves.reversed:
+      peersCtx[0].blockWanted(address)
 
     await engine.taskHandler(peersCtx[0])
+    check sent.len == blocks.len + 1
+    check blocks[0].address in sent
+    check sent.filterIt(it.leaf) == leaves
 
   test "Should not mark blocks for which local look fails as sent":
-    peersCtx[0].wantedBlocks.incl(blocks[0].address)
+    peersCtx[0].blockWanted(blocks[0].address)
 
     await engine.taskHandler(peersCtx[0])
 
@@ -0,0 +1,82 @@
+import std/sequtils
+
+import pkg/chronos
+import pkg/libp2p/[cid, peerid]
+import pkg/questionable
+import pkg/questionable/results
+
+import pkg/codex/blockexchange
+import pkg/codex/blockexchange/engine/readahead
+import pkg/codex/blocktype as bt
+
+import ../../../asynctest
+import ../../helpers
+import ../../examples
+
+asyncchecksuite "Readahead":
+  let
+    peer = PeerId.example
+    treeCid = Cid.example
+    blk = bt.Block.example
+
+  var
+    looked: seq[BlockAddress]
+    readahead: Readahead
+
+  proc leaf(index: int): BlockAddress =
+    BlockAddress.init(treeCid, index)
+
+  setup:
+    looked = @[]
+
+    proc lookup(
+        address: BlockAddress
+    ): Future[?!BlockDelivery] {.async: (raises: [CancelledError]).} =
+      looked.add(address)
+      success BlockDelivery(address: address, blk: blk)
+
+    readahead = Readahead.new(4, lookup)
+
+  teardown:
+    await readahead.stop()
+
+  test "Should read ahead of leaves asked for in order":
+    readahead.observe(peer, leaf(10))
+    check looked.len == 0
+
+    readahead.observe(peer, leaf(11))
+    check looked == (12 .. 15).mapIt(leaf(it))
+
+  test "Should keep the window full":
+    for index in 0 .. 2:
+      readahead.observe(peer, leaf(index))
+
+    check looked == (2 .. 6).mapIt(leaf(it))
+
+  test "Should not read ahead of scattered leaves":
+    for index in [3, 40, 9, 100]:
+      readahead.observe(peer, leaf(index))
+
+    check looked.len == 0
+
+  test "Should not read ahead of blocks which aren't leaves":
+    readahead.observe(peer, BlockAddress.init(Cid.example))
+    readahead.observe(peer, BlockAddress.init(Cid.example))
+
+    check looked.len == 0
+
+  test "Should track peers separately":
+    readahead.observe(peer, leaf(0))
+    readahead.observe(PeerId.example, leaf(1))
+
+    check looked.len == 0
+
+  test "Should hand over the lookups read ahead once":
+    readahead.observe(peer, leaf(0))
+    readahead.observe(peer, leaf(1))
+
+    let prefetched = readahead.take(leaf(2))
+    check not prefetched.isNil
+    check (await prefetched).tryGet().address == leaf(2)
+    check readahead.take(leaf(2)).isNil
+    check readahead.take(leaf(100)).isNil
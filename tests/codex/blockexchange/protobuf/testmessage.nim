@@ -0,0 +1,99 @@
+import std/sequtils
+import std/strutils
+
+import pkg/chronos
+import pkg/questionable
+import pkg/stew/byteutils
+
+import pkg/codex/blockexchange/protobuf/message
+import pkg/codex/blockexchange/engine/wirecompression
+import pkg/codex/utils/deflate
+import pkg/codex/blocktype as bt
+
+import ../../../asynctest
+import ../../examples
+import ../../helpers
+
+suite "block exchange protobuf messages":
+  proc delivery(blk: bt.Block): BlockDelivery =
+    BlockDelivery(blk: blk, address: blk.address)
+
+  proc roundTrip(msg: Message): Message =
+    Message.protobufDecode(protobufEncode(msg)).tryGet()
+
+  test "should encode the compression flag of want lists":
+    let msg = Message(wantList: WantList(compression: true))
+    check roundTrip(msg).wantList.compression
+    check not roundTrip(Message(wantList: WantList())).wantList.compression
+
+  test "should encode busy presences":
+    let
+      presence = BlockPresence(
+        address: BlockAddress.example, `type`: BlockPresenceType.Busy, retryAfter: 5000
+      )
+      decoded =
+        roundTrip(Message(wantList: WantList(busy: true), blockPresences: @[presence]))
+
+    check decoded.wantList.busy
+    check decoded.blockPresences == @[presence]
+
+  test "should encode the dont-have flag of want lists":
+    let decoded = roundTrip(Message(wantList: WantList(dontHaveBlocks: true)))
+    check decoded.wantList.dontHaveBlocks
+    check not roundTrip(Message(wantList: WantList())).wantList.dontHaveBlocks
+
+  test "should send compressible blocks compressed":
+    let blk = bt.Block.new('a'.repeat(4096).toBytes).tryGet()
+    var bd = delivery(blk)
+    WireCompression.new().prepare(bd)
+
+    check bd.compressed
+    check blk.deflated.len < blk.data.len
+
+    let decoded = roundTrip(Message(payload: @[bd])).payload[0]
+    check decoded.compressed
+    check decoded.blk.cid == blk.cid
+    check decoded.blk.data == blk.data
+
+  test "should send incompressible blocks as they are":
+    let blk = bt.Block.example
+    var bd = delivery(blk)
+    WireCompression.new().prepare(bd)
+
+    check not bd.compressed
+    let decoded = roundTrip(Message(payload: @[bd])).payload[0]
+    check not decoded.compressed
+    check decoded.blk.data == blk.data
+
+  test "should reject compressed blocks not matching their size":
+    let blk = bt.Block.new('a'.repeat(4096).toBytes).tryGet()
+    var bd = delivery(blk)
+    WireCompression.new().prepare(bd)
+
+    blk.data = blk.data[0 ..< 2048]
+    check Message.protobufDecode(protobufEncode(Message(payload: @[bd]))).isErr
+
+  test "should not inflate compressed blocks past their declared size":
+    let blk = bt.Block.new('a'.repeat(1024 * 1024).toBytes).tryGet()
+    var bd = delivery(blk)
+    WireCompression.new().prepare(bd)
+    check bd.compressed
+
+    # the smallest size a stream of that length may claim
+    blk.data = blk.data[0 ..< blk.deflated.len]
+    check blk.deflated.inflatedSize(blk.data.len).isNone
+    check blk.deflated.inflatedSize(1024 * 1024) == (1024 * 1024).some
+    check Message.protobufDecode(protobufEncode(Message(payload: @[bd]))).isErr
+
+  test "should bound the bytes inflated per message":
+    let blocks = (0 ..< 4).mapIt(bt.Block.new(($it).repeat(4096).toBytes).tryGet())
+    var payload: seq[BlockDelivery]
+    for blk in blocks:
+      var bd = delivery(blk)
+      WireCompression.new().prepare(bd)
+      check bd.compressed
+      payload.add(bd)
+
+    let encoded = protobufEncode(Message(payload: payload))
+    check Message.protobufDecode(encoded, maxInflated = 4 * 4096).isOk
+    check Message.protobufDecode(encoded, maxInflated = 4 * 4096 - 1).isErr
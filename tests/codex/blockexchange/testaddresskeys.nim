@@ -0,0 +1,73 @@
+import std/sequtils
+import std/tables
+
+import pkg/unittest2
+import pkg/libp2p/cid
+import pkg/questionable
+
+import pkg/codex/blocktype
+import pkg/codex/blockexchange/addresskeys
+
+import ../examples
+
+suite "Address keys":
+  var keys: AddressKeys
+
+  setup:
+    keys = AddressKeys.new()
+
+  test "Should key the leaves of a tree by one interned cid":
+    let
+      treeCid = Cid.example
+      leaves = (0 .. 9).mapIt(keys.acquire(BlockAddress.init(treeCid, it)))
+
+    check:
+      keys.len == 1
+      leaves.deduplicate.len == leaves.len
+      (0 .. 9).allIt(keys.address(leaves[it]) == BlockAddress.init(treeCid, it))
+      keys.lookup(BlockAddress.init(treeCid, 3)) == leaves[3].some
+
+  test "Should tell blocks and leaves apart":
+    let
+      cid = Cid.example
+      blockKey = keys.acquire(BlockAddress.init(cid))
+      leafKey = keys.acquire(BlockAddress.init(cid, 0))
+
+    check:
+      blockKey != leafKey
+      keys.address(blockKey) == BlockAddress.init(cid)
+      keys.address(leafKey) == BlockAddress.init(cid, 0)
+
+  test "Should not intern cids on lookup":
+    check:
+      keys.lookup(BlockAddress.init(Cid.example)).isNone
+      keys.len == 0
+
+  test "Should recycle the ids of released cids":
+    let
+      first = BlockAddress.init(Cid.example, 0)
+      second = BlockAddress.init(Cid.example, 0)
+      key = keys.acquire(first)
+
+    discard keys.acquire(first)
+    keys.release(key)
+    check keys.lookup(first) == key.some
+
+    keys.release(key)
+    check:
+      keys.lookup(first).isNone
+      keys.len == 0
+
+    let recycled = keys.acquire(second)
+    check:
+      recycled == key
+      keys.address(recycled) == second
+
+  test "Should key tables":
+    var table: Table[AddressKey, int]
+    for i in 0 ..< 100:
+      table[keys.acquire(BlockAddress.init(Cid.example, i))] = i
+
+    check:
+      table.len == 100
+      toSeq(table.pairs).allIt(keys.address(it[0]).index == it[1])
@@ -1,5 +1,6 @@
 import ./engine/testengine
 import ./engine/testblockexc
 import ./engine/testadvertiser
+import ./engine/testreadahead
 
 {.warning[UnusedImport]: off.}
@@ -104,6 +104,39 @@ asyncchecksuite "Network - Handlers":
 
     await done.wait(500.millis)
 
+  test "Should stop reading from a peer whose handlers are all busy":
+    var
+      running = 0
+      release = newFuture[void]()
+
+    proc presenceHandler(
+        peer: PeerId, presence: seq[BlockPresence]
+    ) {.async: (raises: []).} =
+      inc running
+      try:
+        await release
+      except CatchableError:
+        discard
+
+    network.handlers.onPresence = presenceHandler
+
+    let msg = Message(
+      blockPresences:
+        @[BlockPresence(address: blocks[0].address, type: BlockPresenceType.Have)]
+    )
+
+    var data: seq[byte]
+    for _ in 0 ..< DefaultMaxHandlers + 2:
+      data &= lenPrefix(protobufEncode(msg))
+    await buffer.pushData(data)
+
+    check eventually running == DefaultMaxHandlers
+    await sleepAsync(50.millis)
+    check running == DefaultMaxHandlers
+
+    release.complete()
+    check eventually running == DefaultMaxHandlers + 2
+
 asyncchecksuite "Network - Senders":
   let chunker = RandomChunker.new(Rng.instance(), size = 1024, chunkSize = 256)
 
@@ -3,6 +3,7 @@ import std/sequtils
 
 import pkg/unittest2
 import pkg/libp2p
+import pkg/chronos
 
 import pkg/codex/blockexchange/peers
 import pkg/codex/blockexchange/protobuf/blockexc
@@ -31,6 +32,72 @@ suite "Peer Context Store":
   test "Should get peer":
     check store.get(peerCtx.id) == peerCtx
 
+  test "Should watch all requests to a peer with a single timer":
+    peerCtx.activityTimeout = 50.milliseconds
+    peerCtx.blockRequestScheduled(BlockAddress.example)
+    peerCtx.blockRequestScheduled(BlockAddress.example)
+
+    let inactive = peerCtx.inactive()
+    check peerCtx.inactive() == inactive
+    check not inactive.finished
+
+    check waitFor(inactive.withTimeout(1.seconds))
+    check peerCtx.inactive() != inactive
+
+  test "Should wake up requests of a peer marked inactive":
+    peerCtx.activityTimeout = 60.seconds
+    peerCtx.blockRequestScheduled(BlockAddress.example)
+
+    let inactive = peerCtx.inactive()
+    peerCtx.markInactive()
+    check inactive.finished
+
+  test "Should stop watching a peer":
+    peerCtx.activityTimeout = 50.milliseconds
+    peerCtx.blockRequestScheduled(BlockAddress.example)
+
+    let inactive = peerCtx.inactive()
+    waitFor peerCtx.stopWatching()
+    waitFor sleepAsync(200.milliseconds)
+    check not inactive.finished
+
+  test "Should bound the remote haves kept for a peer":
+    let treeCid = Cid.example
+    for i in 0 .. MaxPeerPresence:
+      let address = BlockAddress.init(treeCid, i)
+      peerCtx.setPresence(Presence(address: address, have: true))
+
+    check peerCtx.blocks.len == MaxPeerPresence * 3 div 4
+
+  test "Should bound the blocks a peer wants":
+    let treeCid = Cid.example
+    for i in 0 ..< MaxPeerWants:
+      check peerCtx.canWant
+      peerCtx.blockWanted(BlockAddress.init(treeCid, i))
+
+    check not peerCtx.canWant
+    peerCtx.blockUnwanted(BlockAddress.init(treeCid, 0))
+    check peerCtx.canWant
+
+  test "Should take peers with blocks of a dataset for likely holders":
+    let
+      treeCid = Cid.example
+      other = BlockAddress.init(Cid.example, 1)
+
+    check not peerCtx.likelyHas(BlockAddress.init(treeCid, 1))
+
+    peerCtx.setPresence(Presence(address: BlockAddress.init(treeCid, 0), have: true))
+    check peerCtx.likelyHas(BlockAddress.init(treeCid, 1))
+    check not peerCtx.likelyHas(BlockAddress.init(treeCid, 0)) # known already
+    check not peerCtx.likelyHas(other)
+
+    peerCtx.blockRequestScheduled(other)
+    check peerCtx.blockReceived(other)
+    check peerCtx.likelyHas(BlockAddress.init(other.treeCid, 2))
+
+    peerCtx.datasetMissing(BlockAddress.init(treeCid, 1))
+    check not peerCtx.likelyHas(BlockAddress.init(treeCid, 1))
+
 suite "Peer Context Store Peer Selection":
   var
     store: PeerCtxStore
@@ -82,8 +149,8 @@ suite "Peer Context Store Peer Selection":
     )
 
     for address in addresses:
-      peerCtxs[0].wantedBlocks.incl(address)
-      peerCtxs[5].wantedBlocks.incl(address)
+      peerCtxs[0].blockWanted(address)
+      peerCtxs[5].blockWanted(address)
 
     let peers = store.peersWant(addresses[4])
 
@@ -106,3 +173,39 @@ suite "Peer Context Store Peer Selection":
       else:
         check pc notin peers.with
         check pc in peers.without
+
+  test "Should index peers wanting a block":
+    let address = addresses[3]
+
+    peerCtxs[2].blockWanted(address)
+    peerCtxs[7].blockWanted(address)
+    check store.peersWanting(address).len == 2
+    check peerCtxs[2] in store.peersWanting(address)
+    check peerCtxs[7] in store.peersWanting(address)
+
+    peerCtxs[2].blockUnwanted(address)
+    check store.peersWanting(address) == @[peerCtxs[7]]
+
+    store.remove(peerCtxs[7].id)
+    check store.peersWanting(address).len == 0
+
+  test "Should index peers blocks were requested from":
+    let address = addresses[6]
+
+    peerCtxs[4].blockRequestScheduled(address)
+    check store.peersRequested(address) == @[peerCtxs[4]]
+
+    check peerCtxs[4].blockReceived(address)
+    check store.peersRequested(address).len == 0
+
+  test "Should index wants of peers added afterwards":
+    let
+      address = addresses[1]
+      peerCtx = BlockExcPeerCtx.example
+
+    peerCtx.blockWanted(address)
+    peerCtx.blockRequestScheduled(address)
+    store.add(peerCtx)
+
+    check store.peersWanting(address) == @[peerCtx]
+    check store.peersRequested(address) == @[peerCtx]
@@ -2,12 +2,14 @@ import std/sequtils
 import std/algorithm
 
 import pkg/chronos
+import pkg/libp2p/cid
 import pkg/stew/byteutils
 
 import pkg/codex/blocktype as bt
 import pkg/codex/blockexchange
 
 import ../helpers
+import ../examples
 import ../../asynctest
 
 suite "Pending Blocks":
@@ -84,3 +86,28 @@ suite "Pending Blocks":
     pendingBlocks.decRetries(address)
     check pendingBlocks.retries(address) == 0
     check pendingBlocks.retriesExhausted(address)
+
+  test "Should track the leaves of a tree":
+    let
+      pendingBlocks = PendingBlocksManager.new()
+      treeCid = Cid.example
+      addresses = (0 .. 9).mapIt(BlockAddress.init(treeCid, it))
+      handles = addresses.mapIt(pendingBlocks.getWantHandle(it))
+
+    check:
+      addresses.allIt(it in pendingBlocks)
+      BlockAddress.init(treeCid, 10) notin pendingBlocks
+      toSeq(pendingBlocks.wantList).mapIt(it.index.int).sorted == toSeq(0 .. 9)
+      toSeq(pendingBlocks.wantListCids) == @[treeCid]
+
+    await handles[0].cancelAndWait()
+    check:
+      addresses[0] notin pendingBlocks
+      addresses[1] in pendingBlocks
+
+    for handle in handles:
+      await handle.cancelAndWait()
+
+    check:
+      pendingBlocks.len == 0
+      addresses.allIt(it notin pendingBlocks)
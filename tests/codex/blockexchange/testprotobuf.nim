@@ -1,3 +1,4 @@
 import ./protobuf/testpresence
+import ./protobuf/testmessage
 
 {.warning[UnusedImport]: off.}
@@ -152,6 +152,28 @@ suite "Test CodexTree":
       tree.mcodec == sha256
       tree == fromNodes
 
+  test "Should derive proofs from the proofs of neighbouring leaves":
+    let
+      tree = CodexTree.init(sha256, leaves = data).tryGet
+      root = tree.root.tryGet
+
+    for index in 0 ..< data.len:
+      let
+        sibling = index xor 1
+        proof = tree.getProof(sibling).tryGet.neighbourProof(data[sibling], index).tryGet
+
+      check:
+        proof.path == tree.getProof(index).tryGet.path
+        proof.verify(data[index], root).tryGet
+
+    check tree.getProof(5).tryGet.neighbourProof(data[5], 0).isErr
+
+    let
+      odd = CodexTree.init(sha256, leaves = data[0 ..< 9]).tryGet
+      last = odd.getProof(7).tryGet.neighbourProof(data[7], 8).tryGet
+
+    check last.verify(data[8], odd.root.tryGet).tryGet
+
 let
   digestSize = sha256.digestSize.get
   zero: seq[byte] = newSeq[byte](digestSize)
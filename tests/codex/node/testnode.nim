@@ -208,3 +208,80 @@ asyncchecksuite "Test Node - Basic":
     let randomBlock = bt.Block.new("Random block".toBytes).tryGet()
 
     check (await node.hasLocalBlock(randomBlock.cid)) == false
+
+  test "Should rebuild missing blocks of a protected dataset":
+    node.stripeSize = 4
+
+    let
+      stream = BufferStream.new()
+      storeFut = node.store(stream, blockSize = 1024.NBytes)
+      original = bt.Block.example(size = 10 * 1024).data
+
+    await stream.pushData(original)
+    await stream.pushEof()
+    await stream.close()
+
+    let
+      manifestCid = (await storeFut).tryGet()
+      manifestBlock = (await localStore.getBlock(manifestCid)).tryGet()
+      manifest = Manifest.decode(manifestBlock).tryGet()
+
+    check:
+      manifest.protected
+      manifest.stripeSize == 4
+      manifest.leavesCount == 13
+
+    for index in 0 ..< manifest.leavesCount:
+      check (await localStore.getBlockAndProof(manifest.treeCid, index)).isOk
+
+    # Lose one data block of the first stripe and the parity block of the last
+    (await localStore.delBlock(manifest.treeCid, 1)).tryGet()
+    (await localStore.delBlock(manifest.treeCid, 12)).tryGet()
+
+    var data: seq[byte]
+    (
+      await node.fetchBatched(
+        manifest,
+        onBatch = proc(
+            blocks: seq[bt.Block]
+        ): Future[?!void] {.async: (raises: [CancelledError]).} =
+          for blk in blocks:
+            data &= blk.data
+          return success(),
+      )
+    ).tryGet()
+
+    check data == original
+    for index in [1, 12]:
+      check (await localStore.getBlockAndProof(manifest.treeCid, index)).isOk
+
+  test "Should not use rebuilt blocks that don't match the dataset tree":
+    node.stripeSize = 4
+
+    let
+      stream = BufferStream.new()
+      storeFut = node.store(stream, blockSize = 1024.NBytes)
+
+    await stream.pushData(bt.Block.example(size = 10 * 1024).data)
+    await stream.pushEof()
+    await stream.close()
+
+    let
+      manifestCid = (await storeFut).tryGet()
+      manifestBlock = (await localStore.getBlock(manifestCid)).tryGet()
+      manifest = Manifest.decode(manifestBlock).tryGet()
+      parity = manifest.blocksCount # parity block of the first stripe
+      (_, parityProof) =
+        (await localStore.getCidAndProof(manifest.treeCid, parity)).tryGet()
+      bad = bt.Block.example(size = 1024)
+
+    # Lose a data block of the first stripe, and corrupt its parity block
+    (await localStore.delBlock(manifest.treeCid, 1)).tryGet()
+    (await localStore.delBlock(manifest.treeCid, parity)).tryGet()
+    (await localStore.putBlock(bad)).tryGet()
+    (
+      await localStore.putCidAndProof(manifest.treeCid, parity, bad.cid, parityProof)
+    ).tryGet()
+
+    check (await node.fetchBatched(manifest)).isErr
+    check not (await localStore.hasBlock(manifest.treeCid, 1)).tryGet()
@@ -141,6 +141,23 @@ proc commonBlockStoreTests*(
 
       check count == 1
 
+    test "listManifests":
+      let
+        manifestBlock =
+          Block.new(manifest.encode().tryGet(), codec = ManifestCodec).tryGet()
+        treeBlock = Block.new(tree.encode()).tryGet()
+
+      (await store.putBlock(treeBlock)).tryGet()
+      (await store.putBlock(manifestBlock)).tryGet()
+      (await store.putBlock(newBlock1)).tryGet()
+
+      var entries: seq[ManifestEntry]
+      for m in (await store.listManifests()).tryGet():
+        if entry =? await m:
+          entries.add(entry)
+
+      check entries == @[(manifestCid: manifestBlock.cid, treeCid: manifest.treeCid)]
+
     test "listBlocks Both":
       let
         blocks = @[newBlock1, newBlock2, newBlock3]
@@ -1,4 +1,5 @@
 import std/random
+import std/sequtils
 
 import pkg/unittest2
 import pkg/stew/objects
@@ -6,10 +7,14 @@ import pkg/questionable
 import pkg/questionable/results
 
 import pkg/codex/clock
+import pkg/codex/merkletree
+import pkg/codex/blocktype as bt
+import pkg/codex/utils/json
 import pkg/codex/stores/repostore/types
 import pkg/codex/stores/repostore/coders
 
 import ../../helpers
+import ../../examples
 
 suite "Test coders":
   proc rand(T: type NBytes): T =
@@ -57,3 +62,50 @@ suite "Test coders":
     for val in newSeqWith(100, rand(StoreResult)):
       check:
         success(val) == StoreResult.decode(encode(val))
+
+  test "BlockMetadata has a fixed size encoding":
+    for val in newSeqWith(100, rand(BlockMetadata)):
+      check:
+        encode(val).len == 25
+
+  test "LeafMetadata encode/decode":
+    let
+      blocks = newSeqWith(4, bt.Block.example)
+      tree = CodexTree.init(blocks.mapIt(it.cid)).tryGet()
+
+    for index, blk in blocks:
+      let
+        val = LeafMetadata(blkCid: blk.cid, proof: tree.getProof(index).tryGet())
+        decoded = LeafMetadata.decode(encode(val)).tryGet()
+
+      check:
+        decoded.blkCid == val.blkCid
+        decoded.proof == val.proof
+
+  test "ManifestIndexEntry encode/decode":
+    let val = ManifestIndexEntry(treeCid: Cid.example)
+    check:
+      ManifestIndexEntry.decode(encode(val)).tryGet().treeCid == val.treeCid
+
+  test "JournalEntry encode/decode":
+    for op in JournalOp:
+      let
+        val = JournalEntry(op: op, cids: newSeqWith(3, Cid.example))
+        decoded = JournalEntry.decode(encode(val)).tryGet()
+
+      check:
+        decoded.op == val.op
+        decoded.cids == val.cids
+
+  test "Should decode metadata stored as JSON":
+    let
+      blk = bt.Block.example
+      tree = CodexTree.init(@[blk.cid]).tryGet()
+      leaf = LeafMetadata(blkCid: blk.cid, proof: tree.getProof(0).tryGet())
+      decodedLeaf = LeafMetadata.decode(leaf.toJson().toBytes()).tryGet()
+      blockMd = rand(BlockMetadata)
+
+    check:
+      decodedLeaf.blkCid == leaf.blkCid
+      decodedLeaf.proof == leaf.proof
+      success(blockMd) == BlockMetadata.decode(blockMd.toJson().toBytes())
@@ -7,6 +7,7 @@
 ## This file may not be copied, modified, or distributed except according to
 ## those terms.
 
+import std/algorithm
 import std/random
 import std/sequtils
 import pkg/chronos
@@ -91,3 +92,24 @@ suite "KeyUtils":
       namespaces[0].value == CodexMetaNamespace
       namespaces[1].value == "ttl"
       namespaces[2].value == "*"
+
+  test "createBlockCidAndProofMetadataKey should create fixed width leaf keys":
+    let
+      treeCid = Cid.example
+      key = !createBlockCidAndProofMetadataKey(treeCid, 10).option
+      namespaces = key.namespaces
+
+    check:
+      namespaces.len == 4
+      namespaces[0].value == CodexMetaNamespace
+      namespaces[1].value == "leaves"
+      namespaces[2].value == $treeCid
+      namespaces[3].value == "000000000000000A"
+
+  test "createBlockCidAndProofMetadataKey should sort leaves in index order":
+    let
+      treeCid = Cid.example
+      indices = @[0, 1, 2, 9, 10, 11, 99, 100, 255, 256, 65535, 65536]
+      keys = indices.mapIt($(!createBlockCidAndProofMetadataKey(treeCid, it).option))
+
+    check keys == keys.sorted()
@@ -1,6 +1,8 @@
 import std/os
 import std/strutils
 import std/sequtils
+import std/sets
+import std/tables
 
 import pkg/questionable
 import pkg/questionable/results
@@ -8,15 +10,23 @@ import pkg/questionable/results
 import pkg/chronos
 import pkg/stew/byteutils
 import pkg/datastore
+import pkg/taskpools
 
 import pkg/codex/stores/cachestore
 import pkg/codex/chunker
 import pkg/codex/stores
 import pkg/codex/stores/repostore/operations
+import pkg/codex/stores/repostore/journal
+import pkg/codex/stores/repostore/sharding
+import pkg/codex/stores/repostore/tiering
+import pkg/codex/stores/keyutils
+import pkg/codex/utils/json
 import pkg/codex/blocktype as bt
 import pkg/codex/clock
+import pkg/codex/errors
 import pkg/codex/utils/safeasynciter
 import pkg/codex/merkletree/codex
+import pkg/codex/manifest
 
 import ../../asynctest
 import ../helpers
@@ -75,6 +85,7 @@ asyncchecksuite "RepoStore":
     repo = RepoStore.new(repoDs, metaDs, clock = mockClock, quotaMaxBytes = 200'nb)
 
   teardown:
+    await repo.stop()
     (await repoDs.close()).tryGet
     (await metaDs.close()).tryGet
 
@@ -120,6 +131,36 @@ asyncchecksuite "RepoStore":
     expect QuotaNotEnoughError:
       (await repo.putBlock(blk)).tryGet
 
+  test "Should store blocks in a batch":
+    let
+      blk1 = createTestBlock(50)
+      blk2 = createTestBlock(60)
+
+    (await repo.putBlock(blk1)).tryGet
+    (await repo.putBlocks(@[blk1, blk2])).tryGet
+
+    check:
+      repo.quotaUsedBytes == 110'nb
+      repo.totalBlocks == 2
+      (await blk2.cid in repo)
+
+  test "Should not store any block of a batch passed the quota":
+    let
+      blk1 = createTestBlock(100)
+      blk2 = createTestBlock(150)
+
+    expect QuotaNotEnoughError:
+      (await repo.putBlocks(@[blk1, blk2])).tryGet
+
+    check:
+      repo.quotaUsedBytes == 0'nb
+      not (await blk1.cid in repo)
+      not (await blk2.cid in repo)
+
+    for blk in [blk1, blk2]:
+      let blkKey = makePrefixKey(repo.postFixLen, blk.cid).tryGet()
+      check not (await repoDs.has(blkKey)).tryGet()
+
   test "Should reserve bytes":
     let blk = createTestBlock(100)
 
@@ -472,6 +513,582 @@ asyncchecksuite "RepoStore":
     (await repo.putBlock(blk)).tryGet()
     (await repo.delBlock(treeCid, 0.Natural)).tryGet()
 
+  test "should count the stored blocks of a dataset":
+    let
+      repo = RepoStore.new(repoDs, metaDs, clock = mockClock, quotaMaxBytes =
+          1000'nb)
+      blocks = await makeRandomBlocks(datasetSize = 768, blockSize = 256'nb)
+      (_, tree, manifest) = makeDataset(blocks).tryGet()
+      treeCid = tree.rootCid.tryGet()
+
+    check (await repo.countBlocks(treeCid, blocks.len)).tryGet() == 0.Natural
+
+    for index in [0, 2]:
+      (await repo.putBlock(blocks[index])).tryGet()
+      (
+        await repo.putCidAndProof(
+          treeCid, index, blocks[index].cid, tree.getProof(index).tryGet()
+        )
+      ).tryGet()
+
+    check (await repo.countBlocks(treeCid, blocks.len)).tryGet() == 2.Natural
+
+    (await repo.delBlock(treeCid, 2.Natural)).tryGet()
+    check (await repo.countBlocks(treeCid, blocks.len)).tryGet() == 1.Natural
+
+    # expired blocks are deleted by cid, along with their leaf metadata
+    mockClock.set(now + DefaultBlockTtl.seconds + 1)
+    (await repo.delBlock(blocks[0].cid)).tryGet()
+    check not (await repo.hasBlock(blocks[0].cid)).tryGet()
+    check (await repo.getCidAndProof(treeCid, 0)).isErr
+    check (await repo.leafCount(treeCid)).tryGet() == 0.Natural
+    check (await repo.countBlocks(treeCid, blocks.len)).tryGet() == 0.Natural
+
+  test "should count leaves stored before leaves were counted":
+    let
+      repo = RepoStore.new(repoDs, metaDs, clock = mockClock, quotaMaxBytes =
+          1000'nb)
+      blocks = await makeRandomBlocks(datasetSize = 768, blockSize = 256'nb)
+      (_, tree, manifest) = makeDataset(blocks).tryGet()
+      treeCid = tree.rootCid.tryGet()
+
+    for blk in blocks:
+      (await repo.putBlock(blk)).tryGet()
+
+    # leaves of an older repo, missing from the leaf count
+    for index in [0, 1]:
+      discard (
+        await repo.putLeafMetadata(
+          treeCid, index, blocks[index].cid, tree.getProof(index).tryGet()
+        )
+      ).tryGet()
+
+    (
+      await repo.putCidAndProof(treeCid, 2, blocks[2].cid, tree.getProof(2).tryGet())
+    ).tryGet()
+    check (await repo.leafCount(treeCid)).tryGet() == 1.Natural
+
+    await repo.start()
+    check not repo.leavesCounted
+    check (await repo.countBlocks(treeCid, blocks.len)).tryGet() == 3.Natural
+
+  test "should migrate leaf metadata stored under legacy keys":
+    let
+      blocks = await makeRandomBlocks(datasetSize = 512, blockSize = 256'nb)
+      (_, tree, manifest) = makeDataset(blocks).tryGet()
+      treeCid = tree.rootCid.tryGet()
+      leaf = LeafMetadata(blkCid: blocks[1].cid, proof: tree.getProof(1).tryGet())
+      legacyKey = ((LegacyBlockProofKey / $treeCid).tryGet() / "1").tryGet()
+
+    (await metaDs.put(legacyKey, leaf.toJson().toBytes())).tryGet()
+
+    await repo.start()
+
+    check (await repo.getLeafMetadata(treeCid, 1)).tryGet().blkCid == blocks[1].cid
+    check not (await metaDs.has(legacyKey)).tryGet()
+
+  test "should migrate metadata in the background, dropping undecodable leaves":
+    let
+      blocks = await makeRandomBlocks(datasetSize = 512, blockSize = 256'nb)
+      (_, tree, manifest) = makeDataset(blocks).tryGet()
+      treeCid = tree.rootCid.tryGet()
+      leaf = LeafMetadata(blkCid: blocks[0].cid, proof: tree.getProof(0).tryGet())
+      legacyKey = ((LegacyBlockProofKey / $treeCid).tryGet() / "0").tryGet()
+      badKey = ((LegacyBlockProofKey / $treeCid).tryGet() / "1").tryGet()
+
+    (await metaDs.put(legacyKey, leaf.toJson().toBytes())).tryGet()
+    (await metaDs.put(badKey, @[1'u8, 2, 3])).tryGet()
+
+    await repo.start()
+    check repo.started
+    check eventually repo.metadataMigrated
+
+    check (await repo.getLeafMetadata(treeCid, 0)).tryGet().blkCid == blocks[0].cid
+    check not (await metaDs.has(legacyKey)).tryGet()
+    check not (await metaDs.has(badKey)).tryGet()
+
+  test "should list manifests from the manifest index":
+    let
+      blocks = await makeRandomBlocks(datasetSize = 512, blockSize = 256'nb)
+      (_, _, manifest) = makeDataset(blocks).tryGet()
+      manifestBlock =
+        bt.Block.new(manifest.encode().tryGet(), codec = ManifestCodec).tryGet()
+      missing = Manifest.new(
+        treeCid = Cid.example, blockSize = 256'nb, datasetSize = 512'nb
+      )
+      missingBlock =
+        bt.Block.new(missing.encode().tryGet(), codec = ManifestCodec).tryGet()
+      missingKey = createManifestIndexKey(missingBlock.cid).tryGet()
+
+    await repo.start()
+    check eventually repo.manifestIndexReady
+
+    (await repo.putBlock(manifestBlock)).tryGet()
+    # index entry of a manifest which failed to store
+    (await repo.indexManifest(missingBlock)).tryGet()
+
+    var entries: seq[ManifestEntry]
+    for m in (await repo.listManifests()).tryGet():
+      if entry =? await m:
+        entries.add(entry)
+
+    check entries == @[(manifestCid: manifestBlock.cid, treeCid: manifest.treeCid)]
+    check not (await metaDs.has(missingKey)).tryGet()
+
+  test "should keep index entries of manifests being stored":
+    let
+      manifest = Manifest.new(
+        treeCid = Cid.example, blockSize = 256'nb, datasetSize = 512'nb
+      )
+      manifestBlock =
+        bt.Block.new(manifest.encode().tryGet(), codec = ManifestCodec).tryGet()
+      key = createManifestIndexKey(manifestBlock.cid).tryGet()
+
+    await repo.start()
+    check eventually repo.manifestIndexReady
+
+    # the index entry is written ahead of the data of the manifest
+    let storing = repo.storingManifests([manifestBlock])
+    (await repo.indexManifest(manifestBlock)).tryGet()
+
+    for m in (await repo.listManifests()).tryGet():
+      discard await m
+    check (await metaDs.has(key)).tryGet()
+
+    repo.manifestsStored(storing)
+    check repo.manifestsStoring.len == 0
+
+    for m in (await repo.listManifests()).tryGet():
+      discard await m
+    check not (await metaDs.has(key)).tryGet()
+
+  test "should unindex deleted manifests":
+    let
+      blocks = await makeRandomBlocks(datasetSize = 512, blockSize = 256'nb)
+      (_, _, manifest) = makeDataset(blocks).tryGet()
+      manifestBlock =
+        bt.Block.new(manifest.encode().tryGet(), codec = ManifestCodec).tryGet()
+      key = createManifestIndexKey(manifestBlock.cid).tryGet()
+
+    (await repo.putBlock(manifestBlock)).tryGet()
+    check (await metaDs.has(key)).tryGet()
+
+    (await repo.delBlock(manifestBlock.cid)).tryGet()
+    check not (await metaDs.has(key)).tryGet()
+
+  test "should roll back unfinished block writes on start":
+    let
+      blk = createTestBlock(100)
+      blkKey = makePrefixKey(repo.postFixLen, blk.cid).tryGet()
+
+    # crash after writing the data, before writing the metadata
+    discard (await repo.beginJournal(JournalOp.Store, @[blk.cid])).tryGet()
+    (await repoDs.put(blkKey, blk.data)).tryGet()
+
+    await repo.start()
+
+    check not (await repoDs.has(blkKey)).tryGet()
+    check not (await repo.hasBlock(blk.cid)).tryGet()
+    check (await repo.recoverJournal()).tryGet() == 0
+
+  test "should complete unfinished block deletes on start":
+    let
+      blk = createTestBlock(100)
+      blkKey = makePrefixKey(repo.postFixLen, blk.cid).tryGet()
+
+    (await repo.putBlock(blk)).tryGet()
+
+    # crash after deleting the data, before deleting the metadata
+    discard (await repo.beginJournal(JournalOp.Delete, @[blk.cid])).tryGet()
+    (await repoDs.delete(blkKey)).tryGet()
+
+    await repo.start()
+
+    let metaKey = createBlockExpirationMetadataKey(blk.cid).tryGet()
+    check not (await metaDs.has(metaKey)).tryGet()
+    check repo.totalBlocks == 0
+    check repo.quotaUsedBytes == 0'nb
+    check (await repo.recoverJournal()).tryGet() == 0
+
+  test "should drop block data left without metadata on delete":
+    let
+      blk = createTestBlock(100)
+      blkKey = makePrefixKey(repo.postFixLen, blk.cid).tryGet()
+
+    # crash after deleting the metadata, before deleting the data
+    (await repoDs.put(blkKey, blk.data)).tryGet()
+
+    (await repo.delBlock(blk.cid)).tryGet()
+
+    check not (await repoDs.has(blkKey)).tryGet()
+    check repo.totalBlocks == 0
+
+  test "should not drop the data of blocks a batch is writing":
+    let
+      blk = createTestBlock(100)
+      blkKey = makePrefixKey(repo.postFixLen, blk.cid).tryGet()
+
+    repo.writingBlocks(@[blk.cid])
+    (await repoDs.put(blkKey, blk.data)).tryGet()
+
+    (await repo.dropUnstoredData(blk.cid)).tryGet()
+    check (await repoDs.has(blkKey)).tryGet()
+
+    repo.blocksWritten(@[blk.cid])
+    (await repo.dropUnstoredData(blk.cid)).tryGet()
+    check not (await repoDs.has(blkKey)).tryGet()
+
+  test "should store blocks and metadata in a unified datastore":
+    let
+      ds = SQLiteDatastore.new(Memory).tryGet()
+      repo = RepoStore.new(ds, ds, clock = mockClock, quotaMaxBytes = 200'nb)
+      blocks = @[createTestBlock(10), createTestBlock(20)]
+
+    check repo.unified
+    await repo.start()
+
+    (await repo.putBlocks(blocks)).tryGet()
+    check repo.totalBlocks == 2
+    check (await repo.recoverJournal()).tryGet() == 0
+    for blk in blocks:
+      check (await repo.getBlock(blk.cid)).tryGet() == blk
+
+    await repo.stop()
+    await repo.close()
+
+  test "should not leave journal entries behind":
+    let blk = createTestBlock(100)
+
+    (await repo.putBlock(blk)).tryGet()
+    (await repo.delBlock(blk.cid)).tryGet()
+    (await repo.putBlocks(@[createTestBlock(10), createTestBlock(20)])).tryGet()
+
+    check (await repo.recoverJournal()).tryGet() == 0
+
+  test "should move datasets to the capacity tier":
+    let
+      capacityDs = SQLiteDatastore.new(Memory).tryGet()
+      repo = RepoStore.new(
+        repoDs,
+        metaDs,
+        clock = mockClock,
+        quotaMaxBytes = 2000'nb,
+        capacityDs = capacityDs,
+      )
+      blocks = await makeRandomBlocks(datasetSize = 768, blockSize = 256'nb)
+      (_, tree, _) = makeDataset(blocks).tryGet()
+      treeCid = tree.rootCid.tryGet()
+
+    for index, blk in blocks:
+      (await repo.putBlock(blk)).tryGet()
+      (
+        await repo.putCidAndProof(treeCid, index, blk.cid, tree.getProof(index).tryGet())
+      ).tryGet()
+
+    check (await repo.moveDataset(treeCid, toCapacity = true)).tryGet() == blocks.len
+
+    for index, blk in blocks:
+      let key = makePrefixKey(repo.postFixLen, blk.cid).tryGet()
+      check not (await repoDs.has(key)).tryGet()
+      check (await capacityDs.has(key)).tryGet()
+      check (await repo.hasBlock(blk.cid)).tryGet()
+      check (await repo.getBlock(blk.cid)).tryGet() == blk
+      check (await repo.getBlock(treeCid, index)).tryGet() == blk
+
+    (await repo.delBlock(treeCid, 0)).tryGet()
+    let key = makePrefixKey(repo.postFixLen, blocks[0].cid).tryGet()
+    check not (await capacityDs.has(key)).tryGet()
+
+    (await capacityDs.close()).tryGet
+
+  test "should demote idle datasets and promote read ones":
+    let
+      capacityDs = SQLiteDatastore.new(Memory).tryGet()
+      repo = RepoStore.new(
+        repoDs,
+        metaDs,
+        clock = mockClock,
+        quotaMaxBytes = 2000'nb,
+        capacityDs = capacityDs,
+        coldAfter = 0.seconds,
+      )
+      blocks = await makeRandomBlocks(datasetSize = 768, blockSize = 256'nb)
+      (_, tree, manifest) = makeDataset(blocks).tryGet()
+      treeCid = tree.rootCid.tryGet()
+      manifestBlock =
+        bt.Block.new(manifest.encode().tryGet(), codec = ManifestCodec).tryGet()
+      keys = blocks.mapIt(makePrefixKey(repo.postFixLen, it.cid).tryGet())
+
+    await repo.start()
+    (await repo.putBlock(manifestBlock)).tryGet()
+    for index, blk in blocks:
+      (await repo.putBlock(blk)).tryGet()
+      (
+        await repo.putCidAndProof(treeCid, index, blk.cid, tree.getProof(index).tryGet())
+      ).tryGet()
+
+    (await repo.runTiering()).tryGet()
+
+    check treeCid in repo.coldDatasets
+    check (await metaDs.has(createColdDatasetKey(treeCid).tryGet())).tryGet()
+    for key in keys:
+      check (await capacityDs.has(key)).tryGet()
+    check (await repo.getBlock(manifestBlock.cid)).tryGet() == manifestBlock
+
+    for _ in 0 ..< PromoteReads:
+      discard (await repo.getBlock(treeCid, 0)).tryGet()
+
+    (await repo.runTiering()).tryGet()
+
+    check treeCid notin repo.coldDatasets
+    check not (await metaDs.has(createColdDatasetKey(treeCid).tryGet())).tryGet()
+    for key in keys:
+      check (await repoDs.has(key)).tryGet()
+      check not (await capacityDs.has(key)).tryGet()
+
+    await repo.stop()
+    (await capacityDs.close()).tryGet
+
+  test "should keep newly written datasets on the fast tier":
+    let
+      capacityDs = SQLiteDatastore.new(Memory).tryGet()
+      repo = RepoStore.new(
+        repoDs,
+        metaDs,
+        clock = mockClock,
+        quotaMaxBytes = 2000'nb,
+        capacityDs = capacityDs,
+        coldAfter = 1.hours,
+      )
+      blocks = await makeRandomBlocks(datasetSize = 768, blockSize = 256'nb)
+      (_, tree, manifest) = makeDataset(blocks).tryGet()
+      treeCid = tree.rootCid.tryGet()
+      manifestBlock =
+        bt.Block.new(manifest.encode().tryGet(), codec = ManifestCodec).tryGet()
+      deleted = Cid.example
+
+    await repo.start()
+    # up for longer than `coldAfter`
+    repo.tieringStarted = Moment.now() - 2.hours
+    repo.datasetReads[deleted] = DatasetReads(lastRead: repo.tieringStarted)
+
+    (await repo.putBlock(manifestBlock)).tryGet()
+    for index, blk in blocks:
+      (await repo.putBlock(blk)).tryGet()
+      (
+        await repo.putCidAndProof(treeCid, index, blk.cid, tree.getProof(index).tryGet())
+      ).tryGet()
+
+    (await repo.runTiering()).tryGet()
+
+    check treeCid notin repo.coldDatasets
+    for blk in blocks:
+      let key = makePrefixKey(repo.postFixLen, blk.cid).tryGet()
+      check not (await capacityDs.has(key)).tryGet()
+
+    check treeCid in repo.datasetReads
+    check deleted notin repo.datasetReads
+
+    await repo.stop()
+    (await capacityDs.close()).tryGet
+
+  test "should stripe blocks across shards":
+    let
+      shards =
+        @[SQLiteDatastore.new(Memory).tryGet(), SQLiteDatastore.new(Memory).tryGet()]
+      repo = RepoStore.new(
+        repoDs,
+        metaDs,
+        clock = mockClock,
+        quotaMaxBytes = 2000'nb,
+        shards = shards.mapIt(Datastore(it)),
+      )
+      blocks = (0 ..< 16).mapIt(bt.Block.new(("block " & $it).toBytes).tryGet())
+      used = blocks.foldl(a + b.data.len, 0).NBytes
+
+    check repo.isSharded
+    (await repo.putBlocks(blocks[0 ..< 8])).tryGet()
+    for blk in blocks[8 ..^ 1]:
+      (await repo.putBlock(blk)).tryGet()
+
+    check repo.quotaUsedBytes == used
+    var usedShards: seq[Datastore]
+    for blk in blocks:
+      let
+        key = makePrefixKey(repo.postFixLen, blk.cid).tryGet()
+        shard = repo.shardOf(key)
+
+      for ds in repo.shards:
+        check (await ds.has(key)).tryGet() == (ds == shard)
+
+      if shard notin usedShards:
+        usedShards.add(shard)
+
+      check (await repo.getBlock(blk.cid)).tryGet() == blk
+
+    check usedShards.len > 1
+
+    var listed = 0
+    for c in (await repo.listBlocks(BlockType.Block)).tryGet():
+      if (await c).isOk:
+        inc listed
+    check listed == blocks.len
+
+    for blk in blocks:
+      (await repo.delBlock(blk.cid)).tryGet()
+      let key = makePrefixKey(repo.postFixLen, blk.cid).tryGet()
+      check not (await repo.shardOf(key).has(key)).tryGet()
+
+    check repo.quotaUsedBytes == 0'nb
+    for ds in shards:
+      (await ds.close()).tryGet
+
+  test "should refuse to start with other shards":
+    let
+      shards = @[
+        Datastore(SQLiteDatastore.new(Memory).tryGet()),
+        Datastore(SQLiteDatastore.new(Memory).tryGet()),
+      ]
+      sharded = RepoStore.new(repoDs, metaDs, clock = mockClock, shards = shards)
+
+    await sharded.start()
+    await sharded.stop()
+
+    expect CodexError:
+      await repo.start()
+
+    let
+      extra = Datastore(SQLiteDatastore.new(Memory).tryGet())
+      more = RepoStore.new(repoDs, metaDs, clock = mockClock, shards = shards & extra)
+    expect CodexError:
+      await more.start()
+
+    let reordered = RepoStore.new(
+      repoDs, metaDs, clock = mockClock, shards = @[shards[1], shards[0]]
+    )
+    expect CodexError:
+      await reordered.start()
+
+    let same = RepoStore.new(repoDs, metaDs, clock = mockClock, shards = shards)
+    await same.start()
+    await same.stop()
+
+    for ds in shards & extra:
+      (await ds.close()).tryGet
+
+  test "should store compressible blocks compressed":
+    let
+      repo = RepoStore.new(
+        repoDs, metaDs, clock = mockClock, quotaMaxBytes = 20000'nb, compression = true
+      )
+      text = createTestBlock(4096)
+      random = (await makeRandomBlocks(datasetSize = 4096, blockSize = 4096'nb))[0]
+      textKey = makePrefixKey(repo.postFixLen, text.cid).tryGet()
+      randomKey = makePrefixKey(repo.postFixLen, random.cid).tryGet()
+
+    (await repo.putBlock(text)).tryGet()
+    (await repo.putBlocks(@[random])).tryGet()
+
+    let textSize = (await repoDs.get(textKey)).tryGet().len
+    check textSize < text.data.len
+    check (await repoDs.get(randomKey)).tryGet() == random.data
+    check repo.quotaUsedBytes == (textSize + random.data.len).NBytes
+
+    check (await repo.getBlock(text.cid)).tryGet() == text
+    check (await repo.getBlock(random.cid)).tryGet() == random
+
+    (await repo.delBlock(text.cid)).tryGet()
+    check repo.quotaUsedBytes == random.data.len.NBytes
+
+  test "should compress large blocks on the taskpool":
+    let
+      taskpool = Taskpool.new(numThreads = 2)
+      repo = RepoStore.new(
+        repoDs,
+        metaDs,
+        clock = mockClock,
+        quotaMaxBytes = (1024 * 1024).NBytes,
+        compression = true,
+        taskpool = taskpool,
+      )
+      single = createTestBlock(128 * 1024)
+      batched = createTestBlock(256 * 1024)
+
+    defer:
+      taskpool.shutdown()
+
+    (await repo.putBlock(single)).tryGet()
+    (await repo.putBlocks(@[batched, single])).tryGet()
+
+    var used = 0
+    for blk in [single, batched]:
+      let key = makePrefixKey(repo.postFixLen, blk.cid).tryGet()
+      let size = (await repoDs.get(key)).tryGet().len
+      check size < blk.data.len
+      used += size
+      check (await repo.getBlock(blk.cid)).tryGet() == blk
+
+    check repo.quotaUsedBytes == used.NBytes
+    check repo.totalBlocks == 2
+
+  test "should read blocks which only look compressed":
+    let
+      repo = RepoStore.new(
+        repoDs, metaDs, clock = mockClock, quotaMaxBytes = 20000'nb, compression = true
+      )
+      data = @[0x00'u8, 0x5a, 0x42, 0x01] & 'a'.repeat(2048).toBytes
+      blk = bt.Block.new(data).tryGet()
+      key = makePrefixKey(repo.postFixLen, blk.cid).tryGet()
+
+    # stored verbatim, e.g. before compression was turned on
+    (await repoDs.put(key, blk.data)).tryGet()
+    check (await repo.getBlock(blk.cid)).tryGet() == blk
+
+  test "should share the read of a block between concurrent readers":
+    let
+      blk = createTestBlock(100)
+      read = Future[?!bt.Block].Raising([CancelledError]).init("test.read")
+
+    (await repo.putBlock(blk)).tryGet()
+    repo.blockReads[(blk.cid, false)] = read # a read in flight
+
+    let
+      first = repo.getBlock(blk.cid)
+      second = repo.getBlock(BlockAddress.init(blk.cid))
+
+    await sleepAsync(1.millis)
+    check not first.finished
+    check not second.finished
+
+    await first.cancelAndWait()
+    check not read.finished
+
+    read.complete(success blk)
+    check (await second).tryGet() == blk
+
+  test "should not share the read of a block between tiers":
+    let
+      blk = createTestBlock(100)
+      read = Future[?!bt.Block].Raising([CancelledError]).init("test.read")
+
+    (await repo.putBlock(blk)).tryGet()
+    repo.blockReads[(blk.cid, true)] = read # a read of the capacity tier
+
+    check (await repo.getBlock(blk.cid)).tryGet() == blk
+    check not read.finished
+    await read.cancelAndWait()
+
+  test "should not keep the reads of blocks once done":
+    let blk = createTestBlock(100)
+
+    (await repo.putBlock(blk)).tryGet()
+    let reads = @[repo.getBlock(blk.cid), repo.getBlock(blk.cid)]
+    for read in reads:
+      check (await read).tryGet() == blk
+
+    await sleepAsync(1.millis)
+    check (blk.cid, false) notin repo.blockReads
+
 commonBlockStoreTests(
   "RepoStore Sql backend",
   proc(): BlockStore =
@@ -484,6 +1101,39 @@ commonBlockStoreTests(
     ),
 )
 
+commonBlockStoreTests(
+  "RepoStore unified Sql backend",
+  proc(): BlockStore =
+    let ds = SQLiteDatastore.new(Memory).tryGet()
+    BlockStore(RepoStore.new(ds, ds, clock = MockClock.new())),
+)
+
+commonBlockStoreTests(
+  "RepoStore compressed Sql backend",
+  proc(): BlockStore =
+    BlockStore(
+      RepoStore.new(
+        SQLiteDatastore.new(Memory).tryGet(),
+        SQLiteDatastore.new(Memory).tryGet(),
+        clock = MockClock.new(),
+        compression = true,
+      )
+    ),
+)
+
+commonBlockStoreTests(
+  "RepoStore sharded Sql backend",
+  proc(): BlockStore =
+    BlockStore(
+      RepoStore.new(
+        SQLiteDatastore.new(Memory).tryGet(),
+        SQLiteDatastore.new(Memory).tryGet(),
+        clock = MockClock.new(),
+        shards = @[Datastore(SQLiteDatastore.new(Memory).tryGet())],
+      )
+    ),
+)
+
 const path = currentSourcePath().parentDir / "test"
 
 proc before() {.async.} =
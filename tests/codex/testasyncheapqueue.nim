@@ -1,3 +1,5 @@
+import std/hashes
+
 import pkg/chronos
 import pkg/results
 
@@ -15,6 +17,9 @@ proc `<`*(a, b: Task): bool =
 proc `==`*(a, b: Task): bool =
   a.name == b.name
 
+proc hash*(a: Task): Hash =
+  hash(a.name)
+
 proc toSortedSeq[T](h: AsyncHeapQueue[T], queueType = QueueType.Min): seq[T] =
   var tmp = newAsyncHeapQueue[T](queueType = queueType)
   for d in h:
@@ -171,6 +176,38 @@ asyncchecksuite "Asynchronous Tests":
     check heap.update((name: "a", priority: 1))
     check heap[0] == (name: "a", priority: 1)
 
+  test "Test update both ways":
+    var heap = newAsyncHeapQueue[Task]()
+    let data = [("a", 4), ("b", 3), ("c", 2), ("d", 5), ("e", 6), ("f", 1)]
+
+    for item in data:
+      check heap.pushNoWait(item).isOk
+
+    check heap.update((name: "f", priority: 7))
+    check heap.update((name: "e", priority: 0))
+    check heap.update((name: "b", priority: 8))
+    check not heap.update((name: "g", priority: 0))
+
+    check heap.len == data.len
+    for name in ["a", "b", "c", "d", "e", "f"]:
+      let index = heap.find((name: name, priority: 0))
+      check index >= 0 and heap[index].name == name
+
+    var res: seq[string]
+    while heap.len > 0:
+      res.add(heap.popNoWait().tryGet().name)
+
+    check res == @["e", "c", "a", "d", "f", "b"]
+
+  test "Test pushNoWait updates queued items":
+    var heap = newAsyncHeapQueue[Task](2)
+    check heap.pushNoWait(("a", 4)).isOk
+    check heap.pushNoWait(("b", 3)).isOk
+    check heap.pushNoWait(("a", 1)).isOk
+
+    check heap.len == 2
+    check heap[0] == (name: "a", priority: 1)
+
   test "Test pushOrUpdate - update":
     var heap = newAsyncHeapQueue[Task](3)
     let data = [("a", 4), ("b", 3), ("c", 2)]
@@ -4,5 +4,6 @@ import ./blockexchange/testpeerctxstore
 import ./blockexchange/testdiscovery
 import ./blockexchange/testprotobuf
 import ./blockexchange/testpendingblocks
+import ./blockexchange/testaddresskeys
 
 {.warning[UnusedImport]: off.}
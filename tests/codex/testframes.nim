@@ -0,0 +1,74 @@
+import pkg/chronos
+import pkg/libp2p/protobuf/minprotobuf
+import pkg/libp2p/varint
+import pkg/questionable/results
+
+import pkg/codex/rest/frames
+import pkg/codex/merkletree
+import pkg/codex/blocktype as bt
+import pkg/codex/units
+
+import ../asynctest
+import ./helpers
+
+asyncchecksuite "Verified download frames":
+  var
+    blocks: seq[bt.Block]
+    tree: CodexTree
+    treeCid: Cid
+
+  setup:
+    blocks = await makeRandomBlocks(datasetSize = 4 * 256, blockSize = 256'nb)
+    tree = makeDataset(blocks).tryGet().tree
+    treeCid = tree.rootCid.tryGet()
+
+  proc frame(index: int): seq[byte] =
+    FrameHeader(
+      index: index, dataLen: blocks[index].data.len, proof: tree.getProof(index).tryGet()
+    ).encode() & blocks[index].data
+
+  test "should decode encoded frames":
+    let
+      encoded = frame(2)
+      (header, len) = FrameHeader.decode(encoded).tryGet()
+
+    check header.index == 2
+    check header.dataLen == blocks[2].data.len
+    check encoded[len ..^ 1] == blocks[2].data
+    check header.verify(encoded[len ..^ 1], treeCid).isOk
+
+  test "should fail on truncated headers":
+    let encoded = frame(1)
+    check FrameHeader.decode(encoded[0 ..< 10]).isErr
+
+  test "should reject corrupted data":
+    let
+      encoded = frame(1)
+      (header, len) = FrameHeader.decode(encoded).tryGet()
+
+    var data = encoded[len ..^ 1]
+    data[0] = data[0] xor 1
+    check header.verify(data, treeCid).isErr
+
+  test "should reject data of another leaf":
+    let (header, _) = FrameHeader.decode(frame(1)).tryGet()
+    check header.verify(blocks[0].data, treeCid).isErr
+
+  test "should fail on out of range index and data length":
+    proc header(index: uint64, dataLen: uint64): seq[byte] =
+      var pb = initProtoBuffer()
+      pb.write(1, index)
+      pb.write(2, dataLen)
+      pb.write(3, tree.getProof(0).tryGet().encode())
+      pb.finish
+
+      var
+        prefix: array[10, byte]
+        prefixLen: int
+      discard PB.putUVarint(prefix, prefixLen, pb.buffer.len.uint64)
+      @(prefix.toOpenArray(0, prefixLen - 1)) & pb.buffer
+
+    check FrameHeader.decode(header(0, 256)).isOk
+    check FrameHeader.decode(header(uint64.high, 256)).isErr
+    check FrameHeader.decode(header(0, uint64.high)).isErr
+    check FrameHeader.decode(header(0, int.high.uint64)).isErr
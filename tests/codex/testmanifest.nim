@@ -31,3 +31,14 @@ suite "Manifest":
 
     check:
       encodeDecode(large) == large
+
+  test "Should encode/decode protected manifest":
+    let protected = Manifest.new(
+      treeCid = Cid.example, blockSize = 1.MiBs, datasetSize = 100.MiBs, stripeSize = 8
+    )
+
+    check:
+      encodeDecode(protected) == protected
+      protected.stripesCount == 13
+      protected.leavesCount == 113
+      protected.stripeMembers(12) == @[96, 97, 98, 99, 112]
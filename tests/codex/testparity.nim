@@ -0,0 +1,30 @@
+import pkg/unittest2
+import pkg/questionable/results
+
+import pkg/codex/blocktype as bt
+import pkg/codex/parity
+import pkg/codex/units
+
+import ./examples
+
+suite "Parity":
+  test "Should rebuild any block of a stripe from the others":
+    let
+      blocks = @[
+        bt.Block.example(size = 1024),
+        bt.Block.example(size = 1024),
+        bt.Block.example(size = 1021),
+      ]
+      parity = parityBlock(blocks, 1024.NBytes).tryGet()
+
+    check parityBlock(@[blocks[0], blocks[2], parity], 1024.NBytes).tryGet().cid ==
+      blocks[1].cid
+
+    # Short blocks come back zero padded
+    let rebuilt = parityBlock(@[blocks[0], blocks[1], parity], 1024.NBytes).tryGet()
+    check:
+      rebuilt.data[0 ..< 1021] == blocks[2].data
+      rebuilt.data[1021 ..^ 1] == @[0'u8, 0, 0]
+
+  test "Should reject blocks larger than the block size":
+    check parityBlock(@[bt.Block.example(size = 1025)], 1024.NBytes).isFailure
@@ -0,0 +1,109 @@
+import pkg/unittest2
+import pkg/chronos
+import pkg/questionable
+import pkg/questionable/results
+
+import pkg/codex/units
+import pkg/codex/uploadsession
+
+import ./examples
+import ./helpers
+
+suite "Upload sessions":
+  var sessions: UploadSessions
+  var session: UploadSession
+
+  setup:
+    sessions = UploadSessions.new()
+    session = sessions.create(blockSize = 4.NBytes)
+
+  test "creates sessions with unique ids":
+    let other = sessions.create(blockSize = 4.NBytes)
+    check other.id != session.id
+    check sessions.len == 2
+    check (sessions.get(session.id) |? nil) == session
+
+  test "removes sessions":
+    sessions.remove(session.id)
+    check sessions.get(session.id).isNone
+
+  test "prunes idle sessions":
+    sessions.ttl = 0.seconds
+    session.lastActivity = Moment.now() - 1.seconds
+    sessions.prune()
+    check sessions.get(session.id).isNone
+
+  test "rejects unaligned part offsets":
+    check session.validatePart(0).tryGet == 0
+    check session.validatePart(8).tryGet == 2
+    check session.validatePart(3).isFailure
+    check session.validatePart(-4).isFailure
+
+  test "reports received and missing ranges":
+    session.addBlock(0, Cid.example)
+    session.addBlock(1, Cid.example)
+    session.addBlock(4, Cid.example)
+
+    check session.receivedRanges == @[(first: 0, last: 1), (first: 4, last: 4)]
+    check session.missingRanges == @[(first: 2, last: 3)]
+    check not session.isComplete
+
+  test "final part sets the end of the dataset":
+    session.addBlock(2, Cid.example)
+    check session.completePart(8, 3, final = true).isSuccess
+    check session.datasetSize == 11.some
+    check session.blocksCount == 3
+    check session.missingRanges == @[(first: 0, last: 1)]
+    check session.validatePart(12).isFailure
+
+  test "rejects parts conflicting with the end of the dataset":
+    session.addBlock(0, Cid.example)
+    check session.completePart(0, 2, final = true).isSuccess
+    check session.completePart(0, 3, final = true).isFailure
+    check session.completePart(4, 4).isFailure
+
+  test "rejects end of dataset before received blocks":
+    session.addBlock(3, Cid.example)
+    check session.completePart(0, 2, final = true).isFailure
+
+  test "rejects empty and short parts not flagged as final":
+    check session.completePart(8, 0).isFailure
+    check session.completePart(8, 0, final = true).isFailure
+    check session.completePart(8, 3).isFailure
+    check session.datasetSize.isNone
+
+    check session.completePart(8, 4).isSuccess
+    check session.datasetSize.isNone
+
+  test "rejects parts committed while finalizing":
+    session.finalizing = true
+    check session.addPart(0, 4, @[Cid.example], final = true).isFailure
+    check session.blocks.len == 0
+    check session.datasetSize.isNone
+
+  test "returns cids in dataset order once complete":
+    let cids = @[Cid.example, Cid.example, Cid.example]
+    session.addBlock(2, cids[2])
+    check session.orderedCids.isFailure
+
+    session.addBlock(0, cids[0])
+    session.addBlock(1, cids[1])
+    check session.orderedCids.isFailure
+
+    check session.completePart(8, 4, final = true).isSuccess
+    check session.orderedCids.tryGet == cids
+    check session.finalSize == 12
+
+  test "rejected parts leave the session untouched":
+    session.addBlock(2, Cid.example)
+    check session.completePart(8, 3, final = true).isSuccess
+
+    let cids = @[Cid.example, Cid.example, Cid.example, Cid.example]
+    check session.addPart(0, 16, cids).isFailure
+    check session.blocks.len == 1
+    check session.blocksCount == 3
+    check not session.withinDataset(3)
+
+    check session.addPart(0, 8, cids[0 .. 1]).isSuccess
+    check session.isComplete
+    check session.orderedCids.isSuccess
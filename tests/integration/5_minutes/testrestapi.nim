@@ -169,3 +169,22 @@ twonodessuite "REST API":
     discard (await client1.download(cid)).get
     response = await client1.hasBlock(cid)
     check response.get() == false
+
+  test "should return the status of many datasets at once", twoNodesConfig:
+    let
+      cid1 = (await client1.upload("some file contents")).get
+      cid2 = (await client2.upload("some other file contents")).get
+      status = (await client1.datasetsStatus(@[cid1, cid2])).get
+
+    check status.content.len == 2
+    check status.content[0].cid == cid1
+    check status.content[0].exists
+    check status.content[0].complete == true.some
+    check status.content[0].manifest.isSome
+    check status.content[1].cid == cid2
+    check not status.content[1].exists
+    check status.content[1].complete.isNone
+
+  test "should reject invalid cids in dataset status queries", twoNodesConfig:
+    let response = await client1.datasetsStatusRaw(@["invalid"])
+    check response.status == 400
@@ -1,4 +1,5 @@
 import std/strutils
+import std/sequtils
 
 from pkg/libp2p import Cid, `$`, init
 import pkg/stint
@@ -235,3 +236,21 @@ proc hasBlockRaw*(
 .} =
   let url = client.baseurl & "/data/" & cid & "/exists"
   return client.get(url)
+
+proc datasetsStatusRaw*(
+    client: CodexClient, cids: seq[string], manifest = true
+): Future[HttpClientResponseRef] {.
+    async: (raw: true, raises: [CancelledError, HttpError])
+.} =
+  let url = client.baseurl & "/datasets/status?manifest=" & $manifest
+  return client.post(url, body = $(%cids))
+
+proc datasetsStatus*(
+    client: CodexClient, cids: seq[Cid], manifest = true
+): Future[?!RestDatasetStatusList] {.async: (raises: [CancelledError, HttpError]).} =
+  let response = await client.datasetsStatusRaw(cids.mapIt($it), manifest)
+
+  if response.status != 200:
+    return failure($response.status)
+
+  RestDatasetStatusList.fromJson(await response.body)